@@ -90,6 +90,25 @@
 #include <numeric>      // For std::accumulate (sum)
 #include <algorithm>    // For std::min_element, std::max_element
 #include <cmath>        // For std::sqrt (for jitter)
+#include <set>          // Failed nodes, route check sources
+#include <iterator>     // For std::back_inserter
+#include <fstream>      // For the binary table snapshot file
+#include <sstream>      // To capture the Print*Table output of a node
+#include <string>
+#include <unordered_map> // Row dictionary of the table snapshots
+#include <queue>        // Priority queue of the Dijkstra shortest paths
+#include <deque>        // Frames buffered by the parents of the sleepy end devices
+#include <thread>       // To run the shortest path computations on all cores
+#include <limits>
+#include <tuple>        // Lexicographic ranking of the candidate parents
+#include <functional>   // Final reports executed when the run completes
+#include <cstdio>       // popen, to run child simulations in the automated searches
+#include <cstdlib>      // strtod/strtoul, to validate the --faults entries
+#include <mutex>
+#include <atomic>
+#include <cctype>       // std::tolower, to parse the roles
+#include <chrono>       // Prediction time of the surrogate model
+#include <unistd.h>     // readlink, to find the executable of the child simulations
 
 using namespace ns3;
 using namespace ns3::lrwpan;
@@ -105,6 +124,369 @@ uint32_t g_totalPacketsReceived = 0;
 uint32_t g_packetCounter = 0;           // Unique packet identifier
 std::map<uint32_t, Time> g_sendTimeMap; // Map to track packet send times
 std::vector<Time> g_delayList;          // List of end-to-end delays for received packets
+
+//Completion Tracking (the simulation stops when every packet is resolved)
+uint32_t g_sendsRemaining = 0;          // Scheduled SendData calls not executed yet
+uint32_t g_packetsDropped = 0;          // Packets confirmed as dropped (NLDE-DATA.confirm failure at the source)
+uint32_t g_packetsTimedOut = 0;         // Packets neither received nor dropped within the timeout
+bool g_stopOnCompletion = true;         // Stop as soon as all packets are resolved
+double g_packetTimeout = 5.0;           // Seconds after which an outstanding packet is considered lost
+bool g_finalReportsDone = false;
+std::vector<std::function<void()>> g_finalReports; // Reports printed (in order) at the end of the run
+struct NsduRequest
+{
+    std::vector<uint32_t> packetIds; // Packets carried by the frame (none for APS acks and replies)
+    double time;                     // Time of the NLDE-DATA.request [s]
+};
+std::map<std::pair<uint32_t, uint8_t>, NsduRequest> g_nsduHandleToPacket; // (Src Node ID, NSDU handle) -> request waiting for its confirm
+std::map<uint32_t, uint8_t> g_nextNsduHandle;                              // Src Node ID -> next NSDU handle to try
+
+//Sequential Early Stopping (batch means confidence intervals)
+bool g_earlyStop = false;               // Stop the traffic when the confidence intervals are narrow enough
+double g_ciRelWidth = 0.05;             // Target relative half-width of the 95% confidence intervals
+uint32_t g_ciBatchSize = 20;            // Packets per batch
+uint32_t g_ciMinBatches = 10;           // Batches required before testing convergence
+std::vector<int8_t> g_packetOutcome;    // Packet ID - 1 -> -1 outstanding, 0 lost, 1 received
+std::vector<uint32_t> g_batchResolved;  // PDR batch -> resolved packets of the batch
+uint32_t g_nextPdrBatch = 0;            // First PDR batch not complete yet
+std::vector<double> g_pdrBatchMeans;    // PDR of each complete batch (in send order)
+std::vector<double> g_delayBatch;       // Delays of the current latency batch (in reception order)
+std::vector<double> g_delayBatchMeans;  // Mean delay of each complete batch
+std::vector<double> g_delaySeries;      // Delays of all the received packets (in reception order, p99 sectioning)
+const uint32_t P99_SECTION_DELAYS = 500; // Minimum delays per section of the p99 interval (a p99 needs >> 100 samples)
+uint32_t g_earlyStopPackets = 0;        // Packets sent when the intervals converged (0 = not converged)
+Time g_earlyStopTime;
+
+//Windowed Metrics (time-series of the metrics per interval)
+std::ofstream g_metricsStream;          // Time-series file (closed if disabled)
+Time g_windowStart;                     // Start of the current window
+uint32_t g_windowSent = 0;              // Packets sent in the current window
+uint32_t g_windowReceived = 0;          // Packets received in the current window
+uint32_t g_windowLost = 0;              // Packets dropped or timed out in the current window
+uint64_t g_windowBytes = 0;             // Payload bytes received in the current window
+std::vector<double> g_windowDelays;     // Delays of the packets received in the current window [s]
+uint32_t g_metricsWindows = 0;          // Windows written
+
+//Airtime and Goodput (from the PHY state traces)
+enum AirtimeState : uint8_t
+{
+    AIRTIME_TX = 0, // Transmitting a frame (BUSY_TX)
+    AIRTIME_RX,     // Receiving a frame (BUSY_RX)
+    AIRTIME_BUSY,   // Transceiver turnaround / busy (TX_ON, BUSY)
+    AIRTIME_IDLE,   // Listening to an idle channel (RX_ON)
+    AIRTIME_OFF,    // Transceiver off
+    AIRTIME_NUM_STATES
+};
+struct AirtimeStats
+{
+    Time inState[AIRTIME_NUM_STATES]; // Time spent in each state since the start of the measurement
+    AirtimeState state = AIRTIME_OFF; // Current state
+    Time since;                       // Time of the last state change
+    uint32_t txFrames = 0;            // Frames transmitted (data, commands, beacons, ACKs)
+    uint64_t txAirtimeBytes = 0;      // Bytes transmitted on air (PPDU: SHR + PHR + PSDU)
+    uint32_t controlFrames = 0;       // MAC data frames not carrying a tracked packet (NWK commands, link status, ...)
+};
+struct FlowGoodput
+{
+    uint64_t payloadBytes = 0; // Payload bytes delivered
+    double firstSend = -1;     // Send time of the first packet of the flow [s]
+    double lastReceive = 0;    // Reception time of the last packet delivered [s]
+};
+const uint32_t PHY_SHR_PHR_BYTES = 6;   // Synchronization header (5 bytes) and PHY header (1 byte) of every PPDU
+std::vector<AirtimeStats> g_airtime;    // Node ID -> airtime statistics
+uint32_t g_activeTransmitters = 0;      // Nodes transmitting right now
+Time g_channelBusySince;                // Start of the current period with at least one transmission
+Time g_channelBusyTime;                 // Time with at least one transmission on the channel
+Time g_airtimeStart;                    // Start of the airtime measurement
+std::vector<uint16_t> g_packetSrc;      // Packet ID - 1 -> source Node ID
+std::map<std::pair<uint16_t, uint16_t>, FlowGoodput> g_flowGoodput; // (Src, Dst) -> goodput counters
+
+//Warm-up Detection (MSER-5)
+std::vector<double> g_packetSendTime;   // Packet ID - 1 -> send time [s]
+std::vector<double> g_packetDelay;      // Packet ID - 1 -> end-to-end delay [s] (negative if not received)
+
+//Table Snapshots (delta encoded time-series of every node's tables)
+std::ofstream g_snapshotStream;                               // Binary snapshot file (closed if disabled)
+std::unordered_map<std::string, uint32_t> g_snapshotRowIds;   // Row text -> row ID (dictionary written once per row)
+std::map<std::pair<uint32_t, uint8_t>, std::vector<uint32_t>> g_snapshotState; // (Node ID, table) -> row IDs of the last snapshot (printed order)
+uint32_t g_snapshotCount = 0;
+
+//Data Path Recording (real forwarding path of every tracked packet)
+struct PathStats
+{
+    uint32_t count = 0;     // Packets delivered over this path
+    double sumDelay = 0;    // Sum of their delays [s]
+    double sumSqDelay = 0;  // Sum of the squared delays [s^2]
+    double maxDelay = 0;    // Maximum delay [s]
+};
+std::unordered_map<uint32_t, std::vector<uint16_t>> g_pathInFlight; // Packet ID -> Node IDs traversed so far
+std::map<std::vector<uint16_t>, uint32_t> g_pathIds;                // Path -> path ID (each distinct path stored once)
+std::vector<const std::vector<uint16_t>*> g_paths;                  // Path ID -> path
+std::map<std::pair<uint16_t, uint16_t>, std::map<uint32_t, PathStats>> g_flowPaths; // (Src, Dst) -> path ID -> stats
+uint32_t g_rareEventEffort = 0;   // Trajectories per level of the rare-event loss estimation (0 = disabled)
+
+//Link Model (used by the analyses that need the physical topology)
+Ptr<PropagationLossModel> g_propModel;        // Propagation loss model of the channel
+const double LINK_TX_POWER_DBM = 0.0;         // Tx power of the LR-WPAN PHY (ns-3 default)
+const double LINK_RX_SENSITIVITY_DBM = -106.58; // Rx sensitivity of the LR-WPAN PHY (ns-3 default)
+double g_rxSensitivityDbm = LINK_RX_SENSITIVITY_DBM; // Rx sensitivity of every PHY (--rxSensitivity)
+double g_snrOffsetDb = 0;                     // SNR shift of every link from the start of the traffic (--snrOffset)
+double g_snrOffsetStart = 0;                  // Start of the traffic, when the SNR shift begins [s]
+const double LINK_NOISE_FLOOR_DBM = -110.98;  // Thermal noise in the 2 MHz O-QPSK channel (-174 dBm/Hz + 10log10(2 MHz))
+const uint32_t LINK_FRAME_BITS = 30 * 8;      // Data frame used to evaluate links (PHY + MAC + NWK headers and 5-byte payload)
+
+//Route Consistency Checker
+std::map<uint32_t, std::string> g_routeIssues; // Destination Node ID -> description of its current routing issues (empty = consistent)
+uint32_t g_routeChecks = 0;                     // Number of network-wide checks performed
+uint32_t g_routeIssuesFormed = 0;               // Number of times a destination went from consistent to inconsistent
+uint32_t g_routeLoopsFound = 0;                 // Number of checks in which a routing loop was present (summed over destinations)
+uint32_t g_routeBlackHolesFound = 0;            // Number of checks in which a black hole was present (summed over destinations)
+
+//Random Streams (common random numbers): every node owns a fixed block of streams, whatever the configuration
+const int64_t STREAMS_PER_NODE = 100;       // Node i: streams [i * 100, i * 100 + 100)
+const int64_t STREAM_OFFSET_DEVICE = 0;     // LR-WPAN MAC and PHY (CSMA/CA backoffs, ...)
+const int64_t STREAM_OFFSET_NWK = 50;       // Zigbee NWK (jitter of broadcasts and route requests, ...)
+const int64_t STREAM_OFFSET_TRAFFIC = 90;   // Traffic source of the node (send jitter)
+double g_sendJitter = 0;                    // Random send time variation, as a fraction of the interval (0 = periodic)
+std::vector<Ptr<UniformRandomVariable>> g_trafficRng; // Node ID -> send jitter of its traffic source
+
+//Sleepy End Devices (indirect transmission through the parent)
+struct BufferedFrame
+{
+    uint32_t packetId;
+    uint16_t child;   // Sleepy end device the frame is for
+    Ptr<Packet> packet;
+    double arrival;   // Arrival in the parent buffer [s]
+    EventId expiry;   // End of its persistence time in the buffer
+};
+struct ParentBuffer
+{
+    std::deque<BufferedFrame> frames;
+    double lastChange = 0;    // Last change of the occupancy [s]
+    double occupancyArea = 0; // Integral of the occupancy over time [frames * s]
+    uint32_t maxOccupancy = 0;
+};
+double g_pollInterval = 1.0;                       // Seconds between two polls of a sleepy end device
+double g_pollAwake = 0.1;                          // Seconds the receiver stays on after a poll (or a frame)
+double g_bufferPersistence = 7.68;                 // Seconds a frame waits in the parent (macTransactionPersistenceTime)
+std::map<uint16_t, ParentBuffer> g_parentBuffers;  // Parent Node ID -> frames buffered for its sleepy children
+std::map<uint32_t, uint16_t> g_sleepyDownlink;     // Packet ID -> sleepy Node ID (packet on its way to the parent)
+std::vector<uint32_t> g_sleepyPackets;             // Packets sent to sleepy end devices
+std::vector<double> g_bufferHoldTimes;             // Time spent in the parent buffer by every forwarded frame [s]
+std::map<uint16_t, EventId> g_sleepEvents;         // Sleepy Node ID -> end of its awake period
+std::map<uint16_t, double> g_awakeUntil;           // Sleepy Node ID -> end of its awake period [s]
+std::map<uint16_t, double> g_awakeTime;            // Sleepy Node ID -> receiver on time [s]
+std::map<uint16_t, double> g_firstPoll;            // Sleepy Node ID -> time of its first poll [s]
+uint32_t g_polls = 0;
+uint32_t g_pollsWithData = 0;
+uint32_t g_bufferExpired = 0;
+uint64_t g_pollAirtimeBytes = 0;
+
+//Fault Injection
+struct FaultEvent
+{
+    enum Kind
+    {
+        NODE,
+        LINK,
+        COORDINATOR
+    };
+    Kind kind = NODE;
+    uint16_t a = 0;              // Failed node, or first node of the failed link
+    uint16_t b = 0;              // Second node of the failed link
+    double start = 0;            // Start of the fault [s]
+    double duration = -1;        // Duration of the fault [s] (negative = permanent)
+    std::vector<std::pair<uint16_t, uint16_t>> affectedFlows; // (Src, Dst) whose dominant path used the failed element
+    double repairTime = -1;      // Route repair latency [s] (negative = not repaired)
+    std::vector<uint16_t> repairPath; // Path of the first delivery after the repair
+};
+std::vector<FaultEvent> g_faults;
+std::set<uint16_t> g_nodesDown;                              // Nodes powered off
+std::map<std::pair<uint16_t, uint16_t>, double> g_linkFades; // (Node ID, Node ID) -> start of the fade [s]
+double g_fadeTime = 5.0;                                     // Duration of the fade of a link [s]
+double g_recoveryWindow = 5.0;                               // Window of the PDR recovery measurement [s]
+double g_recoverySlo = 0;                                    // Recovery time objective [s] (0 = none)
+const int64_t STREAM_FAULTS = 1 << 20;                       // Stream of the random faults (after the node blocks)
+const int64_t STREAM_PLACEMENT = STREAM_FAULTS + 1;          // Streams of the router placement search (uniform, normal)
+const int64_t STREAM_SURROGATE = STREAM_FAULTS + 3;          // Stream of the random surrogate configurations
+
+//Topology and Collection Traffic
+size_t g_routingTableHeaderRows = 0;     // Rows printed by an empty routing table (header)
+uint32_t g_mtoDiscoveries = 0;           // Many-to-one route discoveries started by the concentrator
+
+//Broadcast Traffic (flooding to all devices, routers only or rx-on-when-idle devices)
+struct BroadcastStats
+{
+    double sendTime = 0;          // Send time [s]
+    uint16_t src = 0;             // Originator Node ID
+    std::vector<bool> expected;   // Node ID -> must receive the broadcast (depends on the broadcast address)
+    std::vector<bool> delivered;  // Node ID -> the NWK delivered it to the application
+    std::vector<bool> heard;      // Node ID -> the MAC received at least one copy
+    bool originatorSent = false;  // The first transmission of the originator was seen
+    uint32_t numExpected = 0;
+    uint32_t numDelivered = 0;    // Expected nodes that got it
+    double completeTime = -1;     // Time the last expected node got it [s] (-1 = never)
+};
+bool g_broadcastMode = false;                          // The sources broadcast instead of sending to the destination
+Mac16Address g_broadcastAddr("FF:FF");                 // FF:FF all devices, FF:FC routers and coordinator, FF:FD rx-on-when-idle
+uint8_t g_broadcastRadius = 0;                         // NWK radius of the broadcasts (0 = 2 * max depth)
+std::unordered_map<uint32_t, BroadcastStats> g_broadcasts; // Packet ID -> broadcast statistics
+std::vector<std::vector<uint16_t>> g_broadcastNeighbors;   // Node ID -> nodes in radio range (from the link model)
+std::vector<uint32_t> g_broadcastTx;                   // Node ID -> transmissions of tracked broadcast frames
+std::vector<uint32_t> g_broadcastRebroadcasts;         // Node ID -> transmissions other than the originator's first one
+std::vector<uint32_t> g_broadcastRedundant;            // Node ID -> rebroadcasts when every expected neighbor already had it
+
+//Request/Response Traffic (the destination answers every request)
+struct PendingReply
+{
+    std::vector<uint16_t> forwardPath; // Node IDs traversed by the request
+    std::vector<uint16_t> reversePath; // Node IDs traversed by the reply so far
+    double requestDelay = 0;           // One-way delay of the request [s]
+    double replySendTime = 0;          // [s]
+};
+bool g_respond = false;                                   // The destination replies to every request
+std::unordered_map<uint32_t, PendingReply> g_replyPending; // Request packet ID -> reply in flight
+uint32_t g_repliesSent = 0;
+uint32_t g_repliesReceived = 0;
+uint32_t g_repliesLost = 0;                               // Replies not received within the packet timeout
+uint32_t g_asymmetricExchanges = 0;                       // Reply path != reversed request path
+std::vector<double> g_rttList;                            // Round-trip times [s]
+std::vector<double> g_requestDelays;                      // One-way delays of the answered requests [s]
+std::vector<double> g_replyDelays;                        // One-way delays of their replies [s]
+std::vector<int32_t> g_hopDifference;                     // Reply hops - request hops of every exchange
+
+//APS Layer (end-to-end acknowledged delivery with retries, emulated on top of the NWK)
+struct ApsPending
+{
+    Ptr<ZigbeeStack> src;  // Originator
+    Ptr<ZigbeeStack> dst;  // Destination
+    uint8_t counter = 0;   // APS counter of the frame
+    uint32_t attempts = 0; // Transmissions so far
+    uint32_t arrived = 0;  // Attempt of the first frame that reached the destination (0 = none yet)
+    EventId ackTimer;      // apsAckWaitDuration timer
+};
+bool g_aps = false;                                  // Data is sent over the APS layer (acknowledged)
+uint32_t g_apsMaxRetries = 3;                        // apsMaxFrameRetries
+double g_apsAckWait = 1.0;                           // apsAckWaitDuration [s]
+std::unordered_map<uint32_t, ApsPending> g_apsPending;       // Packet ID -> frame waiting for its APS ack
+std::map<std::pair<uint16_t, uint8_t>, uint32_t> g_apsCounterToPacket; // (Src Node ID, APS counter) -> Packet ID
+std::map<uint16_t, uint8_t> g_apsCounter;                     // Node ID -> next APS counter
+std::map<std::pair<uint16_t, uint8_t>, double> g_apsDuplicateTable; // (Src short address key, APS counter) -> reception time [s]
+std::unordered_map<uint64_t, uint32_t> g_apsFrameUids;        // Packet UID -> 0 for APS acks, attempt number for data frames
+std::vector<uint32_t> g_apsDeliveredAtAttempt;                // Attempt number -> frames delivered at that attempt
+std::vector<double> g_apsFirstAttemptDelays;                  // Delays of the frames delivered at the first attempt [s]
+std::vector<double> g_apsRetriedDelays;                       // Delays of the frames delivered after retries [s]
+uint32_t g_apsRetransmissions = 0;
+uint32_t g_apsAcksSent = 0;
+uint32_t g_apsAcksReceived = 0;
+uint32_t g_apsDuplicates = 0;                                 // Retransmissions rejected as duplicates by the destination
+uint32_t g_apsFailures = 0;                                   // Frames never acknowledged (retries exhausted)
+uint64_t g_apsAirtimeBytes[3] = {0, 0, 0};                    // Bytes on air: first attempts, retransmissions, acks
+
+//In-network Aggregation (collection traffic: routers merge the readings of their children toward the coordinator)
+const uint32_t READING_BYTES = 5;          // Reading: packet ID (4 bytes, big endian) + sample (1 byte)
+const uint32_t MAX_NSDU_BYTES = 92;        // 127-byte PHY frame - MAC header and FCS (11) - NWK header (24, IEEE addresses)
+struct AggregationBuffer
+{
+    std::vector<std::pair<uint32_t, double>> readings; // (Packet ID, arrival time [s]) waiting to be merged
+    EventId flushTimer;                                // End of the aggregation window
+};
+bool g_aggregation = false;                        // Routers aggregate the readings of their children
+double g_aggWindow = 1.0;                          // Aggregation window [s] (from the first reading in the buffer)
+uint32_t g_aggMaxReadings = 16;                    // Readings per aggregated frame (at most MAX_NSDU_BYTES / READING_BYTES)
+std::map<uint16_t, AggregationBuffer> g_aggBuffers; // Aggregator Node ID -> buffer
+uint32_t g_aggFrames = 0;                          // Aggregated frames sent to the coordinator
+uint32_t g_aggReadings = 0;                        // Readings sent inside aggregated frames
+double g_aggHoldTime = 0;                          // Sum of the time the readings waited in the buffers [s]
+std::unordered_map<uint64_t, std::vector<uint32_t>> g_frameReadings; // Packet UID -> readings carried by an untagged frame
+
+//Source Batching (a source accumulates its readings before issuing the NLDE-DATA.request)
+struct BatchBuffer
+{
+    Ptr<ZigbeeStack> dst;           // Destination of the batch
+    std::vector<uint32_t> readings; // Packet IDs waiting at the source
+    EventId flushTimer;             // Age limit of the batch
+};
+bool g_batching = false;
+double g_batchWindow = 1.0;                     // Maximum age of the oldest reading of a batch [s]
+uint32_t g_batchMaxReadings = 16;               // Readings per batch (at most MAX_NSDU_BYTES / READING_BYTES)
+std::map<uint16_t, BatchBuffer> g_batchBuffers; // Source Node ID -> batch being filled
+uint32_t g_batchFrames = 0;                     // Batches sent
+
+//Parent Selection (candidate parents ranked in NwkNetworkDiscoveryConfirm)
+struct ParentCandidate
+{
+    double sinrDb = 0;              // Best beacon SINR [dB] (the LQI of the neighbor table entry is derived from it)
+    uint8_t depth = 0;              // Depth advertised in the beacon payload
+    bool routerCapacity = false;    // Beacon payload: the candidate accepts another router
+    bool endDeviceCapacity = false; // Beacon payload: the candidate accepts another end device
+};
+std::string g_parentPolicy = "first";  // first (NWK default), lqi, depth or score
+double g_parentMinSinr = 3.0;          // Beacon SINR below which a candidate is only used if there is no other [dB]
+std::map<uint16_t, std::map<uint16_t, ParentCandidate>> g_parentCandidates; // Node ID -> (beacon sender Node ID -> candidate)
+std::map<uint16_t, uint16_t> g_chosenParent;             // Node ID -> parent chosen by the policy (direct join)
+std::map<uint16_t, NlmeJoinRequestParams> g_directJoins; // Node ID -> join request issued once the direct join is confirmed
+std::map<uint16_t, uint16_t> g_parentOf;     // Node ID -> parent Node ID (after the join)
+std::map<uint16_t, uint32_t> g_nodeDepth;    // Node ID -> depth in the tree (coordinator: 0)
+
+//Role Table (filled in main from the scenario: built-in topology, grid, --roles or --topologyFile)
+enum NodeRole : uint8_t
+{
+    ROLE_COORDINATOR = 0,
+    ROLE_ROUTER,
+    ROLE_END_DEVICE
+};
+struct NodeConfig
+{
+    NodeRole role = ROLE_END_DEVICE;
+    bool rxOnWhenIdle = true; // End devices only: false for a device that turns its receiver off when idle
+};
+std::vector<NodeConfig> g_roles; // Node ID -> role and options
+
+//* Role of a node (O(1) lookup in the role table)
+static bool
+IsRouterNode(uint32_t nodeId)
+{
+    return g_roles[nodeId].role == ROLE_ROUTER;
+}
+
+static bool
+IsEndDeviceNode(uint32_t nodeId)
+{
+    return g_roles[nodeId].role == ROLE_END_DEVICE;
+}
+
+//* Parses a role of the scenario: "zc", "zr" or "zed" (also "c", "r", "e"), optionally followed by ":rxoff"
+static bool
+ParseNodeConfig(std::string text, NodeConfig& config)
+{
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    std::string option;
+    size_t colon = text.find(':');
+    if (colon != std::string::npos)
+    {
+        option = text.substr(colon + 1);
+        text = text.substr(0, colon);
+    }
+    if (text == "zc" || text == "c")
+    {
+        config.role = ROLE_COORDINATOR;
+    }
+    else if (text == "zr" || text == "r")
+    {
+        config.role = ROLE_ROUTER;
+    }
+    else if (text == "zed" || text == "e")
+    {
+        config.role = ROLE_END_DEVICE;
+    }
+    else
+    {
+        return false;
+    }
+    config.rxOnWhenIdle = (option != "rxoff");
+    return option.empty() || (option == "rxoff" && config.role == ROLE_END_DEVICE);
+}
 //Packet Tag
 class PacketIdTag : public Tag
 {
@@ -138,6 +520,135 @@ private:
     uint32_t m_packetId;
 };
 
+//Poll Tag (sleepy end devices): marks the poll of a sleepy end device to its parent
+class PollTag : public Tag
+{
+public:
+    static TypeId GetTypeId(void)
+    {
+        static TypeId tid = TypeId("PollTag")
+                                .SetParent<Tag>()
+                                .AddConstructor<PollTag>();
+        return tid;
+    }
+    TypeId GetInstanceTypeId() const override { return GetTypeId(); }
+    uint32_t GetSerializedSize() const override { return sizeof(uint16_t); }
+    void Serialize(TagBuffer i) const override
+    {
+        i.WriteU16(m_nodeId);
+    }
+    void Deserialize(TagBuffer i) override
+    {
+        m_nodeId = i.ReadU16();
+    }
+    void Print(std::ostream& os) const override
+    {
+        os << "Poll from Node " << m_nodeId;
+    }
+
+    void SetNodeId(uint16_t id) { m_nodeId = id; }
+    uint16_t GetNodeId() const { return m_nodeId; }
+
+private:
+    uint16_t m_nodeId = 0;
+};
+
+//Reply Tag (request/response traffic): carries the ID of the request a reply answers
+class ResponseTag : public Tag
+{
+public:
+    static TypeId GetTypeId(void)
+    {
+        static TypeId tid = TypeId("ResponseTag")
+                                .SetParent<Tag>()
+                                .AddConstructor<ResponseTag>();
+        return tid;
+    }
+    TypeId GetInstanceTypeId() const override { return GetTypeId(); }
+    uint32_t GetSerializedSize() const override { return sizeof(uint32_t); }
+    void Serialize(TagBuffer i) const override
+    {
+        i.WriteU32(m_requestId);
+    }
+    void Deserialize(TagBuffer i) override
+    {
+        m_requestId = i.ReadU32();
+    }
+    void Print(std::ostream& os) const override
+    {
+        os << "RequestId=" << m_requestId;
+    }
+
+    void SetRequestId(uint32_t id) { m_requestId = id; }
+    uint32_t GetRequestId() const { return m_requestId; }
+
+private:
+    uint32_t m_requestId;
+};
+
+//APS Frame Header (data and acknowledgement frames, unicast with endpoint addressing)
+//Frame control (1) | Dst endpoint (1) | Cluster ID (2) | Profile ID (2) | Src endpoint (1) | APS counter (1)
+class ApsFrameHeader : public Header
+{
+public:
+    enum FrameType : uint8_t
+    {
+        APS_DATA = 0x00,
+        APS_ACK = 0x02
+    };
+
+    static TypeId GetTypeId(void)
+    {
+        static TypeId tid = TypeId("ApsFrameHeader")
+                                .SetParent<Header>()
+                                .AddConstructor<ApsFrameHeader>();
+        return tid;
+    }
+    TypeId GetInstanceTypeId() const override { return GetTypeId(); }
+    uint32_t GetSerializedSize() const override { return 8; }
+    void Serialize(Buffer::Iterator i) const override
+    {
+        i.WriteU8(m_frameType | (m_ackRequest ? 0x40 : 0x00));
+        i.WriteU8(m_dstEndpoint);
+        i.WriteHtonU16(m_clusterId);
+        i.WriteHtonU16(m_profileId);
+        i.WriteU8(m_srcEndpoint);
+        i.WriteU8(m_counter);
+    }
+    uint32_t Deserialize(Buffer::Iterator i) override
+    {
+        uint8_t frameControl = i.ReadU8();
+        m_frameType = static_cast<FrameType>(frameControl & 0x03);
+        m_ackRequest = (frameControl & 0x40) != 0;
+        m_dstEndpoint = i.ReadU8();
+        m_clusterId = i.ReadNtohU16();
+        m_profileId = i.ReadNtohU16();
+        m_srcEndpoint = i.ReadU8();
+        m_counter = i.ReadU8();
+        return GetSerializedSize();
+    }
+    void Print(std::ostream& os) const override
+    {
+        os << (m_frameType == APS_ACK ? "APS ACK" : "APS DATA") << " counter=" << static_cast<uint32_t>(m_counter);
+    }
+
+    void SetFrameType(FrameType type) { m_frameType = type; }
+    FrameType GetFrameType() const { return m_frameType; }
+    void SetAckRequest(bool ackRequest) { m_ackRequest = ackRequest; }
+    bool GetAckRequest() const { return m_ackRequest; }
+    void SetCounter(uint8_t counter) { m_counter = counter; }
+    uint8_t GetCounter() const { return m_counter; }
+
+private:
+    FrameType m_frameType = APS_DATA;
+    bool m_ackRequest = false;
+    uint8_t m_dstEndpoint = 1;
+    uint16_t m_clusterId = 0x0006;  // On/Off cluster (command/acknowledge traffic)
+    uint16_t m_profileId = 0x0104;  // Home Automation profile
+    uint8_t m_srcEndpoint = 1;
+    uint8_t m_counter = 0;
+};
+
 //* TraceRoute Function
 //* Purpose:
 //* This function traces the route from a source to a destination in a Zigbee network by querying the routing tables of intermediate nodes.
@@ -274,266 +785,5878 @@ static void ScheduleTraceRouteWrapper(Ptr<ZigbeeStack> srcStack, Ptr<ZigbeeStack
     TraceRoute(srcAddr, dstAddr); // Call the original TraceRoute function with the currently retrieved addresses
 }
 
-//* NwkDataIndication Function
-//Purpose: This is a callback function that is invoked when a Zigbee node receives a data packet.
-//What it does:
-//Prints a message to the console indicating that a packet has been received, the receiving node's ID, and the packet size.
-static void 
- NwkDataIndication(Ptr<ZigbeeStack> stack, NldeDataIndicationParams params, Ptr<Packet> p)
+//* Route Consistency Checker
+//* Purpose:
+//* For a given destination, the next hop returned by FindRoute on every node defines a functional graph
+//* (each node has at most one successor). This checker builds that graph for every destination and classifies all
+//* nodes in O(N) per destination (each node is walked only once):
+//*  - REACHES:    following the next hops leads to the destination.
+//*  - NO ROUTE:   the walk ends at a node without a route (FF:FF) or with a next hop that is not a node of the network.
+//*  - IN LOOP / TO LOOP: the node is part of a routing cycle, or its route leads into one.
+//* A node without route is a BLACK HOLE only when another node uses it as next hop (the packet is forwarded to it and dies),
+//* otherwise it simply never needed a route to that destination.
+enum RouteOutcome : int8_t
 {
-    PacketIdTag tag;
-    if (p->PeekPacketTag(tag)) // Check if the packet has our tag
-    {
-        uint32_t packetId = tag.GetPacketId();
-        if (packetId > 0) // Ensure the ID is valid
-        {
-            auto it = g_sendTimeMap.find(packetId); // Search for the send time in the map
-            if (it != g_sendTimeMap.end()) // Found?
-            {
-                Time sendTime = it->second;          // Recorded send time
-                Time currentTime = Simulator::Now(); // Current reception time
-                Time delay = currentTime - sendTime; // Calculate latency
+    ROUTE_UNVISITED = 0,
+    ROUTE_REACHES,
+    ROUTE_NO_ROUTE,
+    ROUTE_IN_LOOP,
+    ROUTE_TO_LOOP
+};
 
-                g_delayList.push_back(delay);        // Add latency to the list
-                g_totalPacketsReceived++;            // Increment *valid* received packets
-                g_sendTimeMap.erase(it);             // Remove the entry from the map (packet handled)
+static const int32_t NEXT_HOP_NONE = -1; // FindRoute returned FF:FF or an address that is not a node of the network
 
-                // More detailed log on reception
-                NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " | NwkDataIndication: Received Packet ID: "
-                            << packetId << " | Size: " << p->GetSize() << " | Delay: " << delay.GetSeconds() << " s");
-                std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
-                          << "NwkDataIndication: Received Packet ID: " << packetId << " | Delay: " << delay.GetSeconds() << " s\n";
-            }
-            else
-            {
-                // Packet received but ID not found in the map (could happen if the packet arrives after a long time or there's an error)
-                 NS_LOG_WARN("Node " << stack->GetNode()->GetId() << " | NwkDataIndication: Received Packet ID: " << packetId << " but no send time found!");
-                 std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
-                          << "NwkDataIndication: Received Packet ID: " << packetId << " NO SEND TIME!\n";
-            }
-        } else {
-             NS_LOG_WARN("Node " << stack->GetNode()->GetId() << " | NwkDataIndication: Received packet with invalid ID (0) in tag.");
-             std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
-                          << "NwkDataIndication: Received packet with invalid ID tag.\n";
-        }
-    }
-    else
-    {
-         NS_LOG_WARN("Node " << stack->GetNode()->GetId() << " | NwkDataIndication: Received packet without PacketIdTag.");
-          std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
-                          << "NwkDataIndication: Received packet NO TAG.\n";
-    }
+//* Converts a short address to an integer key (used for O(1) lookups)
+static uint16_t
+AddrKey(Mac16Address addr)
+{
+    uint8_t buffer[2];
+    addr.CopyTo(buffer);
+    return static_cast<uint16_t>((buffer[0] << 8) | buffer[1]);
 }
 
-//* NwkNetworkFormationConfirm Function
-//Purpose: This is a callback function that is invoked when the network formation process (by the coordinator) is confirmed.
-//What it does:
-//Prints the status of the network formation (e.g., success or failure).
-static void
-NwkNetworkFormationConfirm(Ptr<ZigbeeStack> stack, NlmeNetworkFormationConfirmParams params)
+//* End devices do not route: the NWK of an end device always sends to its parent
+static bool
+IsEndDevice(Ptr<ZigbeeStack> stack)
 {
-    std::cout << "\nNlmeNetworkFormationConfirmStatus = " << params.m_status << "\n";
+    return IsEndDeviceNode(stack->GetNode()->GetId());
 }
 
-
-//* NwkNetworkDiscoveryConfirm Function
-//Purpose: This is a callback function that is invoked when the network discovery process (by end devices) is confirmed.
-//What it does:
-//1. Checks if the discovery was successful.
-//2. If successful, it prints the details of the discovered networks (Extended PAN ID, channel, PAN ID, stack profile).
-//3. It then prepares a NlmeJoinRequestParams to join the discovered network.
-//4. It schedules the NlmeJoinRequest to join the network.
-static void
-NwkNetworkDiscoveryConfirm(Ptr<ZigbeeStack> stack, NlmeNetworkDiscoveryConfirmParams params)
+//* Returns the stacks of zigbeeStacks indexed by position, and fills addrToIndex (short address key -> index)
+static std::vector<Ptr<ZigbeeStack>>
+IndexStacks(std::unordered_map<uint16_t, int32_t>& addrToIndex)
 {
-    // See Zigbee Specification r22.1.0, 3.6.1.4.1
-    // This method implements a simplistic version of the method implemented
-    // in a zigbee APL layer. In this layer a candidate Extended PAN Id must
-    // be selected and a NLME-JOIN.request must be issued.
-
-    if (params.m_status == NwkStatus::SUCCESS)
+    std::vector<Ptr<ZigbeeStack>> stacks;
+    addrToIndex.clear();
+    for (auto i = zigbeeStacks.Begin(); i != zigbeeStacks.End(); i++)
     {
-        std::cout << " Network discovery confirm Received. Networks found ("
-                  << params.m_netDescList.size() << "):\n";
-
-        for (const auto& netDescriptor : params.m_netDescList)
+        Mac16Address addr = (*i)->GetNwk()->GetNetworkAddress();
+        if (addr != Mac16Address("FF:FF"))
         {
-            std::cout << " ExtPanID: 0x" << std::hex << netDescriptor.m_extPanId << "\n"
-                      << std::dec << " CH:  " << static_cast<uint32_t>(netDescriptor.m_logCh)
-                      << "\n"
-                      << std::hex << " Pan ID: 0x" << netDescriptor.m_panId << "\n"
-                      << " Stack profile: " << std::dec
-                      << static_cast<uint32_t>(netDescriptor.m_stackProfile) << "\n"
-                      << "--------------------\n";
+            addrToIndex[AddrKey(addr)] = stacks.size();
         }
+        stacks.push_back(*i);
+    }
+    return stacks;
+}
 
-        NlmeJoinRequestParams joinParams;
+//* Builds the next hop (functional) graph toward the node with index dstIndex:
+//* next[v] = index of the next hop of node v, dstIndex for the destination itself, or NEXT_HOP_NONE.
+static std::vector<int32_t>
+BuildNextHopGraph(const std::vector<Ptr<ZigbeeStack>>& stacks,
+                  const std::unordered_map<uint16_t, int32_t>& addrToIndex,
+                  uint32_t dstIndex)
+{
+    Mac16Address dst = stacks[dstIndex]->GetNwk()->GetNetworkAddress();
+    std::vector<int32_t> next(stacks.size(), NEXT_HOP_NONE);
 
-        zigbee::CapabilityInformation capaInfo;
-        // Set device type based on node ID (Nodes 0-4 are Routers, 5-9 are End Devices)
-        if (stack->GetNode()->GetId() >= 1 && stack->GetNode()->GetId() <= 4) // Nodes 1 to 4 are routers
+    for (uint32_t v = 0; v < stacks.size(); v++)
+    {
+        if (v == dstIndex)
         {
-            NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " joining as ROUTER");
-            capaInfo.SetDeviceType(ROUTER);
-        } 
-        else if (stack->GetNode()->GetId() >= 5 && stack->GetNode()->GetId() <= 9) // Nodes 5 to 9 are end devices
+            next[v] = dstIndex;
+            continue;
+        }
+        if (stacks[v]->GetNwk()->GetNetworkAddress() == Mac16Address("FF:FF"))
         {
-            NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " joining as END DEVICE");
-            capaInfo.SetDeviceType(ENDDEVICE);
+            continue; // Not joined (yet)
         }
-        capaInfo.SetAllocateAddrOn(true);
 
-        joinParams.m_rejoinNetwork = zigbee::JoiningMethod::ASSOCIATION;
-        joinParams.m_capabilityInfo = capaInfo.GetCapability();
-        joinParams.m_extendedPanId = params.m_netDescList[0].m_extPanId;
+        bool neighbor = false;
+        Mac16Address nextHopAddr = stacks[v]->GetNwk()->FindRoute(dst, neighbor);
+        if (nextHopAddr == Mac16Address("FF:FF") && IsEndDevice(stacks[v]))
+        {
+            // End devices send everything to their parent
+            Ptr<LrWpanNetDevice> dev = DynamicCast<LrWpanNetDevice>(stacks[v]->GetNode()->GetDevice(0));
+            nextHopAddr = dev->GetMac()->GetCoordShortAddress();
+        }
 
-        Simulator::ScheduleNow(&ZigbeeNwk::NlmeJoinRequest, stack->GetNwk(), joinParams);
-    }
-    else
-    {
-        NS_ABORT_MSG("Unable to discover networks | status: " << params.m_status);
+        auto it = addrToIndex.find(AddrKey(nextHopAddr));
+        if (nextHopAddr != Mac16Address("FF:FF") && it != addrToIndex.end())
+        {
+            next[v] = it->second;
+        }
     }
+    return next;
 }
 
-
-//* NwkJoinConfirm Function
-//Purpose: This is a callback function that is invoked when the JOIN procedure is confirmed.
-//What it does:
-//1. Checks if the JOIN was successful.
-//2. If successful, it prints the details of the JOIN (network short address, extended PAN ID).
-//3. It then schedules a NlmeStartRouterRequest to start the device as a router
-static void
-NwkJoinConfirm(Ptr<ZigbeeStack> stack, NlmeJoinConfirmParams params)
+//* Classifies every node of the next hop graph in linear time (see RouteOutcome).
+//* Each node is pushed on the walk path once; when the walk stops, the outcome is propagated back along the path.
+static std::vector<RouteOutcome>
+ClassifyNextHopGraph(const std::vector<int32_t>& next, uint32_t dstIndex)
 {
-    if (params.m_status == NwkStatus::SUCCESS)
-    {
-        std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
-                  << " The device joined the network SUCCESSFULLY with short address " << std::hex
-                  << params.m_networkAddress << " on the Extended PAN Id: " << std::hex
-                  << params.m_extendedPanId << "\n"
-                  << std::dec;
+    const uint32_t n = next.size();
+    std::vector<RouteOutcome> outcome(n, ROUTE_UNVISITED);
+    std::vector<bool> onPath(n, false);
+    std::vector<uint32_t> path;
+    outcome[dstIndex] = ROUTE_REACHES;
 
-        // Check if the node is NOT an End Device before starting the router
-        if (stack->GetNode()->GetId() >= 1 && stack->GetNode()->GetId() <= 4) // Execute only if NOT an End Device
+    for (uint32_t start = 0; start < n; start++)
+    {
+        if (outcome[start] != ROUTE_UNVISITED)
         {
-            NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " starting as ROUTER");
-            // Original: Start the device as a router
-            NlmeStartRouterRequestParams startRouterParams; 
-            Simulator::ScheduleNow(&ZigbeeNwk::NlmeStartRouterRequest,
-                                   stack->GetNwk(),
-                                   startRouterParams);
+            continue;
         }
-        else
+
+        path.clear();
+        int32_t v = start;
+        RouteOutcome tail;
+        while (true)
         {
-             NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " (EndDevice) does NOT start router functionality.");
+            if (outcome[v] != ROUTE_UNVISITED)
+            {
+                // Joined an already classified walk
+                tail = (outcome[v] == ROUTE_IN_LOOP) ? ROUTE_TO_LOOP : outcome[v];
+                break;
+            }
+            if (onPath[v])
+            {
+                // Cycle: every node from the first visit of v to the end of the path is in the loop
+                auto first = std::find(path.begin(), path.end(), static_cast<uint32_t>(v));
+                for (auto it = first; it != path.end(); it++)
+                {
+                    outcome[*it] = ROUTE_IN_LOOP;
+                }
+                tail = ROUTE_TO_LOOP;
+                break;
+            }
+            onPath[v] = true;
+            path.push_back(v);
+            if (next[v] == NEXT_HOP_NONE)
+            {
+                tail = ROUTE_NO_ROUTE;
+                break;
+            }
+            v = next[v];
+        }
+
+        for (uint32_t u : path)
+        {
+            if (outcome[u] == ROUTE_UNVISITED)
+            {
+                outcome[u] = tail;
+            }
+            onPath[u] = false;
         }
     }
-    else
+    return outcome;
+}
+
+//* Checks the routes toward every destination and reports the inconsistencies (loops, black holes) when they form
+//* or disappear. If interval > 0, it reschedules itself every 'interval' seconds.
+static void
+CheckRouteConsistency(double interval)
+{
+    std::unordered_map<uint16_t, int32_t> addrToIndex;
+    std::vector<Ptr<ZigbeeStack>> stacks = IndexStacks(addrToIndex);
+    g_routeChecks++;
+
+    for (uint32_t d = 0; d < stacks.size(); d++)
     {
-        std::cout << " The device FAILED to join the network with status " << params.m_status
-                  << "\n";
+        if (stacks[d]->GetNwk()->GetNetworkAddress() == Mac16Address("FF:FF"))
+        {
+            continue;
+        }
+
+        std::vector<int32_t> next = BuildNextHopGraph(stacks, addrToIndex, d);
+        std::vector<RouteOutcome> outcome = ClassifyNextHopGraph(next, d);
+
+        // A node without route is a black hole only if some other node forwards to it
+        std::vector<bool> usedAsNextHop(stacks.size(), false);
+        for (uint32_t v = 0; v < stacks.size(); v++)
+        {
+            if (next[v] != NEXT_HOP_NONE && static_cast<uint32_t>(next[v]) != v)
+            {
+                usedAsNextHop[next[v]] = true;
+            }
+        }
+
+        std::ostringstream loops;
+        std::ostringstream blackHoles;
+        std::ostringstream unreachable;
+        for (uint32_t v = 0; v < stacks.size(); v++)
+        {
+            uint32_t nodeId = stacks[v]->GetNode()->GetId();
+            if (outcome[v] != ROUTE_REACHES && stacks[v]->GetNwk()->GetNetworkAddress() != Mac16Address("FF:FF"))
+            {
+                unreachable << " " << nodeId; // Nodes that have not joined yet are not counted
+            }
+            if (outcome[v] == ROUTE_IN_LOOP)
+            {
+                loops << " " << nodeId;
+            }
+            else if (next[v] == NEXT_HOP_NONE && usedAsNextHop[v])
+            {
+                blackHoles << " " << nodeId;
+            }
+        }
+
+        std::string issues;
+        if (!loops.str().empty())
+        {
+            issues += "LOOP among nodes [" + loops.str() + " ] ";
+            g_routeLoopsFound++;
+        }
+        if (!blackHoles.str().empty())
+        {
+            issues += "BLACK HOLE at nodes [" + blackHoles.str() + " ] ";
+            g_routeBlackHolesFound++;
+        }
+
+        uint32_t dstId = stacks[d]->GetNode()->GetId();
+        std::string& previous = g_routeIssues[dstId];
+        if (issues != previous)
+        {
+            if (!issues.empty())
+            {
+                if (previous.empty())
+                {
+                    g_routeIssuesFormed++;
+                }
+                std::cout << Simulator::Now().As(Time::S) << " ROUTE CHECK | Destination Node " << dstId << " ["
+                          << stacks[d]->GetNwk()->GetNetworkAddress() << "]: " << issues << "| Joined nodes that cannot reach it: ["
+                          << unreachable.str() << " ]\n";
+            }
+            else
+            {
+                std::cout << Simulator::Now().As(Time::S) << " ROUTE CHECK | Destination Node " << dstId
+                          << ": routing inconsistency resolved\n";
+            }
+            previous = issues;
+        }
     }
-}
 
+    if (interval > 0)
+    {
+        Simulator::Schedule(Seconds(interval), &CheckRouteConsistency, interval);
+    }
+}
 
-//* NwkRouteDiscoveryConfirm Function
-//Purpose: This is a callback function that is invoked when a route discovery process is confirmed.
-//What it does:
-//Prints the status of the route discovery.
+//* Prints the summary of the periodic route consistency checks
 static void
-NwkRouteDiscoveryConfirm(Ptr<ZigbeeStack> stack, NlmeRouteDiscoveryConfirmParams params)
+PrintRouteConsistencySummary()
 {
-    std::cout << "NlmeRouteDiscoveryConfirmStatus = " << params.m_status << "\n";
+    std::cout << "\n--- Route Consistency Checks ---\n";
+    std::cout << "Checks performed:               " << g_routeChecks << "\n";
+    std::cout << "Inconsistencies formed:         " << g_routeIssuesFormed << "\n";
+    std::cout << "Loop observations:              " << g_routeLoopsFound << "\n";
+    std::cout << "Black hole observations:        " << g_routeBlackHolesFound << "\n";
+    for (const auto& entry : g_routeIssues)
+    {
+        if (!entry.second.empty())
+        {
+            std::cout << "Still inconsistent -> Node " << entry.first << ": " << entry.second << "\n";
+        }
+    }
+    std::cout << "--------------------------------\n";
 }
 
+//* Route Optimality Analyzer
+//* Purpose:
+//* Compares the routes discovered by the Zigbee NWK (next hops from FindRoute, as in TraceRoute) with the shortest paths
+//* of the physical topology, to tell if long/slow routes come from the route selection or from the topology itself.
+//*
+//* How it works:
+//* 1. Link costs are computed from the node positions and the propagation loss model of the channel:
+//*    the SNR of each link gives the frame success probability p (LR-WPAN error model) and the Zigbee link cost
+//*    C = min(7, round(1/p^4)) (Zigbee Specification, 3.6.3.1). Links below the rx sensitivity do not exist.
+//* 2. A Dijkstra per sink (end devices cannot relay) gives the optimal cost from every node; the sinks are split
+//*    among all the cores.
+//* 3. For every pair with a discovered route, the stretch factor is (discovered route cost) / (optimal cost).
+static const double LINK_COST_NONE = std::numeric_limits<double>::infinity();
 
-//* SendData Function
-//Purpose: This function sends a data packet from one Zigbee node (stackSrc) to another (stackDst).
-//How it works:
-//1. Creates a packet.
-//2. Sets the destination address (dataReqParams.m_dstAddr) to the network address of the destination node.
-//3. Sets dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY; to enable route discovery if a route is not already known.
-//4. Schedules the NldeDataRequest to send the packet.
+//* Success probability of one data frame transmission between two positions (0 if out of range).
+//* snrOffsetDb shifts the received power, hence the SNR, of the link (negative = worse channel than the model), as
+//* --snrOffset does in the channel; frames below sensitivityDbm are not received.
+static double
+LinkSuccessRate(Ptr<MobilityModel> a,
+                Ptr<MobilityModel> b,
+                double snrOffsetDb = 0,
+                double sensitivityDbm = g_rxSensitivityDbm)
+{
+    double rxPowerDbm = g_propModel->CalcRxPower(LINK_TX_POWER_DBM, a, b) + snrOffsetDb;
+    if (rxPowerDbm < sensitivityDbm)
+    {
+        return 0;
+    }
+    static Ptr<LrWpanErrorModel> errorModel = CreateObject<LrWpanErrorModel>();
+    double snr = std::pow(10.0, (rxPowerDbm - LINK_NOISE_FLOOR_DBM) / 10.0);
+    return errorModel->GetChunkSuccessRate(snr, LINK_FRAME_BITS);
+}
+
+//* Zigbee link cost between two positions (LINK_COST_NONE if out of range)
+static double
+LinkCost(Ptr<MobilityModel> a, Ptr<MobilityModel> b)
+{
+    double p = LinkSuccessRate(a, b);
+    if (p <= 0)
+    {
+        return LINK_COST_NONE;
+    }
+    return std::min(7.0, std::max(1.0, std::round(1.0 / std::pow(p, 4))));
+}
+
+//* Link cost matrix (n x n, row major) of nodes at the given positions
+static std::vector<double>
+LinkCostsOfPositions(const std::vector<Vector>& positions)
+{
+    const uint32_t n = positions.size();
+    std::vector<Ptr<MobilityModel>> mobility;
+    for (const auto& position : positions)
+    {
+        Ptr<ConstantPositionMobilityModel> model = CreateObject<ConstantPositionMobilityModel>();
+        model->SetPosition(position);
+        mobility.push_back(model);
+    }
+
+    std::vector<double> cost(n * n, LINK_COST_NONE);
+    for (uint32_t a = 0; a < n; a++)
+    {
+        cost[a * n + a] = 0;
+        for (uint32_t b = a + 1; b < n; b++)
+        {
+            cost[a * n + b] = cost[b * n + a] = LinkCost(mobility[a], mobility[b]);
+        }
+    }
+    return cost;
+}
+
+//* Link cost matrix (n x n, row major) of the nodes of the network
+static std::vector<double>
+ComputeLinkCosts(const std::vector<Ptr<ZigbeeStack>>& stacks)
+{
+    std::vector<Vector> positions;
+    for (const auto& stack : stacks)
+    {
+        positions.push_back(stack->GetNode()->GetObject<MobilityModel>()->GetPosition());
+    }
+    return LinkCostsOfPositions(positions);
+}
+
+//* Dijkstra toward 'sink' on the (symmetric) link cost matrix: returns the optimal cost and hops from every node.
+//* Only nodes with canRelay[v] can forward packets. Works on plain data only, so it can run on any thread.
 static void
-SendData(Ptr<ZigbeeStack> stackSrc, Ptr<ZigbeeStack> stackDst)
+ShortestPathsToSink(const std::vector<double>& cost,
+                    const std::vector<bool>& canRelay,
+                    uint32_t sink,
+                    std::vector<double>& dist,
+                    std::vector<uint32_t>& hops)
 {
-    // Send data from a device with stackSrc to device with stackDst.
+    const uint32_t n = canRelay.size();
+    dist.assign(n, LINK_COST_NONE);
+    hops.assign(n, 0);
+    std::priority_queue<std::pair<double, uint32_t>,
+                        std::vector<std::pair<double, uint32_t>>,
+                        std::greater<std::pair<double, uint32_t>>> queue;
+    dist[sink] = 0;
+    queue.push({0, sink});
 
-    // We do not know what network address will be assigned after the JOIN procedure
-    // but we can request the network address from stackDst (the destination device) when
-    // we intend to send data. If a route do not exist, we will search for a route
-    // before transmitting data (Mesh routing).
+    while (!queue.empty())
+    {
+        auto [d, v] = queue.top();
+        queue.pop();
+        if (d > dist[v] || (v != sink && !canRelay[v]))
+        {
+            continue; // Stale entry, or a node that cannot forward toward the sink
+        }
+        for (uint32_t u = 0; u < n; u++)
+        {
+            double c = cost[u * n + v];
+            if (c != LINK_COST_NONE && d + c < dist[u])
+            {
+                dist[u] = d + c;
+                hops[u] = hops[v] + 1;
+                queue.push({dist[u], u});
+            }
+        }
+    }
+}
 
-    // --- Packet Sent ---
-    NS_LOG_INFO("Node " << stackSrc->GetNode()->GetId() << " sending data to Node " << stackDst->GetNode()->GetId()); // Log send
-    g_totalPacketsSent++;
-    g_packetCounter++; //Increment to get a unique ID
+//* Runs the analysis and prints the stretch factor of every pair with a discovered route and the worst offenders
+static void
+AnalyzeRouteOptimality()
+{
+    std::unordered_map<uint16_t, int32_t> addrToIndex;
+    std::vector<Ptr<ZigbeeStack>> stacks = IndexStacks(addrToIndex);
+    const uint32_t n = stacks.size();
 
-    Ptr<Packet> p = Create<Packet>(5); // Create a 5-byte packet
+    std::vector<double> cost = ComputeLinkCosts(stacks);
+    std::vector<bool> canRelay(n);
+    for (uint32_t v = 0; v < n; v++)
+    {
+        canRelay[v] = !IsEndDevice(stacks[v]);
+    }
 
-    // --- Add Packet Tag --- 
-    PacketIdTag tag;
-    tag.SetPacketId(g_packetCounter); // Set the unique ID in the tag
-    p->AddPacketTag(tag); // Add the tag to the packet
+    // Optimal paths: one Dijkstra per sink, sinks distributed among the cores
+    std::vector<std::vector<double>> optCost(n);
+    std::vector<std::vector<uint32_t>> optHops(n);
+    uint32_t numThreads = std::max(1u, std::min(std::thread::hardware_concurrency(), n));
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < numThreads; t++)
+    {
+        workers.emplace_back([&, t]() {
+            for (uint32_t sink = t; sink < n; sink += numThreads)
+            {
+                ShortestPathsToSink(cost, canRelay, sink, optCost[sink], optHops[sink]);
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
 
-    // --- Record Send Time ---
-    g_sendTimeMap[g_packetCounter] = Simulator::Now(); // Associate the packet ID with the current time
+    struct PairResult
+    {
+        uint32_t src;
+        uint32_t dst;
+        double routeCost;
+        uint32_t routeHops;
+        double optCost;
+        uint32_t optHops;
+        double stretch;
+    };
+    std::vector<PairResult> results;
+    uint32_t noRoute = 0;
 
-    NldeDataRequestParams dataReqParams;
-    dataReqParams.m_dstAddrMode = UCST_BCST; 
-    dataReqParams.m_dstAddr = stackDst->GetNwk()->GetNetworkAddress();
-    dataReqParams.m_nsduHandle = 1; // Puoi usare g_packetCounter se vuoi un handle univoco
-    dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY; // Enable route discovery if no route is known
+    std::cout << "\n--- Route Optimality (discovered routes vs. link-cost shortest paths) ---\n";
+    std::cout << "Src -> Dst | Route cost (hops) | Optimal cost (hops) | Stretch\n";
+    for (uint32_t d = 0; d < n; d++)
+    {
+        if (stacks[d]->GetNwk()->GetNetworkAddress() == Mac16Address("FF:FF"))
+        {
+            continue;
+        }
+        std::vector<int32_t> next = BuildNextHopGraph(stacks, addrToIndex, d);
+
+        for (uint32_t s = 0; s < n; s++)
+        {
+            if (s == d || optCost[d][s] == LINK_COST_NONE)
+            {
+                continue;
+            }
+            // Walk the discovered route (at most n hops, otherwise it is a loop)
+            double routeCost = 0;
+            uint32_t routeHops = 0;
+            uint32_t v = s;
+            while (v != d && next[v] != NEXT_HOP_NONE && routeHops < n)
+            {
+                routeCost += cost[v * n + next[v]];
+                v = next[v];
+                routeHops++;
+            }
+            if (v != d)
+            {
+                noRoute++;
+                continue;
+            }
+
+            PairResult r{stacks[s]->GetNode()->GetId(), stacks[d]->GetNode()->GetId(), routeCost, routeHops,
+                         optCost[d][s], optHops[d][s], routeCost / optCost[d][s]};
+            results.push_back(r);
+            std::cout << "Node " << r.src << " -> Node " << r.dst << " | " << r.routeCost << " (" << r.routeHops
+                      << ") | " << r.optCost << " (" << r.optHops << ") | " << r.stretch << "\n";
+        }
+    }
+
+    if (results.empty())
+    {
+        std::cout << "No discovered routes to analyze (" << noRoute << " pairs without a complete route)\n";
+        return;
+    }
+
+    // A route over a link without connectivity has an infinite stretch: such pairs are counted apart from the average
+    double sumStretch = 0;
+    uint32_t optimal = 0;
+    uint32_t broken = 0;
+    for (const auto& r : results)
+    {
+        if (r.stretch == LINK_COST_NONE)
+        {
+            broken++;
+            continue;
+        }
+        sumStretch += r.stretch;
+        optimal += (r.stretch <= 1.0) ? 1 : 0;
+    }
+    std::sort(results.begin(), results.end(), [](const PairResult& a, const PairResult& b) {
+        return a.stretch > b.stretch;
+    });
+
+    std::cout << "Pairs analyzed: " << results.size() << " | Optimal: " << optimal << " | Without complete route: " << noRoute
+              << " | Route over a missing link (infinite stretch): " << broken << "\n";
+    if (broken < results.size())
+    {
+        std::cout << "Average stretch (" << results.size() - broken << " pairs with a finite stretch): "
+                  << sumStretch / (results.size() - broken) << "\n";
+    }
+    else
+    {
+        std::cout << "Average stretch: infinite (every analyzed route uses a missing link)\n";
+    }
+    std::cout << "Worst offenders:\n";
+    for (uint32_t k = 0; k < results.size() && k < 5 && results[k].stretch > 1.0; k++)
+    {
+        std::cout << "  Node " << results[k].src << " -> Node " << results[k].dst << " | Stretch " << results[k].stretch
+                  << " (" << results[k].routeHops << " hops instead of " << results[k].optHops << ")\n";
+    }
+    std::cout << "---------------------------------------------------------------------------\n";
+}
+
+//* Connectivity Pre-check
+//* Purpose:
+//* Checks the physical topology before the simulation runs, so that a broken scenario is rejected in milliseconds
+//* instead of after a full run (e.g. a device that never finds a network to join).
+//*
+//* How it works:
+//* 1. The expected links come from the node positions, the propagation loss model of the channel and the rx
+//*    sensitivity (LinkCostsOfPositions). Only the coordinator and the routers can relay.
+//* 2. A BFS from the coordinator gives the minimum hop count of every node; the nodes it does not reach are reported
+//*    with the disconnected components of the routers.
+//* 3. Tarjan's algorithm on the relay graph finds the articulation-point routers; for every one of them, and for every
+//*    router that is the only relay in range of an end device, a BFS without it counts the nodes it would cut off.
+//* Returns false if a node cannot reach the coordinator.
+static std::vector<int32_t>
+RelayHops(const std::vector<std::vector<uint32_t>>& adjacency, const std::vector<bool>& canRelay, int32_t excluded)
+{
+    std::vector<int32_t> hops(adjacency.size(), -1);
+    std::queue<uint32_t> queue;
+    hops[0] = 0;
+    queue.push(0);
+    while (!queue.empty())
+    {
+        uint32_t v = queue.front();
+        queue.pop();
+        if (v != 0 && !canRelay[v])
+        {
+            continue; // End devices are reached but do not forward
+        }
+        for (uint32_t u : adjacency[v])
+        {
+            if (hops[u] < 0 && static_cast<int32_t>(u) != excluded)
+            {
+                hops[u] = hops[v] + 1;
+                queue.push(u);
+            }
+        }
+    }
+    return hops;
+}
+
+static bool
+CheckConnectivity(const std::vector<Vector>& positions)
+{
+    const uint32_t n = positions.size();
+    std::vector<double> cost = LinkCostsOfPositions(positions);
+    std::vector<std::vector<uint32_t>> adjacency(n);
+    std::vector<bool> canRelay(n);
+    uint32_t links = 0;
+    for (uint32_t a = 0; a < n; a++)
+    {
+        canRelay[a] = !IsEndDeviceNode(a);
+        for (uint32_t b = 0; b < n; b++)
+        {
+            if (a != b && cost[a * n + b] != LINK_COST_NONE)
+            {
+                adjacency[a].push_back(b);
+                links += (a < b) ? 1 : 0;
+            }
+        }
+    }
+    std::vector<int32_t> hops = RelayHops(adjacency, canRelay, -1);
+
+    std::cout << "\n--- Connectivity pre-check (" << n << " nodes, " << links << " expected links) ---\n";
+
+    // Unreachable nodes: components of the routers cut off from the coordinator, then the end devices
+    std::vector<int32_t> component(n, -1);
+    uint32_t numComponents = 0;
+    for (uint32_t s = 1; s < n; s++)
+    {
+        if (hops[s] >= 0 || !canRelay[s] || component[s] >= 0)
+        {
+            continue;
+        }
+        std::vector<uint32_t> stack = {s};
+        component[s] = numComponents;
+        std::cout << "Disconnected router component " << numComponents + 1 << ": Node " << s;
+        while (!stack.empty())
+        {
+            uint32_t v = stack.back();
+            stack.pop_back();
+            for (uint32_t u : adjacency[v])
+            {
+                if (canRelay[u] && component[u] < 0)
+                {
+                    component[u] = numComponents;
+                    stack.push_back(u);
+                    std::cout << ", Node " << u;
+                }
+            }
+        }
+        std::cout << "\n";
+        numComponents++;
+    }
+    uint32_t unreachable = 0;
+    for (uint32_t v = 1; v < n; v++)
+    {
+        if (hops[v] < 0)
+        {
+            unreachable++;
+            if (!canRelay[v])
+            {
+                bool anyRelay = std::any_of(adjacency[v].begin(), adjacency[v].end(),
+                                            [&](uint32_t u) { return canRelay[u]; });
+                std::cout << "End device Node " << v << ": "
+                          << (anyRelay ? "only routers of a disconnected component in range" : "no router in range")
+                          << "\n";
+            }
+        }
+    }
+
+    // Articulation points of the relay graph (Tarjan, DFS from the coordinator)
+    std::vector<int32_t> discovery(n, -1);
+    std::vector<int32_t> low(n, 0);
+    std::vector<bool> critical(n, false);
+    int32_t time = 0;
+    std::function<void(uint32_t, int32_t)> dfs = [&](uint32_t v, int32_t parent) {
+        discovery[v] = low[v] = time++;
+        uint32_t children = 0;
+        for (uint32_t u : adjacency[v])
+        {
+            if (!canRelay[u] || static_cast<int32_t>(u) == parent)
+            {
+                continue;
+            }
+            if (discovery[u] < 0)
+            {
+                children++;
+                dfs(u, v);
+                low[v] = std::min(low[v], low[u]);
+                if (parent >= 0 && low[u] >= discovery[v])
+                {
+                    critical[v] = true;
+                }
+            }
+            else
+            {
+                low[v] = std::min(low[v], discovery[u]);
+            }
+        }
+        if (parent < 0 && children > 1)
+        {
+            critical[v] = true;
+        }
+    };
+    dfs(0, -1);
+    // A router that is the only relay in range of a reachable end device is also a single point of failure
+    for (uint32_t v = 1; v < n; v++)
+    {
+        if (!canRelay[v] && hops[v] >= 0)
+        {
+            std::vector<uint32_t> relays;
+            std::copy_if(adjacency[v].begin(), adjacency[v].end(), std::back_inserter(relays),
+                         [&](uint32_t u) { return canRelay[u] && hops[u] >= 0; });
+            if (relays.size() == 1)
+            {
+                critical[relays[0]] = true;
+            }
+        }
+    }
+    uint32_t criticalRouters = 0;
+    for (uint32_t v = 1; v < n; v++)
+    {
+        if (critical[v])
+        {
+            std::vector<int32_t> without = RelayHops(adjacency, canRelay, v);
+            uint32_t cutOff = 0;
+            for (uint32_t u = 1; u < n; u++)
+            {
+                cutOff += (u != v && hops[u] >= 0 && without[u] < 0) ? 1 : 0;
+            }
+            std::cout << "Articulation-point router: Node " << v << " (its failure cuts off " << cutOff << " node(s))\n";
+            criticalRouters++;
+        }
+    }
+
+    // Expected minimum hop counts to the coordinator
+    std::map<int32_t, uint32_t> hopHistogram;
+    double sumHops = 0;
+    for (uint32_t v = 1; v < n; v++)
+    {
+        if (hops[v] >= 0)
+        {
+            hopHistogram[hops[v]]++;
+            sumHops += hops[v];
+        }
+    }
+    std::cout << "Minimum hops to the coordinator:";
+    for (const auto& entry : hopHistogram)
+    {
+        std::cout << " " << entry.first << " hop(s): " << entry.second << " node(s) |";
+    }
+    std::cout << " Average: " << (n - 1 > unreachable ? sumHops / (n - 1 - unreachable) : 0.0)
+              << " | Max: " << (hopHistogram.empty() ? 0 : hopHistogram.rbegin()->first) << "\n";
+    std::cout << "Unreachable nodes: " << unreachable << " | Disconnected router components: " << numComponents
+              << " | Articulation-point routers: " << criticalRouters << "\n";
+    std::cout << "---------------------------------------------------\n";
+    return unreachable == 0;
+}
+
+//* Table Snapshots
+//* Purpose:
+//* Periodically records the Neighbor, Routing and Route Discovery tables of ALL nodes into a compact binary time-series,
+//* storing only the rows that changed since the previous snapshot. ViewTableSnapshots() reconstructs the tables at any time.
+//*
+//* File format (little endian, "varint" = unsigned LEB128):
+//*   Header:      "ZSNP" | u8 version
+//*   Row record:  'D' | varint rowId | varint length | row text     (each distinct row text is stored only once)
+//*   Snapshot:    'S' | i64 time [ns] | varint numChanges
+//*                followed by numChanges x (varint nodeId | u8 table | varint numRemoved | rowIds... |
+//*                                          varint numAdded | (varint position | varint rowId)...)
+//* The rows of a table keep the order in which they are printed: the removed rows are erased first, then every added row
+//* is inserted at its position (ascending) in the new table. A table whose kept rows changed order is rewritten entirely.
+enum SnapshotTable : uint8_t
+{
+    SNAPSHOT_NEIGHBOR_TABLE = 0,
+    SNAPSHOT_ROUTING_TABLE = 1,
+    SNAPSHOT_ROUTE_DISCOVERY_TABLE = 2,
+    SNAPSHOT_NUM_TABLES = 3
+};
+
+static const char* SNAPSHOT_TABLE_NAMES[SNAPSHOT_NUM_TABLES] = {"Neighbor table",
+                                                                "Routing table",
+                                                                "Route discovery table"};
+
+static void
+WriteVarint(std::ostream& os, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        os.put(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    os.put(static_cast<char>(value));
+}
+
+static bool
+ReadVarint(std::istream& is, uint64_t& value)
+{
+    value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7)
+    {
+        int c = is.get();
+        if (c == EOF)
+        {
+            return false;
+        }
+        value |= static_cast<uint64_t>(c & 0x7F) << shift;
+        if (!(c & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//* Captures the rows printed by one of the Print*Table functions of a node.
+//* The title line (it contains the current time) and empty lines are discarded, so that an unchanged table
+//* produces exactly the same rows in two different snapshots.
+static std::vector<std::string>
+CaptureTableRows(Ptr<ZigbeeNwk> nwk, uint8_t table)
+{
+    std::ostringstream oss;
+    Ptr<OutputStreamWrapper> capture = Create<OutputStreamWrapper>(&oss);
+    switch (table)
+    {
+    case SNAPSHOT_NEIGHBOR_TABLE:
+        nwk->PrintNeighborTable(capture);
+        break;
+    case SNAPSHOT_ROUTING_TABLE:
+        nwk->PrintRoutingTable(capture);
+        break;
+    default:
+        nwk->PrintRouteDiscoveryTable(capture);
+        break;
+    }
+
+    std::vector<std::string> rows;
+    std::istringstream lines(oss.str());
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos || line.find("Time:") != std::string::npos)
+        {
+            continue;
+        }
+        rows.push_back(line);
+    }
+    return rows;
+}
+
+//* Takes a snapshot of the tables of every node and writes only the differences with the previous one.
+//* It reschedules itself every 'interval' seconds until the end of the simulation.
+static void
+TakeTableSnapshot(double interval)
+{
+    std::ostringstream changes; // Encoded changes of this snapshot (the count is only known at the end)
+    uint32_t numChanges = 0;
+
+    for (auto i = zigbeeStacks.Begin(); i != zigbeeStacks.End(); i++)
+    {
+        Ptr<ZigbeeStack> zstack = *i;
+        uint32_t nodeId = zstack->GetNode()->GetId();
+
+        for (uint8_t table = 0; table < SNAPSHOT_NUM_TABLES; table++)
+        {
+            std::vector<uint32_t> rowIds;
+            for (const auto& row : CaptureTableRows(zstack->GetNwk(), table))
+            {
+                auto it = g_snapshotRowIds.find(row);
+                if (it == g_snapshotRowIds.end())
+                {
+                    // New row text: add it to the dictionary
+                    uint32_t rowId = g_snapshotRowIds.size();
+                    it = g_snapshotRowIds.emplace(row, rowId).first;
+                    g_snapshotStream.put('D');
+                    WriteVarint(g_snapshotStream, rowId);
+                    WriteVarint(g_snapshotStream, row.size());
+                    g_snapshotStream.write(row.data(), row.size());
+                }
+                rowIds.push_back(it->second);
+            }
+
+            std::vector<uint32_t>& previous = g_snapshotState[{nodeId, table}];
+            if (rowIds == previous)
+            {
+                continue; // Nothing changed in this table
+            }
+
+            // Rows kept from the previous snapshot (as a multiset, a row can be printed twice), in both orders
+            std::map<uint32_t, uint32_t> inPrevious;
+            std::map<uint32_t, uint32_t> inCurrent;
+            for (uint32_t rowId : previous)
+            {
+                inPrevious[rowId]++;
+            }
+            for (uint32_t rowId : rowIds)
+            {
+                inCurrent[rowId]++;
+            }
+            std::vector<uint32_t> keptPrevious;
+            std::vector<uint32_t> removed;
+            for (uint32_t rowId : previous)
+            {
+                if (inCurrent[rowId] > 0)
+                {
+                    inCurrent[rowId]--;
+                    keptPrevious.push_back(rowId);
+                }
+                else
+                {
+                    removed.push_back(rowId);
+                }
+            }
+            std::vector<uint32_t> keptCurrent;
+            std::vector<std::pair<uint32_t, uint32_t>> added; // (position in the new table, row ID)
+            for (uint32_t position = 0; position < rowIds.size(); position++)
+            {
+                if (inPrevious[rowIds[position]] > 0)
+                {
+                    inPrevious[rowIds[position]]--;
+                    keptCurrent.push_back(rowIds[position]);
+                }
+                else
+                {
+                    added.emplace_back(position, rowIds[position]);
+                }
+            }
+            if (keptPrevious != keptCurrent)
+            {
+                // The kept rows were reordered: rewrite the whole table
+                removed = previous;
+                added.clear();
+                for (uint32_t position = 0; position < rowIds.size(); position++)
+                {
+                    added.emplace_back(position, rowIds[position]);
+                }
+            }
+
+            WriteVarint(changes, nodeId);
+            changes.put(static_cast<char>(table));
+            WriteVarint(changes, removed.size());
+            for (uint32_t rowId : removed)
+            {
+                WriteVarint(changes, rowId);
+            }
+            WriteVarint(changes, added.size());
+            for (const auto& row : added)
+            {
+                WriteVarint(changes, row.first);
+                WriteVarint(changes, row.second);
+            }
+            previous = rowIds;
+            numChanges++;
+        }
+    }
+
+    int64_t timeNs = Simulator::Now().GetNanoSeconds();
+    g_snapshotStream.put('S');
+    g_snapshotStream.write(reinterpret_cast<const char*>(&timeNs), sizeof(timeNs));
+    WriteVarint(g_snapshotStream, numChanges);
+    g_snapshotStream << changes.str();
+    g_snapshotCount++;
+
+    Simulator::Schedule(Seconds(interval), &TakeTableSnapshot, interval);
+}
+
+//* Snapshot Viewer
+//* Reads a file written by TakeTableSnapshot and, replaying the deltas:
+//* - if viewTime >= 0, prints the tables of all nodes as they were at the last snapshot taken at or before viewTime.
+//* - if viewTime < 0, prints the route churn timeline (number of rows added/removed in each snapshot).
+static int
+ViewTableSnapshots(const std::string& fileName, double viewTime)
+{
+    std::ifstream is(fileName, std::ios::binary);
+    char magic[5] = {0};
+    is.read(magic, 4);
+    if (!is || std::string(magic) != "ZSNP" || is.get() != 2)
+    {
+        std::cout << "ERROR: " << fileName << " is not a valid table snapshot file.\n";
+        return 1;
+    }
+
+    std::vector<std::string> dictionary;
+    std::map<std::pair<uint32_t, uint8_t>, std::vector<uint32_t>> state; // (Node ID, table) -> row IDs (printed order)
+    double stateTime = -1.0;
+    bool corrupted = false;
+
+    if (viewTime < 0)
+    {
+        std::cout << "--- Route churn timeline (" << fileName << ") ---\n";
+        std::cout << "Time [s] | Tables changed | Rows added | Rows removed\n";
+    }
+
+    int c;
+    while (!corrupted && (c = is.get()) != EOF)
+    {
+        uint64_t value = 0;
+        if (c == 'D')
+        {
+            uint64_t rowId = 0;
+            uint64_t length = 0;
+            if (!ReadVarint(is, rowId) || !ReadVarint(is, length) || rowId != dictionary.size())
+            {
+                corrupted = true;
+                break;
+            }
+            std::string row(length, '\0');
+            is.read(&row[0], length);
+            dictionary.push_back(row);
+        }
+        else if (c == 'S')
+        {
+            int64_t timeNs = 0;
+            uint64_t numChanges = 0;
+            is.read(reinterpret_cast<char*>(&timeNs), sizeof(timeNs));
+            double snapshotTime = timeNs / 1e9;
+            if (!is || !ReadVarint(is, numChanges))
+            {
+                corrupted = true;
+                break;
+            }
+            if (viewTime >= 0 && snapshotTime > viewTime)
+            {
+                break; // The state at viewTime is the one of the previous snapshot
+            }
+
+            uint64_t totalAdded = 0;
+            uint64_t totalRemoved = 0;
+            for (uint64_t n = 0; n < numChanges && !corrupted; n++)
+            {
+                uint64_t nodeId = 0;
+                uint64_t count = 0;
+                if (!ReadVarint(is, nodeId))
+                {
+                    corrupted = true;
+                    break;
+                }
+                uint8_t table = static_cast<uint8_t>(is.get());
+                std::vector<uint32_t>& rows = state[{static_cast<uint32_t>(nodeId), table}];
+
+                corrupted = !ReadVarint(is, count);
+                totalRemoved += count;
+                for (uint64_t k = 0; k < count && !corrupted; k++)
+                {
+                    corrupted = !ReadVarint(is, value);
+                    auto row = std::find(rows.begin(), rows.end(), value);
+                    if (row != rows.end())
+                    {
+                        rows.erase(row);
+                    }
+                }
+                corrupted = corrupted || !ReadVarint(is, count);
+                totalAdded += count;
+                for (uint64_t k = 0; k < count && !corrupted; k++)
+                {
+                    uint64_t position = 0;
+                    corrupted = !ReadVarint(is, position) || !ReadVarint(is, value) || value >= dictionary.size() ||
+                                position > rows.size();
+                    if (!corrupted)
+                    {
+                        rows.insert(rows.begin() + position, static_cast<uint32_t>(value));
+                    }
+                }
+            }
+            stateTime = snapshotTime;
+
+            if (viewTime < 0 && numChanges > 0)
+            {
+                std::cout << snapshotTime << " | " << numChanges << " | " << totalAdded << " | " << totalRemoved << "\n";
+            }
+        }
+        else
+        {
+            corrupted = true;
+        }
+    }
+
+    if (corrupted)
+    {
+        std::cout << "WARN: " << fileName << " is truncated or corrupted, showing the last complete snapshot.\n";
+    }
+
+    if (viewTime >= 0)
+    {
+        if (stateTime < 0)
+        {
+            std::cout << "No snapshot taken at or before T=" << viewTime << " s\n";
+            return 1;
+        }
+        std::cout << "--- Tables at T=" << stateTime << " s (requested T=" << viewTime << " s) ---\n";
+        for (const auto& entry : state)
+        {
+            if (entry.second.empty())
+            {
+                continue;
+            }
+            std::cout << "\nNode " << entry.first.first << " | " << SNAPSHOT_TABLE_NAMES[entry.first.second] << ":\n";
+            for (uint32_t rowId : entry.second)
+            {
+                std::cout << dictionary[rowId] << "\n";
+            }
+        }
+    }
+    return 0;
+}
+
+//* Fault Injection
+//* Purpose:
+//* Injects failures during the run (a node powering off, a link fading out, a coordinator outage) and measures
+//* how the network recovers: route repair latency, packets lost during the repair and time to recover the PDR of
+//* before the failure.
+//*
+//* How it works:
+//* 1. FaultLossModel is chained after the propagation loss model of the channel: a node that is down neither
+//*    receives nor is received (-1000 dB) and a fading link loses up to LINK_FADE_DEPTH_DB, linearly over
+//*    g_fadeTime seconds. The NWK of a failed node is not reset: a coordinator outage is a radio outage only.
+//*    The same model shifts every link by --snrOffset dB once the traffic starts (degraded channel).
+//* 2. When a fault starts, the flows whose dominant path (g_flowPaths) uses the failed node or link are affected.
+//* 3. The route is repaired at the first delivery, for an affected flow, of a packet sent after the fault over a path
+//*    that avoids it (or after the end of a temporary fault); TraceRoute then shows the new route of the tables.
+//* 4. At the end, the packets of the affected sources give the baseline PDR (sent before the fault), the losses
+//*    during the repair and the first window of g_recoveryWindow seconds whose PDR is back to the baseline (-5 points).
+const double LINK_FADE_DEPTH_DB = 100.0; // Attenuation of a link that faded out completely
+
+class FaultLossModel : public PropagationLossModel
+{
+public:
+    static TypeId GetTypeId(void)
+    {
+        static TypeId tid = TypeId("FaultLossModel")
+                                .SetParent<PropagationLossModel>()
+                                .AddConstructor<FaultLossModel>();
+        return tid;
+    }
+
+private:
+    double DoCalcRxPower(double txPowerDbm, Ptr<MobilityModel> a, Ptr<MobilityModel> b) const override
+    {
+        Ptr<Node> na = a->GetObject<Node>();
+        Ptr<Node> nb = b->GetObject<Node>();
+        if (!na || !nb)
+        {
+            return txPowerDbm; // Positions of an analysis, not nodes of the network
+        }
+        uint16_t nodeA = na->GetId();
+        uint16_t nodeB = nb->GetId();
+        if (g_nodesDown.count(nodeA) || g_nodesDown.count(nodeB))
+        {
+            return txPowerDbm - 1000.0;
+        }
+        auto fade = g_linkFades.find({std::min(nodeA, nodeB), std::max(nodeA, nodeB)});
+        if (fade != g_linkFades.end())
+        {
+            double progress = (g_fadeTime > 0) ? (Simulator::Now().GetSeconds() - fade->second) / g_fadeTime : 1.0;
+            return txPowerDbm - LINK_FADE_DEPTH_DB * std::min(1.0, progress);
+        }
+        return txPowerDbm + (Simulator::Now().GetSeconds() >= g_snrOffsetStart ? g_snrOffsetDb : 0.0);
+    }
+
+    int64_t DoAssignStreams(int64_t /* stream */) override
+    {
+        return 0;
+    }
+};
+
+//* True if the path goes through the failed node or link of the fault
+static bool
+PathUsesFault(const FaultEvent& fault, const std::vector<uint16_t>& path)
+{
+    if (fault.kind != FaultEvent::LINK)
+    {
+        return std::find(path.begin(), path.end(), fault.a) != path.end();
+    }
+    for (uint32_t k = 0; k + 1 < path.size(); k++)
+    {
+        if ((path[k] == fault.a && path[k + 1] == fault.b) || (path[k] == fault.b && path[k + 1] == fault.a))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string
+FaultDescription(const FaultEvent& fault)
+{
+    std::ostringstream os;
+    if (fault.kind == FaultEvent::LINK)
+    {
+        os << "Link " << fault.a << "-" << fault.b << " fading out";
+    }
+    else
+    {
+        os << (fault.kind == FaultEvent::COORDINATOR ? "Coordinator outage" : "Node " + std::to_string(fault.a) + " off");
+    }
+    os << " at " << fault.start << " s";
+    if (fault.duration >= 0)
+    {
+        os << " for " << fault.duration << " s";
+    }
+    return os.str();
+}
+
+static void
+EndFault(uint32_t index)
+{
+    FaultEvent& fault = g_faults[index];
+    if (fault.kind == FaultEvent::LINK)
+    {
+        g_linkFades.erase({std::min(fault.a, fault.b), std::max(fault.a, fault.b)});
+    }
+    else
+    {
+        g_nodesDown.erase(fault.a);
+    }
+    std::cout << Simulator::Now().As(Time::S) << " FAULT END: " << FaultDescription(fault) << "\n";
+}
+
+static void
+StartFault(uint32_t index)
+{
+    FaultEvent& fault = g_faults[index];
+    if (fault.kind == FaultEvent::LINK)
+    {
+        g_linkFades[{std::min(fault.a, fault.b), std::max(fault.a, fault.b)}] = fault.start;
+    }
+    else
+    {
+        g_nodesDown.insert(fault.a);
+    }
+
+    // Flows whose dominant path uses the failed element
+    for (const auto& flow : g_flowPaths)
+    {
+        auto dominant = std::max_element(flow.second.begin(), flow.second.end(), [](const auto& x, const auto& y) {
+            return x.second.count < y.second.count;
+        });
+        if (PathUsesFault(fault, *g_paths[dominant->first]))
+        {
+            fault.affectedFlows.push_back(flow.first);
+        }
+    }
+    std::cout << Simulator::Now().As(Time::S) << " FAULT: " << FaultDescription(fault) << " | "
+              << fault.affectedFlows.size() << " flow(s) affected\n";
+    if (fault.duration >= 0)
+    {
+        Simulator::Schedule(Seconds(fault.duration), &EndFault, index);
+    }
+}
+
+//* Called when a tracked packet is delivered: detects the repair of the routes of the affected flows
+static void
+CheckRouteRepair(uint32_t packetId, const std::vector<uint16_t>& path)
+{
+    double now = Simulator::Now().GetSeconds();
+    for (auto& fault : g_faults)
+    {
+        std::pair<uint16_t, uint16_t> flow = {path.front(), path.back()};
+        if (fault.repairTime >= 0 || now < fault.start || g_packetSendTime[packetId - 1] < fault.start ||
+            std::find(fault.affectedFlows.begin(), fault.affectedFlows.end(), flow) == fault.affectedFlows.end())
+        {
+            continue;
+        }
+        bool ended = fault.duration >= 0 && now >= fault.start + fault.duration;
+        if (ended || !PathUsesFault(fault, path))
+        {
+            fault.repairTime = now - fault.start;
+            fault.repairPath = path;
+            std::cout << Simulator::Now().As(Time::S) << " ROUTE REPAIRED after " << fault.repairTime << " s ("
+                      << FaultDescription(fault) << ")" << (ended ? " once the fault ended" : "") << ", delivered over:";
+            for (uint16_t node : path)
+            {
+                std::cout << " " << node;
+            }
+            std::cout << "\n";
+            // Confirm the new route in the routing tables
+            Simulator::ScheduleNow(&ScheduleTraceRouteWrapper, zigbeeStacks.Get(flow.first), zigbeeStacks.Get(flow.second));
+        }
+    }
+}
+
+//* Parses a whole string as a number (false on an empty string, trailing characters or a negative value)
+static bool
+ParseNonNegative(const std::string& text, double& value)
+{
+    char* end = nullptr;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && end == text.c_str() + text.size() && std::isfinite(value) && value >= 0;
+}
+
+//* Parses a whole string as a Node ID below numNodes
+static bool
+ParseNodeId(const std::string& text, uint32_t numNodes, uint16_t& nodeId)
+{
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos || text.size() > 5)
+    {
+        return false;
+    }
+    unsigned long id = std::strtoul(text.c_str(), nullptr, 10);
+    nodeId = static_cast<uint16_t>(id);
+    return id < numNodes;
+}
+
+//* Parses --faults: comma separated "node:<id>@<t>[+<d>]", "link:<a>-<b>@<t>[+<d>]" or "coord@<t>[+<d>]"
+//* (fault at t seconds for d seconds, permanent without d; a coordinator outage lasts 5 s by default).
+//* Returns false on any malformed item (non-numeric or negative time, unknown node).
+static bool
+ParseFaults(const std::string& text, uint32_t numNodes)
+{
+    std::istringstream list(text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        FaultEvent fault;
+        size_t at = item.find('@');
+        if (at == std::string::npos)
+        {
+            return false;
+        }
+        std::string target = item.substr(0, at);
+        std::string timing = item.substr(at + 1);
+        size_t plus = timing.find('+');
+        fault.duration = -1.0; // Permanent
+        if (!ParseNonNegative(timing.substr(0, plus), fault.start) ||
+            (plus != std::string::npos && !ParseNonNegative(timing.substr(plus + 1), fault.duration)))
+        {
+            return false;
+        }
+        if (target == "coord")
+        {
+            fault.kind = FaultEvent::COORDINATOR;
+            fault.a = 0;
+            fault.duration = (fault.duration < 0) ? 5.0 : fault.duration;
+        }
+        else if (target.rfind("node:", 0) == 0)
+        {
+            fault.kind = FaultEvent::NODE;
+            if (!ParseNodeId(target.substr(5), numNodes, fault.a))
+            {
+                return false;
+            }
+        }
+        else if (target.rfind("link:", 0) == 0 && target.find('-') != std::string::npos)
+        {
+            fault.kind = FaultEvent::LINK;
+            if (!ParseNodeId(target.substr(5, target.find('-') - 5), numNodes, fault.a) ||
+                !ParseNodeId(target.substr(target.find('-') + 1), numNodes, fault.b))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+        if (fault.a >= numNodes || fault.b >= numNodes || (fault.kind == FaultEvent::NODE && fault.a == 0))
+        {
+            return false;
+        }
+        g_faults.push_back(fault);
+    }
+    return true;
+}
+
+static void
+PrintFaultReport()
+{
+    std::cout << "\n--- Fault injection and route repair ---\n";
+    for (const auto& fault : g_faults)
+    {
+        std::cout << FaultDescription(fault) << " | " << fault.affectedFlows.size() << " flow(s) affected\n";
+        if (fault.affectedFlows.empty())
+        {
+            continue; // No traffic path used the failed element
+        }
+        std::set<uint16_t> sources;
+        for (const auto& flow : fault.affectedFlows)
+        {
+            sources.insert(flow.first);
+        }
+
+        // Packets of the affected sources: baseline before the fault, losses during the repair, recovery windows
+        double repairEnd = (fault.repairTime >= 0) ? fault.start + fault.repairTime : Simulator::Now().GetSeconds();
+        uint32_t baselineSent = 0, baselineReceived = 0, repairSent = 0, repairLost = 0;
+        std::map<uint32_t, std::pair<uint32_t, uint32_t>> windows; // Window after the fault -> (sent, received)
+        for (uint32_t k = 0; k < g_packetSrc.size(); k++)
+        {
+            if (!sources.count(g_packetSrc[k]))
+            {
+                continue;
+            }
+            double sendTime = g_packetSendTime[k];
+            bool received = g_packetDelay[k] >= 0;
+            if (sendTime < fault.start)
+            {
+                baselineSent++;
+                baselineReceived += received ? 1 : 0;
+                continue;
+            }
+            if (sendTime < repairEnd)
+            {
+                repairSent++;
+                repairLost += received ? 0 : 1;
+            }
+            auto& window = windows[static_cast<uint32_t>((sendTime - fault.start) / g_recoveryWindow)];
+            window.first++;
+            window.second += received ? 1 : 0;
+        }
+        double baseline = baselineSent > 0 ? static_cast<double>(baselineReceived) / baselineSent : 1.0;
+        double recovery = -1;
+        for (const auto& window : windows)
+        {
+            if (static_cast<double>(window.second.second) / window.second.first >= baseline - 0.05)
+            {
+                recovery = (window.first + 1) * g_recoveryWindow;
+                break;
+            }
+        }
+
+        std::cout << "  Route repair latency: ";
+        if (fault.repairTime >= 0)
+        {
+            std::cout << fault.repairTime << " s";
+        }
+        else
+        {
+            std::cout << "NOT repaired";
+        }
+        std::cout << " | Lost during the repair: " << repairLost << " of " << repairSent << " packet(s)\n";
+        std::cout << "  Baseline PDR: " << baseline * 100 << " % | Time to recover it: ";
+        if (recovery >= 0)
+        {
+            std::cout << recovery << " s (" << g_recoveryWindow << " s windows)";
+        }
+        else
+        {
+            std::cout << "not recovered";
+        }
+        if (g_recoverySlo > 0)
+        {
+            std::cout << " | SLO " << g_recoverySlo << " s: " << (recovery >= 0 && recovery <= g_recoverySlo ? "PASS" : "FAIL");
+        }
+        std::cout << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* Data Path Recording
+//* Purpose:
+//* TraceRoute shows the route of the current routing tables, which can differ from the path the packets really took.
+//* Here every tracked packet records its real forwarding path: the source node is stored when the packet is sent and
+//* each node appends its ID when its MAC receives the packet (MacRx trace). When the packet is delivered, its path
+//* is interned (each distinct path is stored once) and only per flow / per path statistics are kept.
+
+//* MacRx trace of every node: appends the node to the path of the tagged packet
+static void
+PathMacRx(uint16_t nodeId, Ptr<const Packet> p)
+{
+    PacketIdTag tag;
+    if (!p->PeekPacketTag(tag))
+    {
+        return; // Not a tracked data packet (e.g. NWK commands)
+    }
+    auto it = g_pathInFlight.find(tag.GetPacketId());
+    if (it != g_pathInFlight.end() && it->second.back() != nodeId) // Ignore MAC duplicates (lost ACKs)
+    {
+        it->second.push_back(nodeId);
+    }
+}
+
+//* Called when a tracked packet is delivered: moves its path to the per flow statistics
+static void
+RecordDeliveredPath(uint32_t packetId, Time delay)
+{
+    auto it = g_pathInFlight.find(packetId);
+    if (it == g_pathInFlight.end())
+    {
+        return;
+    }
+    const std::vector<uint16_t>& path = it->second;
+    auto inserted = g_pathIds.emplace(path, g_paths.size());
+    if (inserted.second)
+    {
+        g_paths.push_back(&inserted.first->first);
+    }
+
+    PathStats& stats = g_flowPaths[{path.front(), path.back()}][inserted.first->second];
+    double delaySec = delay.GetSeconds();
+    stats.count++;
+    stats.sumDelay += delaySec;
+    stats.sumSqDelay += delaySec * delaySec;
+    stats.maxDelay = std::max(stats.maxDelay, delaySec);
+
+    if (!g_faults.empty())
+    {
+        CheckRouteRepair(packetId, path);
+    }
+    g_pathInFlight.erase(it);
+}
+
+//* Prints, for every flow, the distribution of the real paths, their latency and the correlation between
+//* hop count and latency. Packets never delivered are reported with the last node they reached.
+static void
+PrintDataPathReport()
+{
+    std::cout << "\n--- Data Paths (real forwarding paths of the tracked packets) ---\n";
+    for (const auto& flow : g_flowPaths)
+    {
+        uint32_t total = 0;
+        double sumHops = 0, sumDelay = 0, sumHopsDelay = 0, sumSqHops = 0, sumSqDelay = 0;
+        for (const auto& entry : flow.second)
+        {
+            const PathStats& stats = entry.second;
+            double hops = g_paths[entry.first]->size() - 1;
+            total += stats.count;
+            sumHops += hops * stats.count;
+            sumSqHops += hops * hops * stats.count;
+            sumDelay += stats.sumDelay;
+            sumSqDelay += stats.sumSqDelay;
+            sumHopsDelay += hops * stats.sumDelay;
+        }
+
+        std::cout << "Flow Node " << flow.first.first << " -> Node " << flow.first.second << " (" << total
+                  << " packets, " << flow.second.size() << " distinct paths)\n";
+        for (const auto& entry : flow.second)
+        {
+            const PathStats& stats = entry.second;
+            std::cout << "  ";
+            for (uint32_t k = 0; k < g_paths[entry.first]->size(); k++)
+            {
+                std::cout << (k ? " > " : "") << (*g_paths[entry.first])[k];
+            }
+            std::cout << " | " << stats.count << " pkts (" << 100.0 * stats.count / total << " %)"
+                      << " | Avg Delay: " << stats.sumDelay / stats.count << " s | Max Delay: " << stats.maxDelay
+                      << " s\n";
+        }
+
+        // Pearson correlation between the hop count and the delay of the packets of the flow
+        double covariance = sumHopsDelay / total - (sumHops / total) * (sumDelay / total);
+        double varHops = sumSqHops / total - (sumHops / total) * (sumHops / total);
+        double varDelay = sumSqDelay / total - (sumDelay / total) * (sumDelay / total);
+        if (varHops > 0 && varDelay > 0)
+        {
+            std::cout << "  Hop count / delay correlation: " << covariance / std::sqrt(varHops * varDelay) << "\n";
+        }
+    }
+
+    // Packets still in flight (lost or late): where did they stop?
+    std::map<std::pair<uint16_t, uint16_t>, uint32_t> lastNodeReached; // (Src, last node) -> packets
+    for (const auto& entry : g_pathInFlight)
+    {
+        lastNodeReached[{entry.second.front(), entry.second.back()}]++;
+    }
+    for (const auto& entry : lastNodeReached)
+    {
+        std::cout << "Undelivered from Node " << entry.first.first << ": " << entry.second
+                  << " packet(s) last seen at Node " << entry.first.second << "\n";
+    }
+    std::cout << "-----------------------------------------------------------------\n";
+}
+
+//* Rare-Event Loss Estimation (multilevel splitting)
+//* Purpose:
+//* Estimates very small loss probabilities (e.g. 1e-5) of the flows with a bounded relative error, without the
+//* millions of packets that brute force needs to observe any loss.
+//*
+//* How it works:
+//* 1. Model of a packet on the dominant path of its flow: every hop makes up to MAC_TX_ATTEMPTS transmissions, each one
+//*    failing with the frame error rate of the link (LinkSuccessRate); the packet is lost when all of them fail.
+//*    CSMA failures and lost acks are not modeled.
+//* 2. Importance function: the consecutive failures at the current hop. Level k is reached at the k-th consecutive
+//*    failure of any hop, and level MAC_TX_ATTEMPTS is the loss.
+//* 3. Fixed-effort splitting: at every level, g_rareEventEffort trajectories restart from the states that reached the
+//*    previous level. The loss probability is the product of the conditional probabilities p_k, with relative
+//*    error sqrt(sum (1 - p_k) / (N p_k)).
+//* 4. Validation against ns-3: the channel of the worst flow is degraded (--snrOffset) until the model loss is moderate
+//*    (1e-2 and 1e-3), and brute-force child simulations of that flow measure the real loss, CSMA-CA failures, lost
+//*    acks, collisions and route changes included. Both the closed form 1 - prod(1 - PER_h ^ MAC_TX_ATTEMPTS) and the
+//*    splitting estimate are compared with it. The links only reach their error-prone SNRs below the default rx
+//*    sensitivity, so the validation lowers it (--rxSensitivity) in the model and in the child runs alike.
+//*    The levels themselves cannot be split over ns-3 runs: a simulation cannot be restarted from a mid-packet state.
+const uint32_t MAC_TX_ATTEMPTS = 4;                          // macMaxFrameRetries (3, ns-3 default) + 1
+const double RARE_EVENT_VALIDATION_SENSITIVITY_DBM = -150.0; // Rx sensitivity of the validation (model and runs)
+const uint32_t RARE_EVENT_VALIDATION_LOSSES = 30;            // Expected losses of the brute-force runs per target
+const int64_t STREAM_RARE_EVENT = STREAM_FAULTS + 4;         // Stream of the splitting trajectories
+
+struct RareEventState
+{
+    uint32_t hop = 0;      // Hop of the path being attempted
+    uint32_t failures = 0; // Consecutive failed transmissions on this hop
+};
+
+struct RareEventEstimate
+{
+    double probability = 0;
+    double relError = std::numeric_limits<double>::infinity();
+    uint64_t attempts = 0; // Simulated transmissions (effort)
+};
+
+//* Advances a packet until its failures on a hop reach 'level' (true, state = entrance state) or it is delivered
+static bool
+RareEventAdvance(const std::vector<double>& per,
+                 RareEventState& state,
+                 uint32_t level,
+                 Ptr<UniformRandomVariable> uniform,
+                 uint64_t& attempts)
+{
+    while (state.hop < per.size())
+    {
+        attempts++;
+        if (uniform->GetValue() < per[state.hop])
+        {
+            if (++state.failures >= level)
+            {
+                return true;
+            }
+        }
+        else
+        {
+            state.hop++;
+            state.failures = 0;
+        }
+    }
+    return false;
+}
+
+static RareEventEstimate
+MultilevelSplitting(const std::vector<double>& per, uint32_t effort, Ptr<UniformRandomVariable> uniform)
+{
+    RareEventEstimate estimate;
+    std::vector<RareEventState> entrance(1);
+    double probability = 1;
+    double relVariance = 0;
+    for (uint32_t level = 1; level <= MAC_TX_ATTEMPTS; level++)
+    {
+        std::vector<RareEventState> reached;
+        for (uint32_t k = 0; k < effort; k++)
+        {
+            RareEventState state = entrance[uniform->GetInteger(0, entrance.size() - 1)];
+            if (RareEventAdvance(per, state, level, uniform, estimate.attempts))
+            {
+                reached.push_back(state);
+            }
+        }
+        if (reached.empty())
+        {
+            return estimate; // Below the resolution of this effort
+        }
+        double p = static_cast<double>(reached.size()) / effort;
+        probability *= p;
+        relVariance += (1 - p) / (effort * p);
+        entrance = std::move(reached);
+    }
+    estimate.probability = probability;
+    estimate.relError = std::sqrt(relVariance);
+    return estimate;
+}
+
+//* Frame error rate of every hop of a path, with the SNR shifted by snrOffsetDb
+static std::vector<double>
+PathErrorRates(const std::vector<uint16_t>& path, double snrOffsetDb, double sensitivityDbm = g_rxSensitivityDbm)
+{
+    std::vector<double> per;
+    for (uint32_t k = 0; k + 1 < path.size(); k++)
+    {
+        per.push_back(1 - LinkSuccessRate(zigbeeStacks.Get(path[k])->GetNode()->GetObject<MobilityModel>(),
+                                          zigbeeStacks.Get(path[k + 1])->GetNode()->GetObject<MobilityModel>(),
+                                          snrOffsetDb,
+                                          sensitivityDbm));
+    }
+    return per;
+}
+
+static double
+ClosedFormLoss(const std::vector<double>& per)
+{
+    double delivered = 1;
+    for (double p : per)
+    {
+        delivered *= 1 - std::pow(p, MAC_TX_ATTEMPTS);
+    }
+    return 1 - delivered;
+}
+
+typedef std::map<std::string, double> RunSummary; // Metrics of a child simulation (see Child Simulations)
+extern uint32_t g_jobs;
+static std::vector<RunSummary> RunChildSimulations(const std::vector<std::string>& argsList);
+
+static void
+PrintRareEventReport()
+{
+    std::cout << "\n--- Rare-event loss estimation (multilevel splitting, " << g_rareEventEffort
+              << " trajectories per level) ---\n";
+    Ptr<UniformRandomVariable> uniform = CreateObject<UniformRandomVariable>();
+    uniform->SetStream(STREAM_RARE_EVENT);
+    const std::vector<uint16_t>* worstPath = nullptr;
+    std::pair<uint16_t, uint16_t> worstFlow;
+    double worstLoss = -1;
+    for (const auto& flow : g_flowPaths)
+    {
+        // Dominant path of the flow
+        auto dominant = std::max_element(flow.second.begin(), flow.second.end(), [](const auto& a, const auto& b) {
+            return a.second.count < b.second.count;
+        });
+        const std::vector<uint16_t>& path = *g_paths[dominant->first];
+        std::vector<double> per = PathErrorRates(path, 0);
+        RareEventEstimate split = MultilevelSplitting(per, g_rareEventEffort, uniform);
+        double closedForm = ClosedFormLoss(per);
+        double avgAttempts = 0;
+        for (double p : per)
+        {
+            avgAttempts += 1 / (1 - p);
+        }
+
+        std::cout << "Flow Node " << flow.first.first << " -> Node " << flow.first.second << " | " << path.size() - 1
+                  << " hops | Worst link PER " << *std::max_element(per.begin(), per.end()) << "\n";
+        std::cout << "  Loss: closed form " << closedForm << " | splitting ";
+        if (split.probability > 0)
+        {
+            // Brute force packets for the same relative error: (1 - P) / (P RE^2)
+            double brutePackets = (1 - split.probability) / (split.probability * split.relError * split.relError);
+            std::cout << split.probability << " (relative error " << 100 * split.relError << " %) with "
+                      << split.attempts << " transmissions | brute force would need " << brutePackets
+                      << " packets (" << brutePackets * avgAttempts << " transmissions)\n";
+        }
+        else
+        {
+            std::cout << "below the resolution of " << split.attempts << " transmissions\n";
+        }
+        if (closedForm > worstLoss)
+        {
+            worstLoss = closedForm;
+            worstPath = &path;
+            worstFlow = flow.first;
+        }
+    }
+    if (!worstPath)
+    {
+        std::cout << "No delivered flow to analyze.\n";
+        return;
+    }
+
+    // Validation on the worst flow against brute-force ns-3 runs, with a degraded channel where they are affordable
+    const double sensitivity = RARE_EVENT_VALIDATION_SENSITIVITY_DBM;
+    std::cout << "Validation against ns-3 (worst flow Node " << worstFlow.first << " -> Node " << worstFlow.second
+              << ", SNR offset from the start of the traffic, rx sensitivity " << sensitivity << " dBm, " << g_jobs
+              << " runs per target):\n";
+    std::cout << "  Target loss | SNR offset [dB] | Closed form | Splitting | ns-3 brute force +/- 95 % (packets) | "
+                 "Model vs ns-3\n";
+    for (double target : {1e-2, 1e-3})
+    {
+        // Bisection on the SNR offset: the closed form loss decreases with the offset
+        double low = -100;
+        double high = 0;
+        if (ClosedFormLoss(PathErrorRates(*worstPath, high, sensitivity)) >= target)
+        {
+            low = high;
+        }
+        for (uint32_t k = 0; k < 40 && low < high; k++)
+        {
+            double mid = (low + high) / 2;
+            (ClosedFormLoss(PathErrorRates(*worstPath, mid, sensitivity)) > target ? low : high) = mid;
+        }
+        std::vector<double> per = PathErrorRates(*worstPath, low, sensitivity);
+        double closedForm = ClosedFormLoss(per);
+        RareEventEstimate split = MultilevelSplitting(per, g_rareEventEffort, uniform);
+
+        // Brute force in ns-3: the worst flow alone, RARE_EVENT_VALIDATION_LOSSES expected losses over g_jobs runs
+        uint32_t packetsPerRun = std::ceil(RARE_EVENT_VALIDATION_LOSSES / std::max(closedForm, target) / g_jobs);
+        std::vector<std::string> argsList;
+        for (uint32_t r = 1; r <= g_jobs; r++)
+        {
+            std::ostringstream args;
+            args << "--collection=0 --numSources=1 --sourceNode=" << worstFlow.first
+                 << " --destinationNode=" << worstFlow.second << " --snrOffset=" << low
+                 << " --rxSensitivity=" << sensitivity << " --numPackets=" << packetsPerRun << " --rngRun=" << r;
+            argsList.push_back(args.str());
+        }
+        double sent = 0;
+        double received = 0;
+        uint32_t failedRuns = 0;
+        for (const auto& summary : RunChildSimulations(argsList))
+        {
+            if (summary.count("sent") == 0)
+            {
+                failedRuns++;
+                continue;
+            }
+            sent += summary.at("sent");
+            received += summary.at("received");
+        }
+
+        std::cout << "  " << target << " | " << low << " | " << closedForm << " | " << split.probability << " +/- "
+                  << 100 * split.relError << " % | ";
+        if (sent > 0)
+        {
+            double measured = 1 - received / sent;
+            double halfWidth = 1.96 * std::sqrt(std::max(measured * (1 - measured), 1 / sent) / sent);
+            std::cout << measured << " +/- " << halfWidth << " (" << sent << ") | ";
+            if (std::abs(closedForm - measured) <= halfWidth)
+            {
+                std::cout << "consistent";
+            }
+            else
+            {
+                std::cout << "model " << (closedForm < measured ? "underestimates" : "overestimates") << " x"
+                          << ((closedForm < measured) ? measured / closedForm : closedForm / std::max(measured, 1 / sent));
+            }
+        }
+        else
+        {
+            std::cout << "no ns-3 result | -";
+        }
+        if (failedRuns > 0)
+        {
+            std::cout << " (" << failedRuns << " run(s) failed)";
+        }
+        std::cout << "\n";
+    }
+    std::cout << "---------------------------------------------------------------------------\n";
+}
+
+//* Sequential Early Stopping
+//* Purpose:
+//* Instead of always sending numPacketsToSend packets, the traffic stops as soon as the 95% confidence intervals of the
+//* PDR, mean latency and p99 latency are narrower than the target (half-width / estimate <= g_ciRelWidth).
+//*
+//* How it works (batch means):
+//* - PDR: packets are grouped in batches of g_ciBatchSize consecutive packet IDs; a batch is complete when all its
+//*   packets are resolved, and its PDR is one observation.
+//* - Latency: delays are grouped in batches of g_ciBatchSize consecutive receptions; each batch gives its mean.
+//* Batches are long enough to be nearly independent, so a Student-t interval on the batch statistics is valid.
+//* - P99 latency: the p99 of a 20-delay batch is its maximum, so the p99 uses sectioning instead: the estimate is the
+//*   p99 of all the delays, and the spread of the p99 of (at most g_ciMinBatches) consecutive sections of at least
+//*   P99_SECTION_DELAYS delays around it gives the interval.
+
+//* 97.5% quantile of the Student t distribution (two-sided 95% interval)
+static double
+StudentT975(uint32_t dof)
+{
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (dof == 0)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    return (dof <= 30) ? table[dof - 1] : 1.96 + 2.4 / dof;
+}
+
+//* Mean and 95% confidence half-width of a series of batch observations
+static std::pair<double, double>
+BatchMeansInterval(const std::vector<double>& batches)
+{
+    if (batches.size() < 2)
+    {
+        return {batches.empty() ? 0.0 : batches[0], std::numeric_limits<double>::infinity()};
+    }
+    double mean = std::accumulate(batches.begin(), batches.end(), 0.0) / batches.size();
+    double sumSq = 0;
+    for (double b : batches)
+    {
+        sumSq += (b - mean) * (b - mean);
+    }
+    double stdErr = std::sqrt(sumSq / (batches.size() - 1) / batches.size());
+    return {mean, StudentT975(batches.size() - 1) * stdErr};
+}
+
+//* Quantile q (0..1) of a series of values (nearest rank)
+static double
+Quantile(std::vector<double> values, double q)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(q * values.size()));
+    rank = std::min(values.size(), std::max<size_t>(rank, 1)) - 1;
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+//* P99 delay and its 95% confidence half-width (sectioning) with the number of sections used
+static std::tuple<double, double, uint32_t>
+SectioningP99Interval()
+{
+    double estimate = Quantile(g_delaySeries, 0.99);
+    uint32_t sections = std::min<size_t>(g_ciMinBatches, g_delaySeries.size() / P99_SECTION_DELAYS);
+    if (sections < 2)
+    {
+        return {estimate, std::numeric_limits<double>::infinity(), sections};
+    }
+    size_t sectionSize = g_delaySeries.size() / sections;
+    double sumSq = 0;
+    for (uint32_t k = 0; k < sections; k++)
+    {
+        std::vector<double> section(g_delaySeries.begin() + k * sectionSize,
+                                    g_delaySeries.begin() + (k + 1) * sectionSize);
+        double q = Quantile(section, 0.99);
+        sumSq += (q - estimate) * (q - estimate);
+    }
+    double stdErr = std::sqrt(sumSq / (sections - 1) / sections);
+    return {estimate, StudentT975(sections - 1) * stdErr, sections};
+}
+
+static bool
+IntervalConverged(const std::vector<double>& batches)
+{
+    auto interval = BatchMeansInterval(batches);
+    return batches.size() >= g_ciMinBatches && interval.second <= g_ciRelWidth * std::abs(interval.first);
+}
+
+static bool
+P99IntervalConverged()
+{
+    auto interval = SectioningP99Interval();
+    return std::get<1>(interval) <= g_ciRelWidth * std::abs(std::get<0>(interval));
+}
+
+//* Records the outcome of a resolved packet and, in early stop mode, stops the traffic once the intervals converged
+static void
+RecordPacketOutcome(uint32_t packetId, bool received, Time delay)
+{
+    if (packetId == 0 || packetId > g_packetOutcome.size())
+    {
+        return;
+    }
+    g_packetOutcome[packetId - 1] = received ? 1 : 0;
+    g_packetDelay[packetId - 1] = received ? delay.GetSeconds() : -1.0;
+
+    // PDR batches complete in send order
+    uint32_t batch = (packetId - 1) / g_ciBatchSize;
+    if (batch >= g_batchResolved.size())
+    {
+        g_batchResolved.resize(batch + 1, 0);
+    }
+    g_batchResolved[batch]++;
+    while (g_nextPdrBatch < g_batchResolved.size() && g_batchResolved[g_nextPdrBatch] == g_ciBatchSize)
+    {
+        uint32_t first = g_nextPdrBatch * g_ciBatchSize;
+        uint32_t receivedInBatch = std::count(g_packetOutcome.begin() + first,
+                                              g_packetOutcome.begin() + first + g_ciBatchSize,
+                                              static_cast<int8_t>(1));
+        g_pdrBatchMeans.push_back(static_cast<double>(receivedInBatch) / g_ciBatchSize);
+        g_nextPdrBatch++;
+    }
+
+    // Latency batches complete in reception order
+    if (received)
+    {
+        g_delaySeries.push_back(delay.GetSeconds());
+        g_delayBatch.push_back(delay.GetSeconds());
+        if (g_delayBatch.size() == g_ciBatchSize)
+        {
+            g_delayBatchMeans.push_back(std::accumulate(g_delayBatch.begin(), g_delayBatch.end(), 0.0) /
+                                        g_delayBatch.size());
+            g_delayBatch.clear();
+        }
+    }
+
+    if (g_earlyStop && g_earlyStopPackets == 0 && g_sendsRemaining > 0 && IntervalConverged(g_pdrBatchMeans) &&
+        IntervalConverged(g_delayBatchMeans) && P99IntervalConverged())
+    {
+        g_earlyStopPackets = g_totalPacketsSent;
+        g_earlyStopTime = Simulator::Now();
+        g_sendsRemaining = 0; // The traffic generator stops, the outstanding packets are still resolved
+        std::cout << Simulator::Now().As(Time::S) << " Confidence intervals converged after " << g_earlyStopPackets
+                  << " packets: stopping the traffic.\n";
+    }
+}
+
+//* Prints the confidence intervals and the early stop outcome
+static void
+PrintConfidenceIntervals()
+{
+    auto print = [](const char* name, const std::vector<double>& batches, double scale, const char* unit) {
+        auto interval = BatchMeansInterval(batches);
+        std::cout << name << interval.first * scale << " +/- " << interval.second * scale << unit << " ("
+                  << batches.size() << " batches)\n";
+    };
+    std::cout << "--- 95% Confidence Intervals (batch means, " << g_ciBatchSize << " packets/batch) ---\n";
+    print("PDR:           ", g_pdrBatchMeans, 100.0, " %");
+    print("Average Delay: ", g_delayBatchMeans, 1.0, " s");
+    auto p99 = SectioningP99Interval();
+    std::cout << "P99 Delay:     " << std::get<0>(p99) << " +/- " << std::get<1>(p99) << " s (" << std::get<2>(p99)
+              << " sections of " << g_delaySeries.size() / std::max(1u, std::get<2>(p99)) << " delays)\n";
+    if (g_earlyStop)
+    {
+        if (g_earlyStopPackets > 0)
+        {
+            std::cout << "Early stop: converged to +/-" << g_ciRelWidth * 100 << " % after " << g_earlyStopPackets
+                      << " packets (T=" << g_earlyStopTime.As(Time::S) << ")\n";
+        }
+        else
+        {
+            std::cout << "Early stop: NOT converged to +/-" << g_ciRelWidth * 100 << " % with "
+                      << g_totalPacketsSent << " packets\n";
+        }
+    }
+}
+
+//* Warm-up Detection
+//* Purpose:
+//* The first packets pay for the route discovery, which skews the average latency and the jitter. The warm-up
+//* (transient) is detected with MSER-5 on the delay series in send order, and the metrics are reported separately for
+//* the transient and for the steady state.
+//*
+//* How it works (MSER-5):
+//* The delays are averaged in batches of 5 (Z_1..Z_m). For every truncation point d (at most m/2), the statistic
+//* MSER(d) = sum_{j>d} (Z_j - mean_{j>d})^2 / (m - d)^2 is computed with suffix sums (O(m) overall), and the transient
+//* is the d minimizing it: the first 5*d received packets.
+
+//* Returns the number of delays of the series to discard as warm-up
+static uint32_t
+Mser5Truncation(const std::vector<double>& series)
+{
+    const uint32_t batchSize = 5;
+    const uint32_t m = series.size() / batchSize;
+    if (m < 4)
+    {
+        return 0; // Too short to detect anything
+    }
+    std::vector<double> batchMeans(m);
+    for (uint32_t j = 0; j < m; j++)
+    {
+        batchMeans[j] = std::accumulate(series.begin() + j * batchSize, series.begin() + (j + 1) * batchSize, 0.0) /
+                        batchSize;
+    }
+
+    // Suffix sums of Z and Z^2 give the sum of squared deviations of every suffix in O(1)
+    double suffixSum = 0;
+    double suffixSumSq = 0;
+    double bestMser = std::numeric_limits<double>::infinity();
+    uint32_t bestD = 0;
+    for (int32_t d = m - 1; d >= 0; d--)
+    {
+        suffixSum += batchMeans[d];
+        suffixSumSq += batchMeans[d] * batchMeans[d];
+        uint32_t count = m - d;
+        if (static_cast<uint32_t>(d) <= m / 2)
+        {
+            double mser = (suffixSumSq - suffixSum * suffixSum / count) / (static_cast<double>(count) * count);
+            if (mser <= bestMser)
+            {
+                bestMser = mser;
+                bestD = d;
+            }
+        }
+    }
+    return bestD * batchSize;
+}
+
+//* Prints the transient length and the transient / steady-state metrics
+static void
+PrintWarmupReport()
+{
+    // Delays of the received packets in send order
+    std::vector<double> delays;
+    std::vector<uint32_t> delayPacketIndex;
+    for (uint32_t k = 0; k < g_packetDelay.size(); k++)
+    {
+        if (g_packetDelay[k] >= 0)
+        {
+            delays.push_back(g_packetDelay[k]);
+            delayPacketIndex.push_back(k);
+        }
+    }
+
+    std::cout << "--- Warm-up Detection (MSER-5) ---\n";
+    if (delays.empty())
+    {
+        std::cout << "Transient: N/A (no packets received)\n";
+        return;
+    }
+
+    uint32_t truncation = Mser5Truncation(delays);
+    uint32_t firstSteadyPacket = (truncation < delays.size()) ? delayPacketIndex[truncation] : g_packetDelay.size();
+    double transientTime = g_packetSendTime[firstSteadyPacket < g_packetSendTime.size() ? firstSteadyPacket : 0] -
+                           g_packetSendTime[0];
+    std::cout << "Transient length: " << firstSteadyPacket << " packets (" << transientTime << " s from the first send)\n";
+
+    auto printPhase = [](const char* name, uint32_t first, uint32_t last) {
+        uint32_t sent = 0;
+        std::vector<double> phaseDelays;
+        for (uint32_t k = first; k < last; k++)
+        {
+            if (g_packetOutcome[k] < 0)
+            {
+                continue; // Still outstanding (stopped by the safety time)
+            }
+            sent++;
+            if (g_packetDelay[k] >= 0)
+            {
+                phaseDelays.push_back(g_packetDelay[k]);
+            }
+        }
+        if (sent == 0 || phaseDelays.empty())
+        {
+            std::cout << name << "N/A\n";
+            return;
+        }
+        double mean = std::accumulate(phaseDelays.begin(), phaseDelays.end(), 0.0) / phaseDelays.size();
+        double sumSq = 0;
+        for (double d : phaseDelays)
+        {
+            sumSq += (d - mean) * (d - mean);
+        }
+        std::cout << name << "PDR " << 100.0 * phaseDelays.size() / sent << " % | Avg Delay " << mean
+                  << " s | Max Delay " << *std::max_element(phaseDelays.begin(), phaseDelays.end())
+                  << " s | Jitter " << std::sqrt(sumSq / phaseDelays.size()) << " s (" << sent << " packets)\n";
+    };
+    printPhase("Transient:    ", 0, firstSteadyPacket);
+    printPhase("Steady state: ", firstSteadyPacket, g_packetDelay.size());
+}
+
+//* Windowed Metrics
+//* Purpose:
+//* The final results collapse the whole run into one set of averages, which hides congestion or route flap episodes.
+//* A periodic sampler writes one line per window to a compact CSV time-series:
+//*   t_start,t_end,sent,received,lost,outstanding,goodput_bps,delay_p50,delay_p90,delay_p99,delay_max
+//* 'received' and the delays refer to the packets received in the window (possibly sent in an earlier one), 'lost' to
+//* the packets dropped or timed out in the window. The counters are updated in O(1) per packet and reset per window.
+
+//* Writes the current window and starts a new one
+static void
+WriteMetricsWindow()
+{
+    Time now = Simulator::Now();
+    double duration = (now - g_windowStart).GetSeconds();
+    if (duration <= 0)
+    {
+        return;
+    }
+
+    g_metricsStream << g_windowStart.GetSeconds() << "," << now.GetSeconds() << "," << g_windowSent << ","
+                    << g_windowReceived << "," << g_windowLost << "," << g_sendTimeMap.size() << ","
+                    << g_windowBytes * 8 / duration;
+    if (g_windowDelays.empty())
+    {
+        g_metricsStream << ",,,,\n";
+    }
+    else
+    {
+        g_metricsStream << "," << Quantile(g_windowDelays, 0.5) << "," << Quantile(g_windowDelays, 0.9) << ","
+                        << Quantile(g_windowDelays, 0.99) << ","
+                        << *std::max_element(g_windowDelays.begin(), g_windowDelays.end()) << "\n";
+    }
+    g_metricsWindows++;
+
+    g_windowStart = now;
+    g_windowSent = 0;
+    g_windowReceived = 0;
+    g_windowLost = 0;
+    g_windowBytes = 0;
+    g_windowDelays.clear();
+}
+
+//* Periodic sampler (reschedules itself every 'window' seconds)
+static void
+SampleMetricsWindow(double window)
+{
+    WriteMetricsWindow();
+    Simulator::Schedule(Seconds(window), &SampleMetricsWindow, window);
+}
+
+//* Airtime and Goodput
+//* Purpose:
+//* Tells how close a topology is to channel saturation. From the LR-WPAN PHY traces of every node:
+//* - TrxState gives the time spent transmitting, receiving, in turnaround, listening to an idle channel or off.
+//* - PhyTxBegin gives the frames and bytes sent on air (including relays, retransmissions, NWK commands and ACKs).
+//* The channel utilization is the fraction of time with at least one transmission in progress (union over all nodes),
+//* the payload efficiency is the ratio between the payload bytes delivered and all the bytes sent on air.
+static AirtimeState
+ToAirtimeState(PhyEnumeration state)
+{
+    switch (state)
+    {
+    case IEEE_802_15_4_PHY_BUSY_TX:
+        return AIRTIME_TX;
+    case IEEE_802_15_4_PHY_BUSY_RX:
+        return AIRTIME_RX;
+    case IEEE_802_15_4_PHY_RX_ON:
+        return AIRTIME_IDLE;
+    case IEEE_802_15_4_PHY_TX_ON:
+    case IEEE_802_15_4_PHY_BUSY:
+        return AIRTIME_BUSY;
+    default:
+        return AIRTIME_OFF;
+    }
+}
+
+//* TrxState trace of every node
+static void
+AirtimeTrxState(uint16_t nodeId, Time time, PhyEnumeration /* oldState */, PhyEnumeration newState)
+{
+    AirtimeStats& stats = g_airtime[nodeId];
+    Time now = time;
+    AirtimeState state = ToAirtimeState(newState);
+
+    stats.inState[stats.state] += now - stats.since;
+    if (stats.state != AIRTIME_TX && state == AIRTIME_TX && g_activeTransmitters++ == 0)
+    {
+        g_channelBusySince = now;
+    }
+    else if (stats.state == AIRTIME_TX && state != AIRTIME_TX && --g_activeTransmitters == 0)
+    {
+        g_channelBusyTime += now - g_channelBusySince;
+    }
+    stats.state = state;
+    stats.since = now;
+}
+
+//* PhyTxBegin trace of every node
+static void
+AirtimePhyTxBegin(uint16_t nodeId, Ptr<const Packet> p)
+{
+    g_airtime[nodeId].txFrames++;
+    g_airtime[nodeId].txAirtimeBytes += p->GetSize() + PHY_SHR_PHR_BYTES;
+
+    // Control overhead: MAC data frames that do not carry a tracked packet (route requests/replies, link status, ...)
+    Ptr<Packet> copy = p->Copy();
+    LrWpanMacHeader macHdr;
+    PacketIdTag tag;
+    ResponseTag responseTag;
+    PollTag pollTag; // Polls are counted apart (sleepy end devices report)
+    if (copy->RemoveHeader(macHdr) > 0 && macHdr.IsData() && !p->PeekPacketTag(tag) && !p->PeekPacketTag(responseTag) &&
+        !p->PeekPacketTag(pollTag) && g_apsFrameUids.count(p->GetUid()) == 0 &&
+        g_frameReadings.count(p->GetUid()) == 0)
+    {
+        g_airtime[nodeId].controlFrames++;
+    }
+}
+
+//* Restarts the measurement (at the beginning of the traffic, to exclude the network formation)
+static void
+ResetAirtimeStats()
+{
+    Time now = Simulator::Now();
+    for (auto& stats : g_airtime)
+    {
+        stats = AirtimeStats{{}, stats.state, now, 0, 0};
+    }
+    g_channelBusySince = now;
+    g_channelBusyTime = Seconds(0);
+    g_airtimeStart = now;
+}
+
+//* Returns the number of routing table entries of every router and of the coordinator
+static std::vector<size_t>
+RoutingTableSizes()
+{
+    std::vector<size_t> sizes;
+    for (auto i = zigbeeStacks.Begin(); i != zigbeeStacks.End(); i++)
+    {
+        if (!IsEndDevice(*i))
+        {
+            size_t rows = CaptureTableRows((*i)->GetNwk(), SNAPSHOT_ROUTING_TABLE).size();
+            sizes.push_back(rows > g_routingTableHeaderRows ? rows - g_routingTableHeaderRows : 0);
+        }
+    }
+    return sizes;
+}
+
+//* Returns the NWK control frames sent by all the nodes since the start of the traffic
+static uint64_t
+TotalControlFrames()
+{
+    uint64_t frames = 0;
+    for (const auto& stats : g_airtime)
+    {
+        frames += stats.controlFrames;
+    }
+    return frames;
+}
+
+//* Returns the payload throughput delivered to all the destinations since the start of the traffic [bit/s]
+static double
+TotalGoodput()
+{
+    double duration = (Simulator::Now() - g_airtimeStart).GetSeconds();
+    uint64_t payloadBytes = 0;
+    for (const auto& flow : g_flowGoodput)
+    {
+        payloadBytes += flow.second.payloadBytes;
+    }
+    return duration > 0 ? payloadBytes * 8 / duration : 0.0;
+}
+
+//* Returns the payload throughput delivered to the coordinator (the sink of the collection traffic) [bit/s]
+static double
+SinkThroughput()
+{
+    double duration = (Simulator::Now() - g_airtimeStart).GetSeconds();
+    uint64_t payloadBytes = 0;
+    for (const auto& flow : g_flowGoodput)
+    {
+        if (flow.first.second == 0)
+        {
+            payloadBytes += flow.second.payloadBytes;
+        }
+    }
+    return duration > 0 ? payloadBytes * 8 / duration : 0.0;
+}
+
+//* PrintCollectionReport Function
+//Purpose: Summarizes the cost of the routing for the collection traffic (many-to-one or per-flow route discovery).
+//How it works: routing table entries are counted on every router from its printed routing table,
+//the control overhead is the number of MAC data frames not carrying a tracked packet (see AirtimePhyTxBegin)
+static void
+PrintCollectionReport()
+{
+    std::vector<size_t> sizes = RoutingTableSizes();
+    size_t maxEntries = sizes.empty() ? 0 : *std::max_element(sizes.begin(), sizes.end());
+    double avgEntries = sizes.empty() ? 0.0 : std::accumulate(sizes.begin(), sizes.end(), 0.0) / sizes.size();
+
+    std::cout << "\n--- Collection Routing Cost ---\n";
+    std::cout << "Many-to-one route discoveries: " << g_mtoDiscoveries << "\n";
+    std::cout << "Routing table entries per router: avg " << avgEntries << ", max " << maxEntries << " ("
+              << sizes.size() << " routers and coordinator)\n";
+    std::cout << "NWK control frames sent:       " << TotalControlFrames() << "\n";
+    std::cout << "Sink throughput (Node 0):      " << SinkThroughput() << " bit/s of payload\n";
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* Returns the fraction of time with at least one transmission on the channel since the start of the traffic
+static double
+ChannelUtilization()
+{
+    Time now = Simulator::Now();
+    double duration = (now - g_airtimeStart).GetSeconds();
+    Time channelBusy = g_channelBusyTime + (g_activeTransmitters > 0 ? now - g_channelBusySince : Seconds(0));
+    return duration > 0 ? channelBusy.GetSeconds() / duration : 0.0;
+}
+
+//* Prints the airtime of every node, the channel utilization and the goodput of every flow
+static void
+PrintAirtimeReport()
+{
+    Time now = Simulator::Now();
+    double duration = (now - g_airtimeStart).GetSeconds();
+    if (duration <= 0)
+    {
+        return;
+    }
+    for (auto& stats : g_airtime)
+    {
+        stats.inState[stats.state] += now - stats.since; // Close the current state
+        stats.since = now;
+    }
+
+    std::cout << "\n--- Airtime (" << duration << " s from the first packet sent) ---\n";
+    std::cout << "Node | TX % | RX % | Busy % | Idle % | Off % | Frames | Airtime bytes\n";
+    double sumTx = 0;
+    uint64_t totalAirtimeBytes = 0;
+    for (uint32_t n = 0; n < g_airtime.size(); n++)
+    {
+        const AirtimeStats& stats = g_airtime[n];
+        std::cout << n;
+        for (uint8_t k = 0; k < AIRTIME_NUM_STATES; k++)
+        {
+            std::cout << " | " << 100.0 * stats.inState[k].GetSeconds() / duration;
+        }
+        std::cout << " | " << stats.txFrames << " | " << stats.txAirtimeBytes << "\n";
+        sumTx += stats.inState[AIRTIME_TX].GetSeconds();
+        totalAirtimeBytes += stats.txAirtimeBytes;
+    }
+
+    uint64_t payloadBytes = 0;
+    std::cout << "Channel utilization (any transmission): " << 100.0 * ChannelUtilization() << " %\n";
+    std::cout << "Aggregate TX time / duration:           " << 100.0 * sumTx / duration << " %\n";
+    std::cout << "--- Goodput per flow ---\n";
+    for (const auto& flow : g_flowGoodput)
+    {
+        double active = flow.second.lastReceive - flow.second.firstSend;
+        payloadBytes += flow.second.payloadBytes;
+        std::cout << "Flow Node " << flow.first.first << " -> Node " << flow.first.second << ": "
+                  << (active > 0 ? flow.second.payloadBytes * 8 / active : 0.0) << " bit/s ("
+                  << flow.second.payloadBytes << " payload bytes)\n";
+    }
+    if (totalAirtimeBytes > 0)
+    {
+        std::cout << "Payload efficiency (payload delivered / bytes on air): "
+                  << 100.0 * payloadBytes / totalAirtimeBytes << " % (" << payloadBytes << " / " << totalAirtimeBytes
+                  << " bytes)\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* Completion Tracking
+//* Purpose:
+//* Stops the simulation as soon as every packet is resolved instead of waiting for a fixed padding time.
+//* A packet is resolved when it is received, confirmed as dropped (failed NLDE-DATA.confirm at the source), or when it
+//* is still outstanding after the packet timeout. A MAC drop at a relay does not resolve the packet: the frame may have
+//* been received with only its MAC ack lost, so the packet is lost only if it does not arrive before the timeout.
+//* When nothing is outstanding and no more packets are scheduled, the final reports are printed and the run stops.
+
+//* Prints all the final reports (once) and stops the simulation
+static void
+RunFinalReports()
+{
+    if (g_finalReportsDone)
+    {
+        return;
+    }
+    g_finalReportsDone = true;
+    for (const auto& report : g_finalReports)
+    {
+        report();
+    }
+    Simulator::Stop();
+}
+
+//* Called every time a packet is resolved or sent
+static void
+CheckCompletion()
+{
+    if (g_stopOnCompletion && !g_finalReportsDone && g_sendsRemaining == 0 && g_sendTimeMap.empty() &&
+        g_replyPending.empty() && g_apsPending.empty())
+    {
+        std::cout << Simulator::Now().As(Time::S) << " All packets resolved, ending the simulation.\n";
+        Simulator::ScheduleNow(&RunFinalReports);
+    }
+}
+
+//* Marks an outstanding packet as dropped (returns false if it was already resolved)
+static bool
+ResolveDroppedPacket(uint32_t packetId, const char* reason)
+{
+    if (g_sendTimeMap.erase(packetId) == 0)
+    {
+        return false;
+    }
+    g_packetsDropped++;
+    g_windowLost++;
+    RecordPacketOutcome(packetId, false, Seconds(0));
+    NS_LOG_INFO("Packet ID " << packetId << " dropped (" << reason << ")");
+    CheckCompletion();
+    return true;
+}
+
+//* Packet timeout: the packet is considered lost if still outstanding
+static void
+ExpirePacket(uint32_t packetId)
+{
+    if (g_sendTimeMap.erase(packetId) > 0)
+    {
+        g_packetsTimedOut++;
+        g_windowLost++;
+        RecordPacketOutcome(packetId, false, Seconds(0));
+        NS_LOG_INFO("Packet ID " << packetId << " timed out");
+        CheckCompletion();
+    }
+}
+
+//* Returns a free NSDU handle of node 'nodeId', reserved until the NLDE-DATA.confirm of the frame carrying 'packetIds'.
+//* Handles are allocated per node, so more than 256 outstanding packets never share one. If all 256 are waiting for
+//* their confirm, the oldest one is reused when it is older than the packet timeout (its packets are already resolved).
+static uint8_t
+AllocateNsduHandle(uint32_t nodeId, const std::vector<uint32_t>& packetIds)
+{
+    double now = Simulator::Now().GetSeconds();
+    uint8_t& next = g_nextNsduHandle[nodeId];
+    auto oldest = g_nsduHandleToPacket.end();
+    for (uint32_t tries = 0; tries < 256; tries++, next++)
+    {
+        auto it = g_nsduHandleToPacket.find({nodeId, next});
+        if (it == g_nsduHandleToPacket.end())
+        {
+            g_nsduHandleToPacket[{nodeId, next}] = {packetIds, now};
+            return next++;
+        }
+        if (oldest == g_nsduHandleToPacket.end() || it->second.time < oldest->second.time)
+        {
+            oldest = it;
+        }
+    }
+    NS_ABORT_MSG_IF(now - oldest->second.time < g_packetTimeout,
+                    "Node " << nodeId << " has 256 NLDE-DATA.requests waiting for their confirm");
+    oldest->second = {packetIds, now};
+    return oldest->first.second;
+}
+
+//* NldeDataConfirm Function
+//Purpose: This is a callback function that is invoked when the NWK of the source confirms a data request.
+//What it does:
+//If the request failed (e.g. route discovery failed), the packet is resolved as dropped.
+static void
+NwkDataConfirm(Ptr<ZigbeeStack> stack, NldeDataConfirmParams params)
+{
+    auto it = g_nsduHandleToPacket.find({stack->GetNode()->GetId(), params.m_nsduHandle});
+    if (it == g_nsduHandleToPacket.end())
+    {
+        return;
+    }
+    if (params.m_status != NwkStatus::SUCCESS)
+    {
+        for (uint32_t packetId : it->second.packetIds)
+        {
+            std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
+                      << "NldeDataConfirm: Packet ID " << packetId << " FAILED with status " << params.m_status << "\n";
+            if (!g_aps) // With the APS layer the frame is retransmitted when the APS ack does not come
+            {
+                ResolveDroppedPacket(packetId, "NLDE-DATA.confirm failure");
+            }
+        }
+    }
+    g_nsduHandleToPacket.erase(it);
+}
+
+static void ApsAckTimeout(uint32_t packetId);
+
+//* ApsTransmit Function
+//Purpose: Transmits (or retransmits) the APS data frame of packet 'packetId' with the acknowledgement request set,
+//then waits apsAckWaitDuration for the APS ack (see ApsAckTimeout).
+static void
+ApsTransmit(uint32_t packetId, Ptr<Packet> p)
+{
+    ApsPending& pending = g_apsPending[packetId];
+    pending.attempts++;
+
+    ApsFrameHeader apsHdr;
+    apsHdr.SetFrameType(ApsFrameHeader::APS_DATA);
+    apsHdr.SetAckRequest(true);
+    apsHdr.SetCounter(pending.counter);
+    p->AddHeader(apsHdr);
+    g_apsFrameUids[p->GetUid()] = pending.attempts;
+
+    NldeDataRequestParams dataReqParams;
+    dataReqParams.m_dstAddrMode = UCST_BCST;
+    dataReqParams.m_dstAddr = pending.dst->GetNwk()->GetNetworkAddress();
+    dataReqParams.m_nsduHandle = AllocateNsduHandle(pending.src->GetNode()->GetId(), {packetId});
+    dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY;
+    Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, pending.src->GetNwk(), dataReqParams, p);
+
+    pending.ackTimer = Simulator::Schedule(Seconds(g_apsAckWait), &ApsAckTimeout, packetId);
+}
+
+//* APSDE-DATA.request: sends packet 'packetId' from stackSrc to stackDst with end-to-end acknowledgement
+static void
+ApsDataRequest(Ptr<ZigbeeStack> stackSrc, Ptr<ZigbeeStack> stackDst, uint32_t packetId, Ptr<Packet> p)
+{
+    uint16_t srcId = stackSrc->GetNode()->GetId();
+    ApsPending& pending = g_apsPending[packetId];
+    pending.src = stackSrc;
+    pending.dst = stackDst;
+    pending.counter = g_apsCounter[srcId]++;
+    g_apsCounterToPacket[{srcId, pending.counter}] = packetId;
+    ApsTransmit(packetId, p);
+}
+
+//* No APS ack within apsAckWaitDuration: retransmit, or give up after apsMaxFrameRetries retransmissions
+static void
+ApsAckTimeout(uint32_t packetId)
+{
+    auto it = g_apsPending.find(packetId);
+    if (it == g_apsPending.end())
+    {
+        return;
+    }
+    if (it->second.attempts <= g_apsMaxRetries)
+    {
+        g_apsRetransmissions++;
+        NS_LOG_INFO("Packet ID " << packetId << " not acknowledged, APS retransmission " << it->second.attempts);
+        auto path = g_pathInFlight.find(packetId);
+        if (path != g_pathInFlight.end())
+        {
+            path->second.resize(1); // The path of the retransmission starts again at the source
+        }
+        Ptr<Packet> p = Create<Packet>(5); // A new frame (the NWK and MAC headers of the first one are gone)
+        PacketIdTag tag;
+        tag.SetPacketId(packetId);
+        p->AddPacketTag(tag);
+        ApsTransmit(packetId, p);
+        return;
+    }
+
+    g_apsFailures++;
+    g_apsCounterToPacket.erase({static_cast<uint16_t>(it->second.src->GetNode()->GetId()), it->second.counter});
+    g_apsPending.erase(it);
+    if (!ResolveDroppedPacket(packetId, "APS retries exhausted")) // Delivered, only the acks were lost
+    {
+        CheckCompletion();
+    }
+}
+
+//* Sends the APS ack of the frame with APS counter 'counter' from stack to 'dstAddr'
+static void
+ApsSendAck(Ptr<ZigbeeStack> stack, Mac16Address dstAddr, uint8_t counter)
+{
+    Ptr<Packet> p = Create<Packet>(0);
+    ApsFrameHeader apsHdr;
+    apsHdr.SetFrameType(ApsFrameHeader::APS_ACK);
+    apsHdr.SetCounter(counter);
+    p->AddHeader(apsHdr);
+    g_apsFrameUids[p->GetUid()] = 0;
+    g_apsAcksSent++;
+
+    NldeDataRequestParams dataReqParams;
+    dataReqParams.m_dstAddrMode = UCST_BCST;
+    dataReqParams.m_dstAddr = dstAddr;
+    dataReqParams.m_nsduHandle = AllocateNsduHandle(stack->GetNode()->GetId(), {});
+    dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY;
+    Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, stack->GetNwk(), dataReqParams, p);
+}
+
+//* APS part of the NLDE-DATA.indication: removes the APS header, ends the transactions acknowledged by APS acks,
+//* acknowledges data frames and rejects the duplicates (retransmissions of frames already delivered).
+//* Returns true if the payload must be delivered to the application.
+static bool
+ApsDataIndication(Ptr<ZigbeeStack> stack, const NldeDataIndicationParams& params, Ptr<Packet> p)
+{
+    ApsFrameHeader apsHdr;
+    p->RemoveHeader(apsHdr);
+
+    if (apsHdr.GetFrameType() == ApsFrameHeader::APS_ACK)
+    {
+        auto key = std::make_pair(static_cast<uint16_t>(stack->GetNode()->GetId()), apsHdr.GetCounter());
+        auto it = g_apsCounterToPacket.find(key);
+        if (it == g_apsCounterToPacket.end())
+        {
+            return false; // Duplicate or late ack
+        }
+        auto pending = g_apsPending.find(it->second);
+        if (pending != g_apsPending.end())
+        {
+            pending->second.ackTimer.Cancel();
+            g_apsPending.erase(pending);
+        }
+        g_apsAcksReceived++;
+        g_apsCounterToPacket.erase(it);
+        CheckCompletion();
+        return false;
+    }
+
+    // Always acknowledge: if this is a retransmission, our previous ack was lost
+    if (apsHdr.GetAckRequest())
+    {
+        ApsSendAck(stack, params.m_srcAddr, apsHdr.GetCounter());
+    }
+    auto key = std::make_pair(AddrKey(params.m_srcAddr), apsHdr.GetCounter());
+    double now = Simulator::Now().GetSeconds();
+    auto seen = g_apsDuplicateTable.find(key);
+    if (seen != g_apsDuplicateTable.end() && now - seen->second < (g_apsMaxRetries + 1) * g_apsAckWait)
+    {
+        g_apsDuplicates++;
+        return false;
+    }
+    g_apsDuplicateTable[key] = now;
+
+    // Attempt of the frame that actually arrived (a late copy of an earlier attempt can arrive after a retransmission)
+    PacketIdTag tag;
+    auto attempt = g_apsFrameUids.find(p->GetUid());
+    if (p->PeekPacketTag(tag) && attempt != g_apsFrameUids.end())
+    {
+        auto pending = g_apsPending.find(tag.GetPacketId());
+        if (pending != g_apsPending.end())
+        {
+            pending->second.arrived = attempt->second;
+        }
+    }
+    return true;
+}
+
+//* First delivery of an APS frame: attempt number and delay (for the extra latency of the retries)
+static void
+RecordApsDelivery(uint32_t packetId, Time delay)
+{
+    auto it = g_apsPending.find(packetId);
+    uint32_t attempt = (it != g_apsPending.end() && it->second.arrived > 0) ? it->second.arrived : 1;
+    if (g_apsDeliveredAtAttempt.size() <= attempt)
+    {
+        g_apsDeliveredAtAttempt.resize(attempt + 1, 0);
+    }
+    g_apsDeliveredAtAttempt[attempt]++;
+    (attempt == 1 ? g_apsFirstAttemptDelays : g_apsRetriedDelays).push_back(delay.GetSeconds());
+}
+
+//* PhyTxBegin trace of every node: bytes on air of the APS first attempts, retransmissions and acks
+static void
+ApsPhyTxBegin(Ptr<const Packet> p)
+{
+    auto it = g_apsFrameUids.find(p->GetUid());
+    if (it != g_apsFrameUids.end())
+    {
+        g_apsAirtimeBytes[it->second == 0 ? 2 : (it->second == 1 ? 0 : 1)] += p->GetSize() + PHY_SHR_PHR_BYTES;
+    }
+}
+
+//* PrintApsReport Function
+//Purpose: Prints what the end-to-end reliability of the APS layer costs.
+//How it works: the delivery ratio counts the frames delivered at any attempt; the extra latency compares the delay of
+//all the delivered frames with the delay of the frames delivered at the first attempt; the airtime overhead is the
+//share of bytes on air spent on retransmissions and APS acks (all hops).
+static void
+PrintApsReport()
+{
+    auto mean = [](const std::vector<double>& v) {
+        return v.empty() ? 0.0 : std::accumulate(v.begin(), v.end(), 0.0) / v.size();
+    };
+    uint32_t sent = g_totalPacketsSent;
+    uint32_t firstAttempt = g_apsDeliveredAtAttempt.size() > 1 ? g_apsDeliveredAtAttempt[1] : 0;
+
+    std::cout << "\n--- APS Acknowledged Delivery (apsMaxFrameRetries " << g_apsMaxRetries << ", apsAckWaitDuration "
+              << g_apsAckWait << " s) ---\n";
+    std::cout << "Delivery ratio after retries:  " << (sent > 0 ? 100.0 * g_totalPacketsReceived / sent : 0.0) << " %\n";
+    std::cout << "Delivery ratio first attempt:  " << (sent > 0 ? 100.0 * firstAttempt / sent : 0.0) << " %\n";
+    for (uint32_t attempt = 2; attempt < g_apsDeliveredAtAttempt.size(); attempt++)
+    {
+        std::cout << "Delivered at attempt " << attempt << ":        " << g_apsDeliveredAtAttempt[attempt] << "\n";
+    }
+    std::cout << "Retransmissions:               " << g_apsRetransmissions << "\n";
+    std::cout << "APS acks sent / received:      " << g_apsAcksSent << " / " << g_apsAcksReceived << "\n";
+    std::cout << "Duplicates rejected:           " << g_apsDuplicates << "\n";
+    std::cout << "Frames never acknowledged:     " << g_apsFailures << "\n";
+
+    std::vector<double> allDelays = g_apsFirstAttemptDelays;
+    allDelays.insert(allDelays.end(), g_apsRetriedDelays.begin(), g_apsRetriedDelays.end());
+    std::cout << "Delay first attempt (avg):     " << mean(g_apsFirstAttemptDelays) << " s\n";
+    std::cout << "Delay after retries (avg):     " << mean(g_apsRetriedDelays) << " s\n";
+    std::cout << "Extra latency of reliability:  " << mean(allDelays) - mean(g_apsFirstAttemptDelays)
+              << " s on average";
+    if (!allDelays.empty() && !g_apsFirstAttemptDelays.empty())
+    {
+        std::cout << ", " << Quantile(allDelays, 0.99) - Quantile(g_apsFirstAttemptDelays, 0.99) << " s on the p99";
+    }
+    std::cout << "\n";
+
+    uint64_t overheadBytes = g_apsAirtimeBytes[1] + g_apsAirtimeBytes[2];
+    uint64_t totalBytes = g_apsAirtimeBytes[0] + overheadBytes;
+    std::cout << "Bytes on air:                  first attempts " << g_apsAirtimeBytes[0] << ", retransmissions "
+              << g_apsAirtimeBytes[1] << ", acks " << g_apsAirtimeBytes[2] << "\n";
+    std::cout << "Airtime overhead:              " << (totalBytes > 0 ? 100.0 * overheadBytes / totalBytes : 0.0)
+              << " % of the APS bytes on air\n";
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* Returns true if 'stack' is addressed by a broadcast to g_broadcastAddr
+static bool
+IsBroadcastRecipient(Ptr<ZigbeeStack> stack)
+{
+    if (g_broadcastAddr == Mac16Address("FF:FC"))
+    {
+        return !IsEndDevice(stack); // Routers and coordinator
+    }
+    if (g_broadcastAddr == Mac16Address("FF:FD"))
+    {
+        return DynamicCast<LrWpanNetDevice>(stack->GetNode()->GetDevice(0))->GetMac()->GetRxOnWhenIdle();
+    }
+    return true; // FF:FF: all devices
+}
+
+//* Starts the tracking of broadcast 'packetId' sent by 'src'
+static void
+StartBroadcastTracking(uint32_t packetId, Ptr<ZigbeeStack> src)
+{
+    const uint32_t n = zigbeeStacks.GetN();
+    if (g_broadcastNeighbors.empty())
+    {
+        // Nodes in radio range of each other, once (the topology is static)
+        std::unordered_map<uint16_t, int32_t> addrToIndex;
+        std::vector<double> cost = ComputeLinkCosts(IndexStacks(addrToIndex));
+        g_broadcastNeighbors.resize(n);
+        for (uint32_t a = 0; a < n; a++)
+        {
+            for (uint32_t b = 0; b < n; b++)
+            {
+                if (a != b && cost[a * n + b] != LINK_COST_NONE)
+                {
+                    g_broadcastNeighbors[a].push_back(b);
+                }
+            }
+        }
+        g_broadcastTx.assign(n, 0);
+        g_broadcastRebroadcasts.assign(n, 0);
+        g_broadcastRedundant.assign(n, 0);
+    }
+
+    BroadcastStats& stats = g_broadcasts[packetId];
+    stats.sendTime = Simulator::Now().GetSeconds();
+    stats.src = src->GetNode()->GetId();
+    stats.expected.assign(n, false);
+    stats.delivered.assign(n, false);
+    stats.heard.assign(n, false);
+    stats.heard[stats.src] = true;
+    for (uint32_t v = 0; v < n; v++)
+    {
+        if (v != stats.src && IsBroadcastRecipient(zigbeeStacks.Get(v)))
+        {
+            stats.expected[v] = true;
+            stats.numExpected++;
+        }
+    }
+}
+
+//* A broadcast reached the application of 'stack': coverage, and completion when the last expected node gets it.
+//* A broadcast counts as received (delay = completion latency) only if it covers every expected node before its timeout.
+static void
+BroadcastDelivered(Ptr<ZigbeeStack> stack, uint32_t packetId)
+{
+    BroadcastStats& stats = g_broadcasts[packetId];
+    uint32_t nodeId = stack->GetNode()->GetId();
+    if (!stats.expected[nodeId] || stats.delivered[nodeId])
+    {
+        return; // Originator, node not addressed or duplicate
+    }
+    stats.delivered[nodeId] = true;
+    stats.numDelivered++;
+    NS_LOG_INFO("Node " << nodeId << " | Broadcast Packet ID " << packetId << " delivered (" << stats.numDelivered
+                << "/" << stats.numExpected << ")");
+    if (stats.numDelivered < stats.numExpected)
+    {
+        return;
+    }
+
+    stats.completeTime = Simulator::Now().GetSeconds();
+    auto it = g_sendTimeMap.find(packetId);
+    if (it != g_sendTimeMap.end())
+    {
+        Time delay = Simulator::Now() - it->second;
+        g_delayList.push_back(delay);
+        g_totalPacketsReceived++;
+        g_sendTimeMap.erase(it);
+        RecordPacketOutcome(packetId, true, delay);
+        g_windowReceived++;
+        g_windowDelays.push_back(delay.GetSeconds());
+        std::cout << Simulator::Now().As(Time::S) << " Broadcast Packet ID " << packetId << " from Node " << stats.src
+                  << " covered all " << stats.numExpected << " nodes | Completion latency: " << delay.GetSeconds()
+                  << " s\n";
+        CheckCompletion();
+    }
+}
+
+//* MacRx trace of every node: the node now has a copy of the broadcast (used to detect redundant rebroadcasts)
+static void
+BroadcastMacRx(uint16_t nodeId, Ptr<const Packet> p)
+{
+    PacketIdTag tag;
+    if (p->PeekPacketTag(tag))
+    {
+        auto it = g_broadcasts.find(tag.GetPacketId());
+        if (it != g_broadcasts.end())
+        {
+            it->second.heard[nodeId] = true;
+        }
+    }
+}
+
+//* PhyTxBegin trace of every node: counts the (re)broadcasts of every node.
+//* A rebroadcast is redundant if every expected node in radio range already had a copy of the frame.
+static void
+BroadcastPhyTxBegin(uint16_t nodeId, Ptr<const Packet> p)
+{
+    PacketIdTag tag;
+    if (!p->PeekPacketTag(tag))
+    {
+        return;
+    }
+    auto it = g_broadcasts.find(tag.GetPacketId());
+    if (it == g_broadcasts.end())
+    {
+        return;
+    }
+    BroadcastStats& stats = it->second;
+    g_broadcastTx[nodeId]++;
+    if (nodeId == stats.src && !stats.originatorSent)
+    {
+        stats.originatorSent = true;
+        return; // First transmission of the originator
+    }
+    g_broadcastRebroadcasts[nodeId]++;
+
+    bool redundant = true;
+    for (uint16_t neighbor : g_broadcastNeighbors[nodeId])
+    {
+        if (stats.expected[neighbor] && !stats.heard[neighbor])
+        {
+            redundant = false;
+            break;
+        }
+    }
+    g_broadcastRedundant[nodeId] += redundant ? 1 : 0;
+}
+
+//* PrintBroadcastReport Function
+//Purpose: Prints the performance of the broadcast traffic.
+//How it works: coverage is the fraction of the addressed nodes whose NWK delivered the broadcast, the completion
+//latency is the time until the last addressed node got it; the per-node table counts transmissions, rebroadcasts
+//and redundant rebroadcasts (all the addressed neighbors already had the frame).
+static void
+PrintBroadcastReport()
+{
+    if (g_broadcasts.empty())
+    {
+        return;
+    }
+    double sumCoverage = 0;
+    uint32_t complete = 0;
+    std::vector<double> latencies;
+    for (const auto& entry : g_broadcasts)
+    {
+        const BroadcastStats& stats = entry.second;
+        sumCoverage += stats.numExpected > 0 ? static_cast<double>(stats.numDelivered) / stats.numExpected : 1.0;
+        if (stats.completeTime >= 0)
+        {
+            complete++;
+            latencies.push_back(stats.completeTime - stats.sendTime);
+        }
+    }
+
+    std::cout << "\n--- Broadcast Performance (address " << g_broadcastAddr << ") ---\n";
+    std::cout << "Broadcasts sent:           " << g_broadcasts.size() << "\n";
+    std::cout << "Average coverage ratio:    " << 100.0 * sumCoverage / g_broadcasts.size() << " %\n";
+    std::cout << "Complete coverage:         " << complete << " (" << 100.0 * complete / g_broadcasts.size()
+              << " %, \"received\" in the results below if before the packet timeout)\n";
+    if (!latencies.empty())
+    {
+        std::cout << "Completion latency:        avg "
+                  << std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size() << " s, p50 "
+                  << Quantile(latencies, 0.5) << " s, p99 " << Quantile(latencies, 0.99) << " s, max "
+                  << *std::max_element(latencies.begin(), latencies.end()) << " s\n";
+    }
+    std::cout << "Node | TX | Rebroadcasts | Redundant | Redundant per broadcast\n";
+    uint64_t totalRedundant = 0;
+    for (uint32_t n = 0; n < g_broadcastTx.size(); n++)
+    {
+        std::cout << n << " | " << g_broadcastTx[n] << " | " << g_broadcastRebroadcasts[n] << " | "
+                  << g_broadcastRedundant[n] << " | " << static_cast<double>(g_broadcastRedundant[n]) / g_broadcasts.size()
+                  << "\n";
+        totalRedundant += g_broadcastRedundant[n];
+    }
+    std::cout << "Redundant rebroadcasts per broadcast: " << static_cast<double>(totalRedundant) / g_broadcasts.size()
+              << "\n";
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* Reply timeout: the reply is considered lost if it did not reach the requester
+static void
+ExpireReply(uint32_t requestId)
+{
+    if (g_replyPending.erase(requestId) > 0)
+    {
+        g_repliesLost++;
+        NS_LOG_INFO("Reply to Packet ID " << requestId << " timed out");
+        CheckCompletion();
+    }
+}
+
+//* SendReply Function
+//Purpose: The responder (stackDst) answers the request 'requestId' received from 'requester'.
+//The reply is a 5-byte packet carrying a ResponseTag (no PacketIdTag, so it does not count as a new request).
+static void
+SendReply(Ptr<ZigbeeStack> stackDst, Mac16Address requester, uint32_t requestId, std::vector<uint16_t> forwardPath, Time requestDelay)
+{
+    Ptr<Packet> p = Create<Packet>(5);
+    ResponseTag tag;
+    tag.SetRequestId(requestId);
+    p->AddPacketTag(tag);
+
+    PendingReply& reply = g_replyPending[requestId];
+    reply.forwardPath = std::move(forwardPath);
+    reply.reversePath = {static_cast<uint16_t>(stackDst->GetNode()->GetId())};
+    reply.requestDelay = requestDelay.GetSeconds();
+    reply.replySendTime = Simulator::Now().GetSeconds();
+    g_repliesSent++;
+
+    NldeDataRequestParams dataReqParams;
+    dataReqParams.m_dstAddrMode = UCST_BCST;
+    dataReqParams.m_dstAddr = requester;
+    dataReqParams.m_nsduHandle = AllocateNsduHandle(stackDst->GetNode()->GetId(), {});
+    dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY;
+    Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, stackDst->GetNwk(), dataReqParams, p);
+    Simulator::Schedule(Seconds(g_packetTimeout), &ExpireReply, requestId);
+}
+
+//* MacRx trace of every node: records the path of the replies (reverse path)
+static void
+ReplyMacRx(uint16_t nodeId, Ptr<const Packet> p)
+{
+    ResponseTag tag;
+    if (!p->PeekPacketTag(tag))
+    {
+        return;
+    }
+    auto it = g_replyPending.find(tag.GetRequestId());
+    if (it != g_replyPending.end() && it->second.reversePath.back() != nodeId) // Ignore MAC duplicates
+    {
+        it->second.reversePath.push_back(nodeId);
+    }
+}
+
+//* A reply reached the requester: round-trip time, one-way delays and path asymmetry of the exchange
+static void
+ReplyReceived(Ptr<ZigbeeStack> stack, uint32_t requestId)
+{
+    auto it = g_replyPending.find(requestId);
+    if (it == g_replyPending.end())
+    {
+        return; // Late (timed out) or duplicate reply
+    }
+    const PendingReply& reply = it->second;
+    double now = Simulator::Now().GetSeconds();
+    double rtt = now - g_packetSendTime[requestId - 1];
+    g_rttList.push_back(rtt);
+    g_requestDelays.push_back(reply.requestDelay);
+    g_replyDelays.push_back(now - reply.replySendTime);
+    g_hopDifference.push_back(static_cast<int32_t>(reply.reversePath.size()) -
+                              static_cast<int32_t>(reply.forwardPath.size()));
+    if (!std::equal(reply.reversePath.begin(), reply.reversePath.end(), reply.forwardPath.rbegin(), reply.forwardPath.rend()))
+    {
+        g_asymmetricExchanges++;
+    }
+    g_repliesReceived++;
+    std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
+              << "Reply to Packet ID " << requestId << " received | RTT: " << rtt << " s\n";
+    g_replyPending.erase(it);
+    CheckCompletion();
+}
+
+//* PrintResponseReport Function
+//Purpose: Prints the performance of the request/response exchanges.
+//How it works: the RTT goes from the request send time to the reception of the reply at the requester;
+//the asymmetry compares the one-way delays and the paths of requests and replies (an exchange is asymmetric
+//if the reply does not follow the request path backwards).
+static void
+PrintResponseReport()
+{
+    std::cout << "\n--- Request/Response ---\n";
+    std::cout << "Requests sent:       " << g_totalPacketsSent << "\n";
+    std::cout << "Requests delivered:  " << g_totalPacketsReceived << "\n";
+    std::cout << "Replies sent:        " << g_repliesSent << "\n";
+    std::cout << "Replies received:    " << g_repliesReceived << "\n";
+    std::cout << "Response loss:       "
+              << (g_repliesSent > 0 ? 100.0 * (g_repliesSent - g_repliesReceived) / g_repliesSent : 0.0)
+              << " % of the delivered requests (" << g_repliesLost << " timed out)\n";
+    std::cout << "Exchange success:    "
+              << (g_totalPacketsSent > 0 ? 100.0 * g_repliesReceived / g_totalPacketsSent : 0.0) << " %\n";
+    if (g_rttList.empty())
+    {
+        std::cout << "RTT: N/A (no reply received)\n";
+        std::cout << "---------------------------------------------------\n";
+        return;
+    }
+    auto mean = [](const std::vector<double>& v) { return std::accumulate(v.begin(), v.end(), 0.0) / v.size(); };
+    std::cout << "RTT:                 avg " << mean(g_rttList) << " s, p50 " << Quantile(g_rttList, 0.5) << " s, p90 "
+              << Quantile(g_rttList, 0.9) << " s, p99 " << Quantile(g_rttList, 0.99) << " s, max "
+              << *std::max_element(g_rttList.begin(), g_rttList.end()) << " s\n";
+    std::cout << "One-way delay:       request avg " << mean(g_requestDelays) << " s, reply avg " << mean(g_replyDelays)
+              << " s\n";
+    double avgHopDiff = std::accumulate(g_hopDifference.begin(), g_hopDifference.end(), 0.0) / g_hopDifference.size();
+    std::cout << "Path asymmetry:      " << 100.0 * g_asymmetricExchanges / g_rttList.size()
+              << " % of the exchanges (reply hops - request hops: avg " << avgHopDiff << ")\n";
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* DeliverTrackedPacket Function
+//Purpose: Records the delivery of the tracked packet 'packetId' (payloadBytes bytes of payload) at 'stack':
+//latency, counters, paths, batch and window statistics, goodput, and the completion of the run.
+static void
+DeliverTrackedPacket(Ptr<ZigbeeStack> stack, const NldeDataIndicationParams& params, uint32_t packetId, uint32_t payloadBytes)
+{
+    auto it = g_sendTimeMap.find(packetId); // Search for the send time in the map
+    if (it != g_sendTimeMap.end()) // Found?
+    {
+        Time sendTime = it->second;          // Recorded send time
+        Time currentTime = Simulator::Now(); // Current reception time
+        Time delay = currentTime - sendTime; // Calculate latency
+
+        g_delayList.push_back(delay);        // Add latency to the list
+        g_totalPacketsReceived++;            // Increment *valid* received packets
+        g_sendTimeMap.erase(it);             // Remove the entry from the map (packet handled)
+        if (g_respond)                       // Responder: answer the requester (before the path is released)
+        {
+            auto path = g_pathInFlight.find(packetId);
+            SendReply(stack, params.m_srcAddr, packetId,
+                      path != g_pathInFlight.end() ? path->second : std::vector<uint16_t>(), delay);
+        }
+        if (g_aps)
+        {
+            RecordApsDelivery(packetId, delay); // Attempt at which the APS frame got through
+        }
+        RecordDeliveredPath(packetId, delay); // Keep the real path taken by the packet
+        RecordPacketOutcome(packetId, true, delay); // Batch statistics (early stop)
+        g_windowReceived++;                  // Windowed metrics
+        g_windowBytes += payloadBytes;
+        g_windowDelays.push_back(delay.GetSeconds());
+        FlowGoodput& goodput = g_flowGoodput[{g_packetSrc[packetId - 1],
+                                              static_cast<uint16_t>(stack->GetNode()->GetId())}];
+        goodput.payloadBytes += payloadBytes;
+        goodput.firstSend = (goodput.firstSend < 0) ? g_packetSendTime[packetId - 1] : goodput.firstSend;
+        goodput.lastReceive = currentTime.GetSeconds();
+        CheckCompletion();                   // Was it the last outstanding packet?
+
+        // More detailed log on reception
+        NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " | NwkDataIndication: Received Packet ID: "
+                    << packetId << " | Size: " << payloadBytes << " | Delay: " << delay.GetSeconds() << " s");
+        std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
+                  << "NwkDataIndication: Received Packet ID: " << packetId << " | Delay: " << delay.GetSeconds() << " s\n";
+    }
+    else
+    {
+        // Packet received but ID not found in the map (could happen if the packet arrives after a long time or there's an error)
+         NS_LOG_WARN("Node " << stack->GetNode()->GetId() << " | NwkDataIndication: Received Packet ID: " << packetId << " but no send time found!");
+         std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
+                  << "NwkDataIndication: Received Packet ID: " << packetId << " NO SEND TIME!\n";
+    }
+}
+
+//* Returns the IDs of the readings carried by a payload (one or more concatenated 5-byte readings)
+static std::vector<uint32_t>
+ReadingIds(Ptr<const Packet> p)
+{
+    std::vector<uint8_t> buffer(p->GetSize());
+    p->CopyData(buffer.data(), buffer.size());
+    std::vector<uint32_t> ids;
+    for (size_t k = 0; k + READING_BYTES <= buffer.size(); k += READING_BYTES)
+    {
+        ids.push_back((static_cast<uint32_t>(buffer[k]) << 24) | (buffer[k + 1] << 16) | (buffer[k + 2] << 8) |
+                      buffer[k + 3]);
+    }
+    return ids;
+}
+
+//* Returns an untagged frame carrying the readings 'ids' (concatenated), registered in g_frameReadings
+static Ptr<Packet>
+ReadingsFrame(const std::vector<uint32_t>& ids)
+{
+    std::vector<uint8_t> payload;
+    for (uint32_t id : ids)
+    {
+        payload.insert(payload.end(),
+                       {static_cast<uint8_t>(id >> 24), static_cast<uint8_t>(id >> 16), static_cast<uint8_t>(id >> 8),
+                        static_cast<uint8_t>(id), static_cast<uint8_t>(id & 0x7F)});
+    }
+    Ptr<Packet> p = Create<Packet>(payload.data(), payload.size());
+    g_frameReadings[p->GetUid()] = ids;
+    return p;
+}
+
+//* Returns the node that aggregates the readings of 'stack': a router aggregates its own readings, an end device
+//* sends them to its parent router. Returns the coordinator if there is no router to aggregate (parent is the coordinator).
+static Ptr<ZigbeeStack>
+AggregatorOf(Ptr<ZigbeeStack> stack)
+{
+    if (!IsEndDevice(stack))
+    {
+        return stack;
+    }
+    Mac16Address parent = DynamicCast<LrWpanNetDevice>(stack->GetNode()->GetDevice(0))->GetMac()->GetCoordShortAddress();
+    for (auto i = zigbeeStacks.Begin(); i != zigbeeStacks.End(); i++)
+    {
+        if ((*i)->GetNwk()->GetNetworkAddress() == parent)
+        {
+            return *i;
+        }
+    }
+    return zigbeeStacks.Get(0);
+}
+
+//* FlushAggregationBuffer Function
+//Purpose: Sends the readings buffered at 'aggregator' to the coordinator in a single frame (concatenated readings).
+//The frame carries no PacketIdTag: the coordinator tracks every reading by the ID it carries (see ReadingsFrame).
+static void
+FlushAggregationBuffer(Ptr<ZigbeeStack> aggregator)
+{
+    AggregationBuffer& buffer = g_aggBuffers[aggregator->GetNode()->GetId()];
+    buffer.flushTimer.Cancel();
+    if (buffer.readings.empty())
+    {
+        return;
+    }
+    std::vector<uint32_t> ids;
+    double now = Simulator::Now().GetSeconds();
+    for (const auto& reading : buffer.readings)
+    {
+        ids.push_back(reading.first);
+        g_aggHoldTime += now - reading.second;
+    }
+    g_aggFrames++;
+    g_aggReadings += buffer.readings.size();
+    NS_LOG_INFO("Node " << aggregator->GetNode()->GetId() << " sends " << buffer.readings.size()
+                << " aggregated readings to the coordinator");
+    buffer.readings.clear();
+
+    NldeDataRequestParams dataReqParams;
+    dataReqParams.m_dstAddrMode = UCST_BCST;
+    dataReqParams.m_dstAddr = zigbeeStacks.Get(0)->GetNwk()->GetNetworkAddress();
+    dataReqParams.m_nsduHandle = AllocateNsduHandle(aggregator->GetNode()->GetId(), ids);
+    dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY;
+    Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, aggregator->GetNwk(), dataReqParams, ReadingsFrame(ids));
+}
+
+//* A reading reached its aggregator: it waits at most g_aggWindow for other readings (or until the frame is full)
+static void
+AggregateReading(Ptr<ZigbeeStack> aggregator, uint32_t packetId)
+{
+    g_pathInFlight.erase(packetId); // The path is no longer followed once merged
+    AggregationBuffer& buffer = g_aggBuffers[aggregator->GetNode()->GetId()];
+    buffer.readings.emplace_back(packetId, Simulator::Now().GetSeconds());
+    if (buffer.readings.size() >= g_aggMaxReadings)
+    {
+        FlushAggregationBuffer(aggregator);
+    }
+    else if (buffer.readings.size() == 1)
+    {
+        buffer.flushTimer = Simulator::Schedule(Seconds(g_aggWindow), &FlushAggregationBuffer, aggregator);
+    }
+}
+
+//* NLDE-DATA.indication of frames carrying one or more readings (aggregation and batching): the final destination
+//* delivers every reading of the frame, an aggregator merges the readings of its children
+static void
+ReadingsDataIndication(Ptr<ZigbeeStack> stack, const NldeDataIndicationParams& params, Ptr<Packet> p)
+{
+    for (uint32_t packetId : ReadingIds(p))
+    {
+        if (!g_aggregation || stack->GetNode()->GetId() == 0)
+        {
+            DeliverTrackedPacket(stack, params, packetId, READING_BYTES);
+        }
+        else
+        {
+            AggregateReading(stack, packetId);
+        }
+    }
+}
+
+//* PrintAggregationReport Function
+//Purpose: Prints the work of the aggregators: frames sent, readings per frame and the time the readings waited
+//in the buffers (the latency added by the aggregation). Compare with --compareAggregation for the channel utilization.
+static void
+PrintAggregationReport()
+{
+    std::cout << "\n--- In-network Aggregation (window " << g_aggWindow << " s, max " << g_aggMaxReadings
+              << " readings per frame) ---\n";
+    std::cout << "Aggregated frames sent:     " << g_aggFrames << "\n";
+    std::cout << "Readings aggregated:        " << g_aggReadings << " of " << g_totalPacketsSent << " sent\n";
+    if (g_aggFrames > 0)
+    {
+        std::cout << "Readings per frame (avg):   " << static_cast<double>(g_aggReadings) / g_aggFrames << "\n";
+        std::cout << "Aggregation delay (avg):    " << g_aggHoldTime / g_aggReadings << " s\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* FlushBatch Function
+//Purpose: Sends the batch of readings of source 'stackSrc' in a single NLDE-DATA.request.
+//Every reading keeps its own ID and send time, so the latency of each reading includes the time spent in the batch.
+static void
+FlushBatch(Ptr<ZigbeeStack> stackSrc)
+{
+    BatchBuffer& batch = g_batchBuffers[stackSrc->GetNode()->GetId()];
+    batch.flushTimer.Cancel();
+    if (batch.readings.empty())
+    {
+        return;
+    }
+    g_batchFrames++;
+    for (uint32_t packetId : batch.readings)
+    {
+        g_pathInFlight.erase(packetId); // The path is only followed for tagged single readings
+    }
+    NS_LOG_INFO("Node " << stackSrc->GetNode()->GetId() << " sends a batch of " << batch.readings.size() << " readings");
+
+    NldeDataRequestParams dataReqParams;
+    dataReqParams.m_dstAddrMode = UCST_BCST;
+    dataReqParams.m_dstAddr = batch.dst->GetNwk()->GetNetworkAddress();
+    dataReqParams.m_nsduHandle = AllocateNsduHandle(stackSrc->GetNode()->GetId(), batch.readings);
+    dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY;
+    Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, stackSrc->GetNwk(), dataReqParams, ReadingsFrame(batch.readings));
+    batch.readings.clear();
+}
+
+//* Adds a reading to the batch of its source: the batch is sent when full or g_batchWindow after its first reading
+static void
+BatchReading(Ptr<ZigbeeStack> stackSrc, Ptr<ZigbeeStack> stackDst, uint32_t packetId)
+{
+    BatchBuffer& batch = g_batchBuffers[stackSrc->GetNode()->GetId()];
+    if (!batch.readings.empty() && batch.dst != stackDst)
+    {
+        FlushBatch(stackSrc); // A batch has a single destination
+    }
+    batch.dst = stackDst;
+    batch.readings.push_back(packetId);
+    if (batch.readings.size() >= g_batchMaxReadings)
+    {
+        FlushBatch(stackSrc);
+    }
+    else if (batch.readings.size() == 1)
+    {
+        batch.flushTimer = Simulator::Schedule(Seconds(g_batchWindow), &FlushBatch, stackSrc);
+    }
+}
+
+//* PrintBatchingReport Function
+//Purpose: Prints how the sources grouped their readings: batches sent and readings per batch.
+//Use --batchSweep for the goodput versus latency curve of the window.
+static void
+PrintBatchingReport()
+{
+    std::cout << "\n--- Source Batching (window " << g_batchWindow << " s, max " << g_batchMaxReadings
+              << " readings per batch) ---\n";
+    std::cout << "Batches sent:               " << g_batchFrames << "\n";
+    std::cout << "Readings sent:              " << g_totalPacketsSent << "\n";
+    if (g_batchFrames > 0)
+    {
+        std::cout << "Readings per batch (avg):   " << static_cast<double>(g_totalPacketsSent) / g_batchFrames << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* Sleepy End Devices
+//* Purpose:
+//* End devices with the rx-off-when-idle role (zed:rxoff, or --sleepyEndDevices) only turn their receiver on when
+//* they poll their parent. Traffic to them waits in the parent (indirect transmission), which adds downlink latency.
+//*
+//* How it works (application level emulation of the MAC indirect transmission, which the ns-3 Zigbee NWK does not use):
+//* 1. A packet for a sleepy end device is routed to its parent (g_parentOf), which buffers it for up to
+//*    g_bufferPersistence seconds (macTransactionPersistenceTime); a frame still there at the end of this time is
+//*    dropped by its own expiry event. The persistence must be shorter than the packet timeout (clamped in main).
+//* 2. Every g_pollInterval seconds the device turns its receiver on for g_pollAwake seconds and sends a poll (a 1-byte
+//*    NWK frame with a PollTag, like the MAC data request command) to its parent.
+//* 3. The parent answers a poll with the frames buffered for the device, which stays awake while they arrive.
+//* 4. The report gives the time spent in the parent buffers (added latency), their occupancy, the poll overhead and
+//*    the duty cycle of the devices.
+static bool
+IsSleepyEndDevice(uint32_t nodeId)
+{
+    return IsEndDeviceNode(nodeId) && !g_roles[nodeId].rxOnWhenIdle;
+}
+
+//* Occupancy integral of a parent buffer, up to now (call before every change)
+static void
+UpdateBufferOccupancy(ParentBuffer& buffer)
+{
+    double now = Simulator::Now().GetSeconds();
+    buffer.occupancyArea += buffer.frames.size() * (now - buffer.lastChange);
+    buffer.lastChange = now;
+}
+
+//* End of the persistence time of a buffered frame: the frame is dropped if the child has not polled it yet
+static void
+ExpireBufferedFrame(uint16_t parentId, uint32_t packetId)
+{
+    ParentBuffer& buffer = g_parentBuffers[parentId];
+    auto it = std::find_if(buffer.frames.begin(), buffer.frames.end(), [packetId](const BufferedFrame& frame) {
+        return frame.packetId == packetId;
+    });
+    if (it == buffer.frames.end())
+    {
+        return;
+    }
+    UpdateBufferOccupancy(buffer);
+    buffer.frames.erase(it);
+    g_bufferExpired++;
+    ResolveDroppedPacket(packetId, "expired in the parent buffer");
+}
+
+static void
+BufferFrame(Ptr<ZigbeeStack> parent, uint16_t child, uint32_t packetId, Ptr<Packet> p)
+{
+    uint16_t parentId = parent->GetNode()->GetId();
+    ParentBuffer& buffer = g_parentBuffers[parentId];
+    UpdateBufferOccupancy(buffer);
+    buffer.frames.push_back({packetId,
+                             child,
+                             p,
+                             Simulator::Now().GetSeconds(),
+                             Simulator::Schedule(Seconds(g_bufferPersistence), &ExpireBufferedFrame, parentId, packetId)});
+    buffer.maxOccupancy = std::max<uint32_t>(buffer.maxOccupancy, buffer.frames.size());
+    NS_LOG_INFO("Node " << parent->GetNode()->GetId() << " buffers Packet ID " << packetId << " for sleepy Node "
+                        << child);
+}
+
+//* The receiver of a sleepy end device goes back off
+static void
+SleepEndDevice(Ptr<ZigbeeStack> stack)
+{
+    DynamicCast<LrWpanNetDevice>(stack->GetNode()->GetDevice(0))->GetMac()->SetRxOnWhenIdle(false);
+}
+
+//* Keeps the receiver of a sleepy end device on for g_pollAwake seconds from now
+static void
+WakeEndDevice(Ptr<ZigbeeStack> stack)
+{
+    uint16_t nodeId = stack->GetNode()->GetId();
+    double now = Simulator::Now().GetSeconds();
+    DynamicCast<LrWpanNetDevice>(stack->GetNode()->GetDevice(0))->GetMac()->SetRxOnWhenIdle(true);
+    g_awakeTime[nodeId] += now + g_pollAwake - std::max(now, g_awakeUntil[nodeId]);
+    g_awakeUntil[nodeId] = now + g_pollAwake;
+    g_sleepEvents[nodeId].Cancel();
+    g_sleepEvents[nodeId] = Simulator::Schedule(Seconds(g_pollAwake), &SleepEndDevice, stack);
+}
+
+//* Poll of a sleepy end device to its parent, repeated every g_pollInterval seconds
+static void
+PollParent(Ptr<ZigbeeStack> stack)
+{
+    if (g_finalReportsDone)
+    {
+        return;
+    }
+    uint16_t nodeId = stack->GetNode()->GetId();
+    auto parent = g_parentOf.find(nodeId);
+    if (parent != g_parentOf.end())
+    {
+        WakeEndDevice(stack);
+        g_firstPoll.emplace(nodeId, Simulator::Now().GetSeconds());
+
+        Ptr<Packet> p = Create<Packet>(1); // Command identifier of the MAC data request
+        PollTag pollTag;
+        pollTag.SetNodeId(nodeId);
+        p->AddPacketTag(pollTag);
+        g_polls++;
+
+        NldeDataRequestParams dataReqParams;
+        dataReqParams.m_dstAddrMode = UCST_BCST;
+        dataReqParams.m_dstAddr = zigbeeStacks.Get(parent->second)->GetNwk()->GetNetworkAddress();
+        dataReqParams.m_radius = 1; // The parent is a neighbor
+        dataReqParams.m_nsduHandle = AllocateNsduHandle(nodeId, {});
+        dataReqParams.m_discoverRoute = SUPPRESS_ROUTE_DISCOVERY;
+        Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, stack->GetNwk(), dataReqParams, p);
+    }
+    Simulator::Schedule(Seconds(g_pollInterval), &PollParent, stack);
+}
+
+//* The parent answers the poll of a child with the frames buffered for it
+static void
+ParentPollReceived(Ptr<ZigbeeStack> parent, uint16_t child)
+{
+    ParentBuffer& buffer = g_parentBuffers[parent->GetNode()->GetId()];
+    UpdateBufferOccupancy(buffer);
+    uint32_t sent = 0;
+    double now = Simulator::Now().GetSeconds();
+    for (auto it = buffer.frames.begin(); it != buffer.frames.end();)
+    {
+        if (it->child != child)
+        {
+            it++;
+            continue;
+        }
+        g_bufferHoldTimes.push_back(now - it->arrival);
+        NldeDataRequestParams dataReqParams;
+        dataReqParams.m_dstAddrMode = UCST_BCST;
+        dataReqParams.m_dstAddr = zigbeeStacks.Get(child)->GetNwk()->GetNetworkAddress();
+        dataReqParams.m_radius = 1;
+        dataReqParams.m_nsduHandle = AllocateNsduHandle(parent->GetNode()->GetId(), {it->packetId});
+        dataReqParams.m_discoverRoute = SUPPRESS_ROUTE_DISCOVERY;
+        Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, parent->GetNwk(), dataReqParams, it->packet);
+        it->expiry.Cancel();
+        it = buffer.frames.erase(it);
+        sent++;
+    }
+    if (sent > 0)
+    {
+        g_pollsWithData++;
+        WakeEndDevice(zigbeeStacks.Get(child)); // Frame pending: the child stays awake to receive them
+    }
+}
+
+//* Airtime of the polls
+static void
+PollPhyTxBegin(Ptr<const Packet> p)
+{
+    PollTag pollTag;
+    if (p->PeekPacketTag(pollTag))
+    {
+        g_pollAirtimeBytes += p->GetSize() + PHY_SHR_PHR_BYTES;
+    }
+}
+
+static void
+PrintSleepyReport()
+{
+    double now = Simulator::Now().GetSeconds();
+    std::cout << "\n--- Sleepy end devices (poll interval " << g_pollInterval << " s, awake " << g_pollAwake
+              << " s per poll) ---\n";
+    if (!g_bufferHoldTimes.empty())
+    {
+        std::cout << "Added downlink latency (parent buffer): avg "
+                  << std::accumulate(g_bufferHoldTimes.begin(), g_bufferHoldTimes.end(), 0.0) / g_bufferHoldTimes.size()
+                  << " s | p99 " << Quantile(g_bufferHoldTimes, 0.99) << " s | max "
+                  << *std::max_element(g_bufferHoldTimes.begin(), g_bufferHoldTimes.end()) << " s ("
+                  << g_bufferHoldTimes.size() << " frames)\n";
+    }
+    double sumDelay = 0;
+    uint32_t received = 0;
+    for (uint32_t packetId : g_sleepyPackets)
+    {
+        if (g_packetDelay[packetId - 1] >= 0)
+        {
+            sumDelay += g_packetDelay[packetId - 1];
+            received++;
+        }
+    }
+    std::cout << "Downlink to sleepy devices: " << received << " of " << g_sleepyPackets.size()
+              << " packets delivered | Avg end-to-end delay: " << (received > 0 ? sumDelay / received : 0.0)
+              << " s | Expired in the parent buffers: " << g_bufferExpired << "\n";
+    for (auto& entry : g_parentBuffers)
+    {
+        UpdateBufferOccupancy(entry.second);
+        std::cout << "  Parent Node " << entry.first << ": avg occupancy "
+                  << (now > 0 ? entry.second.occupancyArea / now : 0.0) << " frames | max "
+                  << entry.second.maxOccupancy << " | still buffered " << entry.second.frames.size() << "\n";
+    }
+    uint64_t totalTxBytes = 0;
+    for (const auto& stats : g_airtime)
+    {
+        totalTxBytes += stats.txAirtimeBytes;
+    }
+    std::cout << "Polls: " << g_polls << " (" << g_polls - g_pollsWithData << " empty) | Poll airtime: "
+              << g_pollAirtimeBytes << " bytes ("
+              << (totalTxBytes > 0 ? 100.0 * g_pollAirtimeBytes / totalTxBytes : 0.0) << " % of the transmitted bytes)\n";
+    for (const auto& entry : g_firstPoll)
+    {
+        double awake = g_awakeTime[entry.first] - std::max(0.0, g_awakeUntil[entry.first] - now);
+        std::cout << "  Node " << entry.first << " duty cycle: "
+                  << (now > entry.second ? 100.0 * awake / (now - entry.second) : 0.0) << " %\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* NwkDataIndication Function
+//Purpose: This is a callback function that is invoked when a Zigbee node receives a data packet.
+//What it does:
+//Prints a message to the console indicating that a packet has been received, the receiving node's ID, and the packet size.
+static void 
+ NwkDataIndication(Ptr<ZigbeeStack> stack, NldeDataIndicationParams params, Ptr<Packet> p)
+{
+    if (g_aps && !ApsDataIndication(stack, params, p)) // APS ack or duplicate: nothing for the application
+    {
+        return;
+    }
+
+    if (g_aggregation || g_batching) // Every frame carries one or more readings
+    {
+        ReadingsDataIndication(stack, params, p);
+        return;
+    }
+
+    PollTag pollTag;
+    if (p->PeekPacketTag(pollTag)) // Poll of a sleepy child: forward its buffered frames
+    {
+        ParentPollReceived(stack, pollTag.GetNodeId());
+        return;
+    }
+
+    ResponseTag responseTag;
+    if (p->PeekPacketTag(responseTag)) // Reply to one of our requests
+    {
+        ReplyReceived(stack, responseTag.GetRequestId());
+        return;
+    }
+
+    PacketIdTag tag;
+    if (p->PeekPacketTag(tag)) // Check if the packet has our tag
+    {
+        uint32_t packetId = tag.GetPacketId();
+        if (g_broadcasts.count(packetId) > 0) // Broadcast traffic: coverage instead of a single delivery
+        {
+            BroadcastDelivered(stack, packetId);
+            return;
+        }
+        auto sleepy = g_sleepyDownlink.find(packetId);
+        if (sleepy != g_sleepyDownlink.end()) // Reached the parent of a sleepy end device: wait for its poll
+        {
+            BufferFrame(stack, sleepy->second, packetId, p);
+            g_sleepyDownlink.erase(sleepy);
+            return;
+        }
+        if (packetId > 0) // Ensure the ID is valid
+        {
+            DeliverTrackedPacket(stack, params, packetId, p->GetSize());
+        } else {
+             NS_LOG_WARN("Node " << stack->GetNode()->GetId() << " | NwkDataIndication: Received packet with invalid ID (0) in tag.");
+             std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
+                          << "NwkDataIndication: Received packet with invalid ID tag.\n";
+        }
+    }
+    else
+    {
+         NS_LOG_WARN("Node " << stack->GetNode()->GetId() << " | NwkDataIndication: Received packet without PacketIdTag.");
+          std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
+                          << "NwkDataIndication: Received packet NO TAG.\n";
+    }
+}
+
+//* NwkNetworkFormationConfirm Function
+//Purpose: This is a callback function that is invoked when the network formation process (by the coordinator) is confirmed.
+//What it does:
+//Prints the status of the network formation (e.g., success or failure).
+static void
+NwkNetworkFormationConfirm(Ptr<ZigbeeStack> stack, NlmeNetworkFormationConfirmParams params)
+{
+    std::cout << "\nNlmeNetworkFormationConfirmStatus = " << params.m_status << "\n";
+}
+
+
+//* Returns the Node ID of the node with network address 'addr', or -1
+static int32_t
+NodeIdOfAddress(Mac16Address addr)
+{
+    for (auto i = zigbeeStacks.Begin(); i != zigbeeStacks.End(); i++)
+    {
+        if ((*i)->GetNwk()->GetNetworkAddress() == addr)
+        {
+            return (*i)->GetNode()->GetId();
+        }
+    }
+    return -1;
+}
+
+//* Returns the Node ID of the node with IEEE address 'addr', or -1
+static int32_t
+NodeIdOfIeeeAddress(Mac64Address addr)
+{
+    for (auto i = zigbeeStacks.Begin(); i != zigbeeStacks.End(); i++)
+    {
+        if ((*i)->GetNwk()->GetIeeeAddress() == addr)
+        {
+            return (*i)->GetNode()->GetId();
+        }
+    }
+    return -1;
+}
+
+//* PhyRxEnd trace of every node: the beacons received during the discovery, i.e. what the NWK stores in the neighbor
+//* table entry of every potential parent: link quality (best SINR, the PHY derives the LQI from it), depth and
+//* router / end device capacity bits of the Zigbee beacon payload (the NWK of the parent sets them from its child limits).
+static void
+ParentBeaconRxEnd(uint16_t nodeId, Ptr<const Packet> p, double sinr)
+{
+    Ptr<Packet> copy = p->Copy();
+    LrWpanMacHeader macHdr;
+    if (copy->RemoveHeader(macHdr) == 0 || !macHdr.IsBeacon() || sinr <= 0)
+    {
+        return;
+    }
+    int32_t sender = NodeIdOfAddress(macHdr.GetShortSrcAddr());
+    BeaconPayloadHeader macPayload;
+    ZigbeeBeaconPayload beaconPayload;
+    if (sender < 0 || copy->RemoveHeader(macPayload) == 0 || copy->RemoveHeader(beaconPayload) == 0)
+    {
+        return;
+    }
+    double sinrDb = 10 * std::log10(sinr);
+    auto inserted = g_parentCandidates[nodeId].emplace(sender, ParentCandidate());
+    ParentCandidate& candidate = inserted.first->second;
+    candidate.sinrDb = inserted.second ? sinrDb : std::max(candidate.sinrDb, sinrDb);
+    candidate.depth = beaconPayload.GetDeviceDepth(); // The last beacon carries the current state of the candidate
+    candidate.routerCapacity = beaconPayload.GetRouterCapacity();
+    candidate.endDeviceCapacity = beaconPayload.GetEndDevCapacity();
+}
+
+//* SelectParent Function
+//Purpose: Ranks the candidate parents of 'stack' (the beacons received during its discovery whose capacity bit
+//accepts its device type) with the --parentPolicy and returns the Node ID of the best one (-1 if there is none).
+//How it works:
+// lqi:   highest beacon SINR.
+// depth: lowest advertised depth, then highest SINR.
+// score: candidates with a SINR of at least g_parentMinSinr first, then lowest depth, highest SINR.
+static int32_t
+SelectParent(Ptr<ZigbeeStack> stack)
+{
+    bool router = IsRouterNode(stack->GetNode()->GetId());
+    int32_t best = -1;
+    std::tuple<bool, int64_t, double> bestKey; // Compared lexicographically: greater is better
+    for (const auto& heard : g_parentCandidates[stack->GetNode()->GetId()])
+    {
+        const ParentCandidate& candidate = heard.second;
+        if (!(router ? candidate.routerCapacity : candidate.endDeviceCapacity))
+        {
+            continue; // The NWK of the candidate has no room for this device type
+        }
+        int64_t depth = candidate.depth;
+        std::tuple<bool, int64_t, double> key;
+        if (g_parentPolicy == "lqi")
+        {
+            key = std::make_tuple(true, 0, candidate.sinrDb);
+        }
+        else if (g_parentPolicy == "depth")
+        {
+            key = std::make_tuple(true, -depth, candidate.sinrDb);
+        }
+        else
+        {
+            key = std::make_tuple(candidate.sinrDb >= g_parentMinSinr, -depth, candidate.sinrDb);
+        }
+        if (best < 0 || key > bestKey)
+        {
+            best = heard.first;
+            bestKey = key;
+        }
+    }
+    return best;
+}
+
+//* NwkDirectJoinConfirm Function
+//Purpose: Callback of the parent chosen by SelectParent when it has (or has not) added the child to its neighbor table.
+//The child only joins the chosen parent (orphan scan) once the direct join succeeded; if the parent refused it
+//(e.g. its NWK child limits are reached), the child falls back to the default NWK association.
+static void
+NwkDirectJoinConfirm(Ptr<ZigbeeStack> stack, NlmeDirectJoinConfirmParams params)
+{
+    int32_t child = NodeIdOfIeeeAddress(params.m_deviceAddr);
+    auto pending = g_directJoins.find(child);
+    if (child < 0 || pending == g_directJoins.end())
+    {
+        return;
+    }
+    NlmeJoinRequestParams joinParams = pending->second;
+    g_directJoins.erase(pending);
+    if (params.m_status != NwkStatus::SUCCESS)
+    {
+        std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
+                  << "Direct join of Node " << child << " FAILED with status " << params.m_status
+                  << ", it joins with the default association\n";
+        g_chosenParent.erase(child);
+        joinParams.m_rejoinNetwork = zigbee::JoiningMethod::ASSOCIATION;
+    }
+    Simulator::ScheduleWithContext(child,
+                                   Seconds(0),
+                                   &ZigbeeNwk::NlmeJoinRequest,
+                                   zigbeeStacks.Get(child)->GetNwk(),
+                                   joinParams);
+}
+
+//* PrintTreeReport Function
+//Purpose: Prints the tree built by the parent selection: depth distribution, and for every depth of the sources
+//the average hop count of their delivered packets (real paths) and their average end-to-end latency.
+static void
+PrintTreeReport()
+{
+    std::map<uint32_t, uint32_t> nodesAtDepth;
+    for (const auto& entry : g_nodeDepth)
+    {
+        nodesAtDepth[entry.second]++;
+    }
+    std::cout << "\n--- Tree (parent policy: " << g_parentPolicy << ") ---\n";
+    std::cout << "Depth | Nodes\n";
+    for (const auto& depth : nodesAtDepth)
+    {
+        std::cout << depth.first << " | " << depth.second << "\n";
+    }
+    std::cout << "Node | Parent | Depth | Beacon SINR from parent [dB]\n";
+    for (const auto& entry : g_parentOf)
+    {
+        auto candidate = g_parentCandidates[entry.first].find(entry.second);
+        std::cout << entry.first << " | " << entry.second << " | " << g_nodeDepth[entry.first] << " | ";
+        if (candidate != g_parentCandidates[entry.first].end())
+        {
+            std::cout << candidate->second.sinrDb << "\n";
+        }
+        else
+        {
+            std::cout << "N/A\n";
+        }
+    }
+
+    // Hops and latency of the delivered packets, by depth of their source
+    std::map<uint32_t, std::pair<double, uint32_t>> hopsByDepth;  // Depth -> (sum of hops, packets)
+    std::map<uint32_t, std::pair<double, uint32_t>> delayByDepth; // Depth -> (sum of delays, packets)
+    for (const auto& flow : g_flowPaths)
+    {
+        uint32_t depth = g_nodeDepth.count(flow.first.first) ? g_nodeDepth[flow.first.first] : 0;
+        for (const auto& path : flow.second)
+        {
+            hopsByDepth[depth].first += static_cast<double>(g_paths[path.first]->size() - 1) * path.second.count;
+            hopsByDepth[depth].second += path.second.count;
+        }
+    }
+    for (uint32_t k = 0; k < g_packetDelay.size(); k++)
+    {
+        if (g_packetDelay[k] >= 0 && g_nodeDepth.count(g_packetSrc[k]))
+        {
+            delayByDepth[g_nodeDepth[g_packetSrc[k]]].first += g_packetDelay[k];
+            delayByDepth[g_nodeDepth[g_packetSrc[k]]].second++;
+        }
+    }
+    std::cout << "Source depth | Avg hops | Avg delay [s] | Packets delivered\n";
+    for (const auto& depth : delayByDepth)
+    {
+        const auto& hops = hopsByDepth[depth.first];
+        std::cout << depth.first << " | " << (hops.second > 0 ? hops.first / hops.second : 0.0) << " | "
+                  << depth.second.first / depth.second.second << " | " << depth.second.second << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+}
+
+//* NwkNetworkDiscoveryConfirm Function
+//Purpose: This is a callback function that is invoked when the network discovery process (by end devices) is confirmed.
+//What it does:
+//1. Checks if the discovery was successful.
+//2. If successful, it prints the details of the discovered networks (Extended PAN ID, channel, PAN ID, stack profile).
+//3. It then prepares a NlmeJoinRequestParams to join the discovered network.
+//4. It schedules the NlmeJoinRequest to join the network.
+static void
+NwkNetworkDiscoveryConfirm(Ptr<ZigbeeStack> stack, NlmeNetworkDiscoveryConfirmParams params)
+{
+    // See Zigbee Specification r22.1.0, 3.6.1.4.1
+    // This method implements a simplistic version of the method implemented
+    // in a zigbee APL layer. In this layer a candidate Extended PAN Id must
+    // be selected and a NLME-JOIN.request must be issued.
+
+    if (params.m_status == NwkStatus::SUCCESS)
+    {
+        std::cout << " Network discovery confirm Received. Networks found ("
+                  << params.m_netDescList.size() << "):\n";
+
+        for (const auto& netDescriptor : params.m_netDescList)
+        {
+            std::cout << " ExtPanID: 0x" << std::hex << netDescriptor.m_extPanId << "\n"
+                      << std::dec << " CH:  " << static_cast<uint32_t>(netDescriptor.m_logCh)
+                      << "\n"
+                      << std::hex << " Pan ID: 0x" << netDescriptor.m_panId << "\n"
+                      << " Stack profile: " << std::dec
+                      << static_cast<uint32_t>(netDescriptor.m_stackProfile) << "\n"
+                      << "--------------------\n";
+        }
+
+        NlmeJoinRequestParams joinParams;
+
+        zigbee::CapabilityInformation capaInfo;
+        // Set device type from the role table (see IsRouterNode)
+        if (IsRouterNode(stack->GetNode()->GetId()))
+        {
+            NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " joining as ROUTER");
+            capaInfo.SetDeviceType(ROUTER);
+        } 
+        else if (IsEndDeviceNode(stack->GetNode()->GetId()))
+        {
+            NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " joining as END DEVICE");
+            capaInfo.SetDeviceType(ENDDEVICE);
+            capaInfo.SetReceiverOnWhenIdle(g_roles[stack->GetNode()->GetId()].rxOnWhenIdle);
+        }
+        capaInfo.SetAllocateAddrOn(true);
+
+        // Parent selection policy: the chosen parent adds the device with a direct join, then (see
+        // NwkDirectJoinConfirm) the device joins it through an orphan scan (DIRECT_OR_REJOIN)
+        int32_t parent = (g_parentPolicy == "first") ? -1 : SelectParent(stack);
+        if (parent >= 0)
+        {
+            Ptr<ZigbeeStack> parentStack = zigbeeStacks.Get(parent);
+            g_chosenParent[stack->GetNode()->GetId()] = parent;
+            NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " selected Node " << parent << " as parent (policy "
+                        << g_parentPolicy << ")");
+
+            NlmeDirectJoinRequestParams directJoinParams;
+            directJoinParams.m_deviceAddr = stack->GetNwk()->GetIeeeAddress();
+            directJoinParams.m_capabilityInfo = capaInfo.GetCapability();
+            Simulator::ScheduleWithContext(parentStack->GetNode()->GetId(),
+                                           Seconds(0),
+                                           &ZigbeeNwk::NlmeDirectJoinRequest,
+                                           parentStack->GetNwk(),
+                                           directJoinParams);
+
+            joinParams.m_rejoinNetwork = zigbee::JoiningMethod::DIRECT_OR_REJOIN;
+            joinParams.m_capabilityInfo = capaInfo.GetCapability();
+            joinParams.m_extendedPanId = params.m_netDescList[0].m_extPanId;
+            joinParams.m_scanChannelList.channelPageCount = 1;
+            joinParams.m_scanChannelList.channelsField[0] = 0x00007800; // Same channels as the discovery
+            joinParams.m_scanDuration = 2;
+            g_directJoins[stack->GetNode()->GetId()] = joinParams;
+            return;
+        }
+
+        joinParams.m_rejoinNetwork = zigbee::JoiningMethod::ASSOCIATION;
+        joinParams.m_capabilityInfo = capaInfo.GetCapability();
+        joinParams.m_extendedPanId = params.m_netDescList[0].m_extPanId;
+
+        Simulator::ScheduleNow(&ZigbeeNwk::NlmeJoinRequest, stack->GetNwk(), joinParams);
+    }
+    else
+    {
+        NS_ABORT_MSG("Unable to discover networks | status: " << params.m_status);
+    }
+}
+
+
+//* NwkJoinConfirm Function
+//Purpose: This is a callback function that is invoked when the JOIN procedure is confirmed.
+//What it does:
+//1. Checks if the JOIN was successful.
+//2. If successful, it prints the details of the JOIN (network short address, extended PAN ID).
+//3. It then schedules a NlmeStartRouterRequest to start the device as a router
+static void
+NwkJoinConfirm(Ptr<ZigbeeStack> stack, NlmeJoinConfirmParams params)
+{
+    if (params.m_status == NwkStatus::SUCCESS)
+    {
+        std::cout << Simulator::Now().As(Time::S) << " Node " << stack->GetNode()->GetId() << " | "
+                  << " The device joined the network SUCCESSFULLY with short address " << std::hex
+                  << params.m_networkAddress << " on the Extended PAN Id: " << std::hex
+                  << params.m_extendedPanId << "\n"
+                  << std::dec;
+
+        // Position in the tree: the parent chosen by the policy, or the coordinator of the MAC association
+        uint16_t nodeId = stack->GetNode()->GetId();
+        int32_t parent = g_chosenParent.count(nodeId)
+                             ? g_chosenParent[nodeId]
+                             : NodeIdOfAddress(DynamicCast<LrWpanNetDevice>(stack->GetNode()->GetDevice(0))
+                                                   ->GetMac()
+                                                   ->GetCoordShortAddress());
+        if (parent >= 0)
+        {
+            g_parentOf[nodeId] = parent;
+            g_nodeDepth[nodeId] = g_nodeDepth[parent] + 1;
+        }
+
+        // Check if the node is NOT an End Device before starting the router
+        if (IsRouterNode(stack->GetNode()->GetId())) // Execute only if NOT an End Device
+        {
+            NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " starting as ROUTER");
+            // Original: Start the device as a router
+            NlmeStartRouterRequestParams startRouterParams; 
+            Simulator::ScheduleNow(&ZigbeeNwk::NlmeStartRouterRequest,
+                                   stack->GetNwk(),
+                                   startRouterParams);
+        }
+        else
+        {
+             NS_LOG_INFO("Node " << stack->GetNode()->GetId() << " (EndDevice) does NOT start router functionality.");
+             if (!g_roles[nodeId].rxOnWhenIdle)
+             {
+                 // Rx-off-when-idle end device: the receiver is only on while it transmits or polls its parent
+                 DynamicCast<LrWpanNetDevice>(stack->GetNode()->GetDevice(0))->GetMac()->SetRxOnWhenIdle(false);
+                 if (!g_sleepEvents.count(nodeId)) // Rejoins keep the running poll cycle
+                 {
+                     g_sleepEvents[nodeId] = EventId();
+                     Simulator::Schedule(Seconds(g_pollInterval), &PollParent, stack);
+                 }
+             }
+        }
+    }
+    else
+    {
+        std::cout << " The device FAILED to join the network with status " << params.m_status
+                  << "\n";
+        g_chosenParent.erase(stack->GetNode()->GetId());
+    }
+}
+
+
+//* NwkRouteDiscoveryConfirm Function
+//Purpose: This is a callback function that is invoked when a route discovery process is confirmed.
+//What it does:
+//Prints the status of the route discovery.
+static void
+NwkRouteDiscoveryConfirm(Ptr<ZigbeeStack> stack, NlmeRouteDiscoveryConfirmParams params)
+{
+    std::cout << "NlmeRouteDiscoveryConfirmStatus = " << params.m_status << "\n";
+}
+
+
+//* CreateTrackedPacket Function
+//Purpose: Creates the 5-byte reading of a new transmission from stackSrc, tagged with a unique ID (g_packetCounter),
+//and records its send time and the per-packet statistics.
+static Ptr<Packet>
+CreateTrackedPacket(Ptr<ZigbeeStack> stackSrc)
+{
+    g_totalPacketsSent++;
+    g_packetCounter++; //Increment to get a unique ID
+    g_sendsRemaining--;
+    g_windowSent++;
+
+    // Create a 5-byte packet: the reading carries its own ID, so it can still be tracked once merged with others
+    uint8_t reading[READING_BYTES] = {static_cast<uint8_t>(g_packetCounter >> 24),
+                                      static_cast<uint8_t>(g_packetCounter >> 16),
+                                      static_cast<uint8_t>(g_packetCounter >> 8),
+                                      static_cast<uint8_t>(g_packetCounter),
+                                      static_cast<uint8_t>(g_packetCounter & 0x7F)}; // Sample value
+    Ptr<Packet> p = Create<Packet>(reading, READING_BYTES);
+
+    // --- Add Packet Tag --- 
+    PacketIdTag tag;
+    tag.SetPacketId(g_packetCounter); // Set the unique ID in the tag
+    p->AddPacketTag(tag); // Add the tag to the packet
+
+    // --- Record Send Time ---
+    g_sendTimeMap[g_packetCounter] = Simulator::Now(); // Associate the packet ID with the current time
+    g_packetOutcome.push_back(-1);                     // Outstanding
+    g_packetSendTime.push_back(Simulator::Now().GetSeconds());
+    g_packetDelay.push_back(-1.0);
+    g_packetSrc.push_back(stackSrc->GetNode()->GetId());
+    return p;
+}
+
+
+//* SendData Function
+//Purpose: This function sends a data packet from one Zigbee node (stackSrc) to another (stackDst).
+//How it works:
+//1. Creates a packet.
+//2. Sets the destination address (dataReqParams.m_dstAddr) to the network address of the destination node.
+//3. Sets dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY; to enable route discovery if a route is not already known.
+//4. Schedules the NldeDataRequest to send the packet.
+static void
+SendData(Ptr<ZigbeeStack> stackSrc, Ptr<ZigbeeStack> stackDst)
+{
+    // Send data from a device with stackSrc to device with stackDst.
+
+    // We do not know what network address will be assigned after the JOIN procedure
+    // but we can request the network address from stackDst (the destination device) when
+    // we intend to send data. If a route do not exist, we will search for a route
+    // before transmitting data (Mesh routing).
+
+    // --- Packet Sent ---
+    NS_LOG_INFO("Node " << stackSrc->GetNode()->GetId() << " sending data to Node " << stackDst->GetNode()->GetId()); // Log send
+    Ptr<Packet> p = CreateTrackedPacket(stackSrc);
+    g_pathInFlight[g_packetCounter] = {static_cast<uint16_t>(stackSrc->GetNode()->GetId())}; // The path starts at the source
+
+    if (g_aggregation) // The reading goes to its aggregator (a router source aggregates its own readings)
+    {
+        Ptr<ZigbeeStack> aggregator = AggregatorOf(stackSrc);
+        if (aggregator == stackSrc)
+        {
+            AggregateReading(stackSrc, g_packetCounter);
+            Simulator::Schedule(Seconds(g_packetTimeout), &ExpirePacket, g_packetCounter);
+            return;
+        }
+        stackDst = aggregator;
+    }
+
+    if (g_batching) // The reading waits in the batch of the source
+    {
+        BatchReading(stackSrc, stackDst, g_packetCounter);
+        Simulator::Schedule(Seconds(g_packetTimeout), &ExpirePacket, g_packetCounter);
+        return;
+    }
+
+    if (g_aps) // The APS layer transmits the frame and retransmits it until it is acknowledged
+    {
+        ApsDataRequest(stackSrc, stackDst, g_packetCounter, p);
+        return;
+    }
+
+    auto sleepyParent = g_parentOf.find(stackDst->GetNode()->GetId());
+    if (IsSleepyEndDevice(stackDst->GetNode()->GetId()) && sleepyParent != g_parentOf.end())
+    {
+        // Indirect transmission: the packet goes to the parent, which buffers it until the device polls
+        g_sleepyPackets.push_back(g_packetCounter);
+        Simulator::Schedule(Seconds(g_packetTimeout), &ExpirePacket, g_packetCounter);
+        if (sleepyParent->second == stackSrc->GetNode()->GetId())
+        {
+            BufferFrame(stackSrc, stackDst->GetNode()->GetId(), g_packetCounter, p);
+            return;
+        }
+        g_sleepyDownlink[g_packetCounter] = stackDst->GetNode()->GetId();
+        stackDst = zigbeeStacks.Get(sleepyParent->second);
+    }
+
+    NldeDataRequestParams dataReqParams;
+    dataReqParams.m_dstAddrMode = UCST_BCST; 
+    dataReqParams.m_dstAddr = stackDst->GetNwk()->GetNetworkAddress();
+    // Handle used to match the NLDE-DATA.confirm with the packet
+    dataReqParams.m_nsduHandle = AllocateNsduHandle(stackSrc->GetNode()->GetId(), {g_packetCounter});
+    dataReqParams.m_discoverRoute = ENABLE_ROUTE_DISCOVERY; // Enable route discovery if no route is known
+
+    Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, stackSrc->GetNwk(), dataReqParams, p);
+
+    // --- Packet Timeout ---
+    if (!g_sleepyDownlink.count(g_packetCounter)) // Already scheduled for the indirect transmissions
+    {
+        Simulator::Schedule(Seconds(g_packetTimeout), &ExpirePacket, g_packetCounter);
+    }
+}
+
+
+//* SendBroadcast Function
+//Purpose: Broadcasts a data packet from stackSrc to g_broadcastAddr (all devices, routers only or rx-on-when-idle devices).
+//The NWK floods it: every router that receives it for the first time rebroadcasts it.
+static void
+SendBroadcast(Ptr<ZigbeeStack> stackSrc)
+{
+    NS_LOG_INFO("Node " << stackSrc->GetNode()->GetId() << " broadcasting data to " << g_broadcastAddr);
+    Ptr<Packet> p = CreateTrackedPacket(stackSrc);
+    StartBroadcastTracking(g_packetCounter, stackSrc);
+
+    NldeDataRequestParams dataReqParams;
+    dataReqParams.m_dstAddrMode = UCST_BCST;
+    dataReqParams.m_dstAddr = g_broadcastAddr;
+    dataReqParams.m_radius = g_broadcastRadius;
+    dataReqParams.m_nsduHandle = AllocateNsduHandle(stackSrc->GetNode()->GetId(), {g_packetCounter});
+    dataReqParams.m_discoverRoute = SUPPRESS_ROUTE_DISCOVERY; // Broadcasts do not use routes
+
+    Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, stackSrc->GetNwk(), dataReqParams, p);
+    Simulator::Schedule(Seconds(g_packetTimeout), &ExpirePacket, g_packetCounter);
+}
+
+
+//* PrintSimulationResults Function
+//Purpose: Calculates and prints the final performance metrics (PDR, latency, jitter).
+static void
+PrintSimulationResults()
+{
+    std::cout << "\n-----------------------------------------\n";
+    std::cout << "---      Simulation Results           ---\n";
+    std::cout << "-----------------------------------------\n";
+    std::cout << "Total Packets Sent:     " << g_totalPacketsSent << "\n";
+    std::cout << "Total Packets Received: " << g_totalPacketsReceived << "\n";
+    std::cout << "Packets Dropped:        " << g_packetsDropped << "\n";
+    std::cout << "Packets Timed Out:      " << g_packetsTimedOut << "\n";
+
+    // Calculate Average PDR
+    double avgPdr = 0.0;
+    if (g_totalPacketsSent > 0)
+    {
+        avgPdr = static_cast<double>(g_totalPacketsReceived) / g_totalPacketsSent;
+        std::cout << "Packet Delivery Ratio (PDR): " << avgPdr * 100.0 << " %\n";
+    }
+    else
+    {
+        std::cout << "PDR: N/A (No packets sent)\n";
+    }
+    
+    // Calculate latency metrics
+    std::cout << "--- Latency Metrics (End-to-End) ---\n";
+    if (!g_delayList.empty())
+    {
+        Time totalDelay = Seconds(0);
+        Time minDelay = g_delayList[0];
+        Time maxDelay = g_delayList[0];
+
+        // Calculate sum, min, max
+        for (const auto& delay : g_delayList) {
+            totalDelay += delay;
+            if (delay < minDelay) minDelay = delay;
+            if (delay > maxDelay) maxDelay = delay;
+        }
+
+        // Calculate average
+        Time avgDelay = totalDelay / g_delayList.size();
+
+        // Calculate Jitter (as standard deviation of latency in seconds)
+        double sumSquaredDiff = 0.0;
+        double avgDelaySec = avgDelay.GetSeconds();
+        for (const auto& delay : g_delayList) {
+            double delaySec = delay.GetSeconds();
+            sumSquaredDiff += (delaySec - avgDelaySec) * (delaySec - avgDelaySec);
+        }
+        double variance = sumSquaredDiff / g_delayList.size();
+        double jitter = std::sqrt(variance);
+
+        std::cout << "Average Delay: " << avgDelay.GetSeconds() << " s\n";
+        std::cout << "Minimum Delay: " << minDelay.GetSeconds() << " s\n";
+        std::cout << "Maximum Delay: " << maxDelay.GetSeconds() << " s\n";
+        std::cout << "Jitter (StdDev): " << jitter << " s\n";
+        std::cout << "(Based on " << g_delayList.size() << " successfully received packets)\n";
+    }
+    else
+    {
+        std::cout << "Average Delay: N/A\n";
+        std::cout << "Minimum Delay: N/A\n";
+        std::cout << "Maximum Delay: N/A\n";
+        std::cout << "Jitter (StdDev): N/A\n";
+        std::cout << "(No packets received successfully to calculate latency)\n";
+    }
+    std::cout << "Simulation ended at T=" << Simulator::Now().As(Time::S) << "\n";
+    std::cout << "-------------------------------------------\n";
+}
+
+
+static void GenerateTraffic(Ptr<ZigbeeStack> stackSrc, Ptr<ZigbeeStack> stackDst, double start, double interval,
+                            uint32_t index, uint32_t count);
+
+//* ScheduleSend Function
+//Purpose: Schedules send 'index' of a source on its fixed grid, at start + index * interval, varied by up to
+//--sendJitter times the interval (the jitter of a send does not shift the following ones; never before start).
+static void
+ScheduleSend(Ptr<ZigbeeStack> stackSrc, Ptr<ZigbeeStack> stackDst, double start, double interval, uint32_t index,
+             uint32_t count)
+{
+    double sendTime = start + index * interval;
+    if (g_sendJitter > 0)
+    {
+        sendTime += g_trafficRng[stackSrc->GetNode()->GetId()]->GetValue(-g_sendJitter, g_sendJitter) * interval;
+    }
+    sendTime = std::max({sendTime, start, Simulator::Now().GetSeconds()});
+    Simulator::Schedule(Seconds(sendTime) - Simulator::Now(),
+                        &GenerateTraffic,
+                        stackSrc,
+                        stackDst,
+                        start,
+                        interval,
+                        index,
+                        count);
+}
+
+
+//* GenerateTraffic Function
+//Purpose: Sends packet 'index' of the 'count' packets of stackSrc to stackDst (or a broadcast with --broadcast) and
+//schedules the next one, unless the early stop has ended the traffic (g_sendsRemaining set to 0).
+static void
+GenerateTraffic(Ptr<ZigbeeStack> stackSrc, Ptr<ZigbeeStack> stackDst, double start, double interval,
+                uint32_t index, uint32_t count)
+{
+    if (g_sendsRemaining == 0)
+    {
+        return;
+    }
+    if (g_broadcastMode)
+    {
+        SendBroadcast(stackSrc);
+    }
+    else
+    {
+        SendData(stackSrc, stackDst);
+    }
+    if (index + 1 < count)
+    {
+        ScheduleSend(stackSrc, stackDst, start, interval, index + 1, count);
+    }
+}
+
+
+//* ManyToOneRouteDiscovery Function
+//Purpose: Makes the coordinator a concentrator: a many-to-one route request (no destination address) is flooded
+//once and every router stores a single route entry towards the coordinator, instead of one route discovery per source.
+//The discovery is repeated every 'interval' seconds (0 = only once) until the final reports run.
+//The measured mode is many-to-one WITH route cache: the request advertises a concentrator that keeps a route record table.
+static void
+ManyToOneRouteDiscovery(Ptr<ZigbeeStack> concentrator, double interval)
+{
+    if (g_finalReportsDone)
+    {
+        return;
+    }
+    NlmeRouteDiscoveryRequestParams routeDiscParams;
+    routeDiscParams.m_dstAddrMode = NO_ADDRESS; // Many-to-one route discovery
+    routeDiscParams.m_radius = 0;               // Default radius (2 * max depth)
+    routeDiscParams.m_noRouteCache = false;     // The concentrator keeps a route record table (route cache)
+    Simulator::ScheduleWithContext(concentrator->GetNode()->GetId(),
+                                   Seconds(0),
+                                   &ZigbeeNwk::NlmeRouteDiscoveryRequest,
+                                   concentrator->GetNwk(),
+                                   routeDiscParams);
+    g_mtoDiscoveries++;
+    NS_LOG_INFO("Node " << concentrator->GetNode()->GetId() << " starts a many-to-one route discovery");
+
+    if (interval > 0)
+    {
+        Simulator::Schedule(Seconds(interval), &ManyToOneRouteDiscovery, concentrator, interval);
+    }
+}
+
+
+//* PrintRunSummary Function
+//Purpose: Prints the key metrics on a single "RUN_SUMMARY key=value ..." line.
+//It is the last line of the results and it is parsed by the automated searches that run child simulations.
+static void
+PrintRunSummary()
+{
+    std::vector<double> delays;
+    for (const auto& delay : g_delayList)
+    {
+        delays.push_back(delay.GetSeconds());
+    }
+    double pdr = (g_totalPacketsSent > 0) ? static_cast<double>(g_totalPacketsReceived) / g_totalPacketsSent : 0.0;
+    double avgDelay = delays.empty() ? 0.0 : std::accumulate(delays.begin(), delays.end(), 0.0) / delays.size();
+    double p99Delay = delays.empty() ? std::numeric_limits<double>::infinity() : Quantile(delays, 0.99);
+    std::map<uint16_t, std::pair<uint32_t, uint32_t>> sourceOutcomes; // Source Node ID -> (sent, received)
+    for (uint32_t k = 0; k < g_packetSrc.size(); k++)
+    {
+        sourceOutcomes[g_packetSrc[k]].first++;
+        sourceOutcomes[g_packetSrc[k]].second += (g_packetDelay[k] >= 0) ? 1 : 0;
+    }
+    double worstFlowPdr = sourceOutcomes.empty() ? 0.0 : 1.0;
+    for (const auto& source : sourceOutcomes)
+    {
+        worstFlowPdr = std::min(worstFlowPdr, static_cast<double>(source.second.second) / source.second.first);
+    }
+
+    std::vector<size_t> sizes = RoutingTableSizes();
+    double avgEntries = sizes.empty() ? 0.0 : std::accumulate(sizes.begin(), sizes.end(), 0.0) / sizes.size();
+    size_t maxEntries = sizes.empty() ? 0 : *std::max_element(sizes.begin(), sizes.end());
+
+    std::cout << "RUN_SUMMARY sent=" << g_totalPacketsSent << " received=" << g_totalPacketsReceived << " pdr=" << pdr
+              << " worstFlowPdr=" << worstFlowPdr << " avgDelay=" << avgDelay << " p99Delay=" << p99Delay << " endTime=" << Simulator::Now().GetSeconds()
+              << " controlFrames=" << TotalControlFrames() << " routingEntriesAvg=" << avgEntries
+              << " routingEntriesMax=" << maxEntries << " sinkBps=" << SinkThroughput()
+              << " channelUtil=" << ChannelUtilization() << " goodputBps=" << TotalGoodput();
+
+    double sumDepth = 0;
+    uint32_t maxDepth = 0;
+    for (const auto& entry : g_nodeDepth)
+    {
+        sumDepth += entry.second;
+        maxDepth = std::max(maxDepth, entry.second);
+    }
+    double sumHops = 0;
+    uint32_t pathPackets = 0;
+    for (const auto& flow : g_flowPaths)
+    {
+        for (const auto& path : flow.second)
+        {
+            sumHops += static_cast<double>(g_paths[path.first]->size() - 1) * path.second.count;
+            pathPackets += path.second.count;
+        }
+    }
+    std::cout << " avgDepth=" << (g_nodeDepth.empty() ? 0.0 : sumDepth / g_nodeDepth.size()) << " maxDepth=" << maxDepth
+              << " avgHops=" << (pathPackets > 0 ? sumHops / pathPackets : 0.0) << " joined=" << g_parentOf.size();
+    if (g_aps)
+    {
+        uint64_t apsBytes = g_apsAirtimeBytes[0] + g_apsAirtimeBytes[1] + g_apsAirtimeBytes[2];
+        std::cout << " apsRetransmissions=" << g_apsRetransmissions << " apsOverhead="
+                  << (apsBytes > 0 ? static_cast<double>(g_apsAirtimeBytes[1] + g_apsAirtimeBytes[2]) / apsBytes : 0.0);
+    }
+    if (g_respond)
+    {
+        std::cout << " repliesReceived=" << g_repliesReceived
+                  << " responseLoss=" << (g_repliesSent > 0 ? 1.0 - static_cast<double>(g_repliesReceived) / g_repliesSent : 0.0)
+                  << " rttAvg=" << (g_rttList.empty() ? 0.0 : std::accumulate(g_rttList.begin(), g_rttList.end(), 0.0) / g_rttList.size())
+                  << " rttP99=" << (g_rttList.empty() ? std::numeric_limits<double>::infinity() : Quantile(g_rttList, 0.99));
+    }
+    if (!g_broadcasts.empty())
+    {
+        double sumCoverage = 0;
+        for (const auto& entry : g_broadcasts)
+        {
+            sumCoverage += entry.second.numExpected > 0
+                               ? static_cast<double>(entry.second.numDelivered) / entry.second.numExpected
+                               : 1.0;
+        }
+        uint64_t redundant = std::accumulate(g_broadcastRedundant.begin(), g_broadcastRedundant.end(), uint64_t(0));
+        std::cout << " coverage=" << sumCoverage / g_broadcasts.size()
+                  << " redundantPerBroadcast=" << static_cast<double>(redundant) / g_broadcasts.size();
+    }
+    if (g_polls > 0)
+    {
+        std::cout << " bufferHoldAvg="
+                  << (g_bufferHoldTimes.empty() ? 0.0
+                                                : std::accumulate(g_bufferHoldTimes.begin(), g_bufferHoldTimes.end(), 0.0) /
+                                                      g_bufferHoldTimes.size())
+                  << " polls=" << g_polls << " pollAirtimeBytes=" << g_pollAirtimeBytes;
+    }
+    if (!g_faults.empty())
+    {
+        double repairTime = 0; // Slowest repair of the faults that affected traffic
+        for (const auto& fault : g_faults)
+        {
+            if (!fault.affectedFlows.empty())
+            {
+                repairTime = std::max(repairTime,
+                                      fault.repairTime >= 0 ? fault.repairTime : std::numeric_limits<double>::infinity());
+            }
+        }
+        std::cout << " repairTime=" << repairTime;
+    }
+    std::cout << "\n";
+}
+
+//* Child Simulations
+//* Purpose:
+//* The automated searches (e.g. the saturation throughput finder) evaluate many configurations with short runs.
+//* ns-3 has a single simulator per process, so every run is a child process of this same program, started with the
+//* command line of the parent plus the overrides of the run. Up to g_jobs children run in parallel and each one
+//* returns the metrics of its RUN_SUMMARY line (RunSummary, declared with the rare-event validation that also uses it).
+std::string g_childCommand; // Executable and forwarded arguments of the child simulations
+uint32_t g_jobs = std::max(1u, std::thread::hardware_concurrency()); // Child simulations run in parallel
+
+//* Quotes an argument for the shell
+static std::string
+ShellQuote(const std::string& arg)
+{
+    std::string quoted = "'";
+    for (char c : arg)
+    {
+        quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+//* Builds g_childCommand from the executable and the arguments of this run, except the ones in 'skip'
+//* (the options that select an automated search, so that children run a normal simulation)
+static void
+SetChildCommand(int argc, char* argv[], const std::vector<std::string>& skip)
+{
+    char exe[4096];
+    ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    g_childCommand = ShellQuote(length > 0 ? std::string(exe, length) : std::string(argv[0]));
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool skipped = false;
+        for (const auto& option : skip)
+        {
+            skipped = skipped || arg.rfind("--" + option, 0) == 0;
+        }
+        if (!skipped)
+        {
+            g_childCommand += " " + ShellQuote(arg);
+        }
+    }
+    // The children do not need the optional output files nor the periodic checks
+    g_childCommand += " --snapshotInterval=0 --metricsWindow=0 --routeCheckInterval=0";
+}
+
+//* Runs one child simulation and returns its RUN_SUMMARY (empty if the run failed)
+static RunSummary
+RunChildSimulation(const std::string& args)
+{
+    RunSummary summary;
+    std::string command = g_childCommand + " " + args + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe)
+    {
+        return summary;
+    }
+    char buffer[4096];
+    std::string summaryLine;
+    while (fgets(buffer, sizeof(buffer), pipe))
+    {
+        if (std::string(buffer).rfind("RUN_SUMMARY ", 0) == 0)
+        {
+            summaryLine = buffer;
+        }
+    }
+    if (pclose(pipe) != 0 || summaryLine.empty())
+    {
+        return summary;
+    }
+
+    std::istringstream fields(summaryLine.substr(12));
+    std::string field;
+    while (fields >> field)
+    {
+        size_t eq = field.find('=');
+        if (eq != std::string::npos)
+        {
+            summary[field.substr(0, eq)] = std::stod(field.substr(eq + 1));
+        }
+    }
+    return summary;
+}
+
+//* Runs the child simulations (one per element of argsList) on g_jobs parallel workers
+static std::vector<RunSummary>
+RunChildSimulations(const std::vector<std::string>& argsList)
+{
+    std::vector<RunSummary> summaries(argsList.size());
+    std::atomic<uint32_t> nextRun(0);
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < std::min<size_t>(g_jobs, argsList.size()); t++)
+    {
+        workers.emplace_back([&]() {
+            for (uint32_t k = nextRun++; k < argsList.size(); k = nextRun++)
+            {
+                summaries[k] = RunChildSimulation(argsList[k]);
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    return summaries;
+}
+
+//* Saturation Throughput Finder
+//* Purpose:
+//* Finds the maximum offered load at which the network still meets its targets (PDR >= targetPdr and
+//* p99 latency <= maxP99), which is the capacity of the topology.
+//*
+//* How it works:
+//* For every number of concurrent sources, the packet interval is searched between minInterval (overloaded) and
+//* maxInterval (light load), on a logarithmic scale. Every round evaluates g_jobs intervals in parallel (one short child
+//* run each) and keeps the bracket between the shortest passing interval and the next failing one (k-ary bisection).
+//* Every probe is run with 'replications' run numbers (--rngRun=firstRun, firstRun+1, ...) and passes if the mean PDR
+//* and the mean p99 latency of its replications meet the targets, so a single lucky seed cannot move the bracket.
+//* The capacity is the highest aggregate rate (sources / interval) that passed.
+static int
+FindCapacity(const std::vector<uint32_t>& sourceCounts,
+             double minInterval,
+             double maxInterval,
+             double targetPdr,
+             double maxP99,
+             uint32_t probePackets,
+             uint32_t rounds,
+             uint32_t replications,
+             uint32_t firstRun)
+{
+    auto passes = [&](const RunSummary& r) {
+        return !r.empty() && r.at("pdr") >= targetPdr && r.at("p99Delay") <= maxP99;
+    };
+
+    std::cout << "--- Saturation Throughput Finder ---\n";
+    std::cout << "Targets: PDR >= " << targetPdr * 100 << " %, p99 latency <= " << maxP99 << " s | "
+              << probePackets << " packets per source per probe | " << replications << " replications per probe | "
+              << g_jobs << " parallel runs\n";
+
+    double bestRate = 0;
+    uint32_t bestSources = 0;
+    for (uint32_t sources : sourceCounts)
+    {
+        double passing = 0; // Shortest interval that passed (0 = none yet)
+        double low = minInterval;
+        double high = maxInterval;
+        for (uint32_t round = 0; round < rounds; round++)
+        {
+            // g_jobs points evenly spaced (log scale) strictly inside [low, high], plus high itself in the first round
+            std::vector<double> intervals;
+            uint32_t points = std::max(1u, g_jobs);
+            for (uint32_t k = 1; k <= points; k++)
+            {
+                intervals.push_back(low * std::pow(high / low, static_cast<double>(k) / (points + 1)));
+            }
+            if (round == 0)
+            {
+                intervals.push_back(high);
+            }
+
+            std::vector<std::string> argsList;
+            for (double interval : intervals)
+            {
+                for (uint32_t r = 0; r < replications; r++)
+                {
+                    std::ostringstream args;
+                    args << "--interval=" << interval << " --numSources=" << sources << " --numPackets=" << probePackets
+                         << " --rngRun=" << firstRun + r;
+                    argsList.push_back(args.str());
+                }
+            }
+            std::vector<RunSummary> runs = RunChildSimulations(argsList);
+
+            // Mean PDR and p99 latency of the replications of every interval (empty if all of them failed)
+            std::vector<RunSummary> results(intervals.size());
+            for (uint32_t k = 0; k < intervals.size(); k++)
+            {
+                uint32_t completed = 0;
+                for (uint32_t r = 0; r < replications; r++)
+                {
+                    const RunSummary& run = runs[k * replications + r];
+                    if (!run.empty())
+                    {
+                        results[k]["pdr"] += run.at("pdr");
+                        results[k]["p99Delay"] += run.at("p99Delay");
+                        completed++;
+                    }
+                }
+                if (completed > 0)
+                {
+                    results[k]["pdr"] /= completed;
+                    results[k]["p99Delay"] /= completed;
+                    results[k]["replications"] = completed;
+                }
+            }
+
+            // New bracket: shortest passing interval and the longest failing interval below it
+            double newLow = low;
+            double newHigh = high;
+            bool anyPass = false;
+            for (uint32_t k = 0; k < intervals.size(); k++)
+            {
+                std::cout << "  " << sources << " source(s), interval " << intervals[k] << " s: "
+                          << (results[k].empty() ? "run FAILED"
+                                                 : (passes(results[k]) ? "PASS" : "FAIL"));
+                if (!results[k].empty())
+                {
+                    std::cout << " (mean PDR " << results[k]["pdr"] * 100 << " %, mean p99 " << results[k]["p99Delay"]
+                              << " s over " << results[k]["replications"] << " runs)";
+                }
+                std::cout << "\n";
+                if (passes(results[k]) && (!anyPass || intervals[k] < newHigh))
+                {
+                    newHigh = intervals[k];
+                    anyPass = true;
+                }
+            }
+            if (!anyPass)
+            {
+                if (round == 0)
+                {
+                    break; // Not even the lightest load passes
+                }
+                low = intervals.back(); // Every interval inside the bracket failed: the threshold is above them
+                continue;
+            }
+            passing = newHigh;
+            for (uint32_t k = 0; k < intervals.size(); k++)
+            {
+                if (intervals[k] < passing && intervals[k] > newLow && !passes(results[k]))
+                {
+                    newLow = intervals[k];
+                }
+            }
+            low = newLow;
+            high = passing;
+        }
+
+        if (passing > 0)
+        {
+            double rate = sources / passing;
+            std::cout << sources << " source(s): capacity " << rate << " pkt/s (interval " << passing << " s)\n";
+            if (rate > bestRate)
+            {
+                bestRate = rate;
+                bestSources = sources;
+            }
+        }
+        else
+        {
+            std::cout << sources << " source(s): targets not met even at interval " << maxInterval << " s\n";
+        }
+    }
+
+    std::cout << "CAPACITY " << bestRate << " pkt/s (" << bestRate * READING_BYTES * 8 << " bit/s of payload) with "
+              << bestSources << " source(s)\n";
+    return bestRate > 0 ? 0 : 1;
+}
+
+
+//* CompareAggregation Function
+//Purpose: Runs the same collection scenario without and with in-network aggregation (two child simulations in parallel)
+//and reports the reduction of the channel utilization, the added latency and the change of the sink PDR.
+static int
+CompareAggregation()
+{
+    std::vector<std::string> argsList = {"--collection=1 --aggregation=0", "--collection=1 --aggregation=1"};
+    std::vector<RunSummary> results = RunChildSimulations(argsList);
+
+    std::cout << "\n--- Collection: no aggregation vs in-network aggregation ---\n";
+    std::cout << "Aggregation | Sink PDR | Avg delay [s] | p99 delay [s] | Channel utilization %\n";
+    const char* names[] = {"Off        ", "On         "};
+    for (uint32_t k = 0; k < results.size(); k++)
+    {
+        if (results[k].empty())
+        {
+            std::cout << names[k] << " | child simulation failed\n";
+            continue;
+        }
+        std::cout << names[k] << " | " << results[k]["pdr"] << " | " << results[k]["avgDelay"] << " | "
+                  << results[k]["p99Delay"] << " | " << 100.0 * results[k]["channelUtil"] << "\n";
+    }
+    if (results[0].empty() || results[1].empty())
+    {
+        return 1;
+    }
+    double utilOff = results[0]["channelUtil"];
+    std::cout << "Channel utilization reduction: "
+              << (utilOff > 0 ? 100.0 * (utilOff - results[1]["channelUtil"]) / utilOff : 0.0) << " %\n";
+    std::cout << "Added latency: avg " << results[1]["avgDelay"] - results[0]["avgDelay"] << " s, p99 "
+              << results[1]["p99Delay"] - results[0]["p99Delay"] << " s\n";
+    std::cout << "Sink PDR change: " << 100.0 * (results[1]["pdr"] - results[0]["pdr"]) << " percentage points\n";
+    std::cout << "---------------------------------------------------\n";
+    return 0;
+}
+
+
+//* SweepBatchWindow Function
+//Purpose: Goodput versus latency trade-off of the source batching: runs one child simulation per batch window
+//(0 = no batching) in parallel and prints one line per window.
+//The packet timeout of the children is extended by the window, so readings waiting in a batch are not counted as lost.
+static int
+SweepBatchWindow(const std::vector<double>& windows)
+{
+    std::vector<std::string> argsList;
+    for (double window : windows)
+    {
+        std::ostringstream args;
+        args << "--batching=" << (window > 0 ? 1 : 0) << " --batchWindow=" << window
+             << " --packetTimeout=" << g_packetTimeout + window;
+        argsList.push_back(args.str());
+    }
+    std::vector<RunSummary> results = RunChildSimulations(argsList);
+
+    std::cout << "\n--- Source batching: goodput vs latency (max " << g_batchMaxReadings << " readings per batch) ---\n";
+    std::cout << "Window [s] | PDR | Goodput [bit/s] | Avg delay [s] | p99 delay [s] | Channel utilization %\n";
+    for (uint32_t k = 0; k < windows.size(); k++)
+    {
+        std::cout << windows[k] << (windows[k] > 0 ? "" : " (off)");
+        if (results[k].empty())
+        {
+            std::cout << " | child simulation failed\n";
+            continue;
+        }
+        std::cout << " | " << results[k]["pdr"] << " | " << results[k]["goodputBps"] << " | " << results[k]["avgDelay"]
+                  << " | " << results[k]["p99Delay"] << " | " << 100.0 * results[k]["channelUtil"] << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+    return 0;
+}
+
+
+//* SweepParentPolicy Function
+//Purpose: Runs the scenario once per parent selection policy (child simulations in parallel) and compares the depth
+//of the resulting tree with the hop count, the latency and the PDR of the traffic.
+static int
+SweepParentPolicy(const std::vector<std::string>& policies)
+{
+    std::vector<std::string> argsList;
+    for (const auto& policy : policies)
+    {
+        argsList.push_back("--parentPolicy=" + policy);
+    }
+    std::vector<RunSummary> results = RunChildSimulations(argsList);
+
+    std::cout << "\n--- Parent selection policies ---\n";
+    std::cout << "Policy | Avg depth | Max depth | Avg hops | Avg delay [s] | p99 delay [s] | PDR\n";
+    for (uint32_t k = 0; k < policies.size(); k++)
+    {
+        std::cout << policies[k];
+        if (results[k].empty())
+        {
+            std::cout << " | child simulation failed\n";
+            continue;
+        }
+        std::cout << " | " << results[k]["avgDepth"] << " | " << results[k]["maxDepth"] << " | " << results[k]["avgHops"]
+                  << " | " << results[k]["avgDelay"] << " | " << results[k]["p99Delay"] << " | " << results[k]["pdr"]
+                  << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+    return 0;
+}
+
+
+//* SweepRouterFraction Function
+//Purpose: Runs the grid scenario once per fraction of routers (child simulations in parallel) and compares
+//how many devices joined, the depth of the tree and the delivery of the traffic.
+static int
+SweepRouterFraction(const std::vector<double>& fractions)
+{
+    std::vector<std::string> argsList;
+    for (double fraction : fractions)
+    {
+        argsList.push_back("--routerFraction=" + std::to_string(fraction));
+    }
+    std::vector<RunSummary> results = RunChildSimulations(argsList);
+
+    std::cout << "\n--- Router fraction sweep ---\n";
+    std::cout << "Routers | Joined | Avg depth | Max depth | Avg hops | PDR | Avg delay [s] | Control frames\n";
+    for (uint32_t k = 0; k < fractions.size(); k++)
+    {
+        std::cout << fractions[k];
+        if (results[k].empty())
+        {
+            std::cout << " | child simulation failed\n";
+            continue;
+        }
+        std::cout << " | " << results[k]["joined"] << " | " << results[k]["avgDepth"] << " | " << results[k]["maxDepth"]
+                  << " | " << results[k]["avgHops"] << " | " << results[k]["pdr"] << " | " << results[k]["avgDelay"]
+                  << " | " << results[k]["controlFrames"] << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+    return 0;
+}
+
+
+//* Router Placement Optimizer
+//* Purpose:
+//* Searches the positions of a budget of routers that give the best service to fixed end devices: the highest PDR
+//* of the worst flow (objective "pdr") or the lowest p99 latency (objective "p99"). The end devices report to the
+//* coordinator (collection traffic), which also stays at its position.
+//*
+//* How it works:
+//* 1. Simulated annealing on the router positions: every iteration moves one router of the current placement with
+//*    a Gaussian step that shrinks with the temperature (bounded to the area of the fixed nodes).
+//* 2. Analytical pre-filter: the candidates are ranked by the link cost model (LinkCost, Dijkstra through the
+//*    routers): the ones that leave an end device without a path are discarded and only the g_jobs best ones run.
+//* 3. The g_jobs candidates run as short child simulations in parallel (--positions, --roles). The best one is
+//*    accepted if it improves the current placement, or with probability exp(-delta / T) otherwise.
+//* 4. The best placement found is printed and written as a --topologyFile scenario.
+struct PlacementScore
+{
+    double worstCost = LINK_COST_NONE; // Analytical: highest path cost of an end device to the coordinator
+    double totalCost = LINK_COST_NONE; // Analytical: sum of the path costs of the end devices
+};
+
+//* Analytical score of a scenario (Node 0 coordinator, Nodes 1..numRouters routers, then the end devices)
+static PlacementScore
+PlacementAnalyticScore(const std::vector<Vector>& positions, uint32_t numRouters)
+{
+    const uint32_t n = positions.size();
+    std::vector<double> cost = LinkCostsOfPositions(positions);
+    std::vector<bool> canRelay(n, false);
+    for (uint32_t i = 0; i <= numRouters; i++)
+    {
+        canRelay[i] = true;
+    }
+    std::vector<double> dist;
+    std::vector<uint32_t> hops;
+    ShortestPathsToSink(cost, canRelay, 0, dist, hops);
+
+    PlacementScore score;
+    score.worstCost = 0;
+    score.totalCost = 0;
+    for (uint32_t i = numRouters + 1; i < n; i++)
+    {
+        score.worstCost = std::max(score.worstCost, dist[i]);
+        score.totalCost += dist[i];
+    }
+    return score;
+}
+
+//* Arguments of the child simulation of a placement
+static std::string
+PlacementArgs(const std::vector<Vector>& positions, uint32_t numRouters, const std::string& endDeviceRoles)
+{
+    std::ostringstream args;
+    args << "--positions=";
+    for (uint32_t i = 0; i < positions.size(); i++)
+    {
+        args << (i > 0 ? "," : "") << positions[i].x << ":" << positions[i].y;
+    }
+    args << " --roles=zc";
+    for (uint32_t i = 0; i < numRouters; i++)
+    {
+        args << ",zr";
+    }
+    args << endDeviceRoles << " --collection=1 --collectionSources=";
+    for (uint32_t i = numRouters + 1; i < positions.size(); i++)
+    {
+        args << (i > numRouters + 1 ? "," : "") << i;
+    }
+    args << " --sourceNode=" << numRouters + 1 << " --destinationNode=0 --inspectNode=0";
+    return args.str();
+}
+
+static int
+OptimizeRouterPlacement(const std::vector<Vector>& scenario,
+                        uint32_t budget,
+                        const std::string& objective,
+                        uint32_t iterations,
+                        const std::string& outputFile)
+{
+    // Fixed nodes: the coordinator and the end devices of the scenario. The routers of the scenario are the
+    // starting placement (completed with random positions, or truncated to the budget)
+    std::vector<Vector> fixed = {scenario[0]};
+    std::vector<Vector> routers;
+    std::vector<std::string> fixedRoles = {"zc"};
+    std::string endDeviceRoles;
+    for (uint32_t i = 1; i < scenario.size(); i++)
+    {
+        if (g_roles[i].role == ROLE_ROUTER)
+        {
+            routers.push_back(scenario[i]);
+        }
+        else
+        {
+            fixed.push_back(scenario[i]);
+            fixedRoles.push_back(g_roles[i].rxOnWhenIdle ? "zed" : "zed:rxoff");
+            endDeviceRoles += "," + fixedRoles.back();
+        }
+    }
+    NS_ABORT_MSG_IF(fixed.size() < 2, "--placeRouters requires end devices in the scenario");
+
+    double minX = fixed[0].x, maxX = fixed[0].x, minY = fixed[0].y, maxY = fixed[0].y;
+    for (const auto& position : fixed)
+    {
+        minX = std::min(minX, position.x);
+        maxX = std::max(maxX, position.x);
+        minY = std::min(minY, position.y);
+        maxY = std::max(maxY, position.y);
+    }
+    Ptr<UniformRandomVariable> uniform = CreateObject<UniformRandomVariable>();
+    Ptr<NormalRandomVariable> normal = CreateObject<NormalRandomVariable>();
+    uniform->SetStream(STREAM_PLACEMENT);
+    normal->SetStream(STREAM_PLACEMENT + 1);
+    while (routers.size() < budget)
+    {
+        routers.push_back(Vector(uniform->GetValue(minX, maxX), uniform->GetValue(minY, maxY), 0));
+    }
+    routers.resize(budget);
+    auto scenarioOf = [&](const std::vector<Vector>& placement) {
+        std::vector<Vector> positions = {fixed[0]};
+        positions.insert(positions.end(), placement.begin(), placement.end());
+        positions.insert(positions.end(), fixed.begin() + 1, fixed.end());
+        return positions;
+    };
+    // Energy to minimize: the worst flow PDR (negated) or the p99 latency; a failed run is the worst possible
+    auto energyOf = [&](const RunSummary& r) {
+        if (r.empty())
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        return objective == "pdr" ? -r.at("worstFlowPdr") : r.at("p99Delay");
+    };
+
+    std::cout << "--- Router Placement Optimizer ---\n";
+    std::cout << budget << " routers for " << fixed.size() - 1 << " end devices in [" << minX << ", " << maxX << "] x ["
+              << minY << ", " << maxY << "] m | objective: " << (objective == "pdr" ? "worst flow PDR" : "p99 latency")
+              << " | " << iterations << " iterations of " << g_jobs << " parallel runs\n";
+
+    RunSummary current = RunChildSimulation(PlacementArgs(scenarioOf(routers), budget, endDeviceRoles));
+    double currentEnergy = energyOf(current);
+    std::vector<Vector> best = routers;
+    RunSummary bestSummary = current;
+    double bestEnergy = currentEnergy;
+    // Initial temperature: 5 points of PDR, or 10 % of the initial p99 latency
+    double temperature0 = (objective == "pdr" || !std::isfinite(currentEnergy)) ? 0.05 : 0.1 * currentEnergy;
+    double step0 = 0.25 * std::max(maxX - minX, maxY - minY);
+    uint32_t filtered = 0;
+
+    for (uint32_t it = 0; it < iterations; it++)
+    {
+        double progress = static_cast<double>(it) / iterations;
+        double temperature = temperature0 * (1 - progress);
+        double step = step0 * (1 - progress) + 0.02 * step0;
+
+        // Neighbors of the current placement, ranked by the analytical score (4 candidates per parallel run)
+        std::vector<std::pair<PlacementScore, std::vector<Vector>>> candidates;
+        for (uint32_t c = 0; c < 4 * g_jobs; c++)
+        {
+            std::vector<Vector> placement = routers;
+            Vector& moved = placement[uniform->GetInteger(0, budget - 1)];
+            moved.x = std::clamp(moved.x + step * normal->GetValue(), minX, maxX);
+            moved.y = std::clamp(moved.y + step * normal->GetValue(), minY, maxY);
+            PlacementScore score = PlacementAnalyticScore(scenarioOf(placement), budget);
+            if (score.worstCost == LINK_COST_NONE)
+            {
+                filtered++; // An end device has no path to the coordinator
+                continue;
+            }
+            candidates.push_back({score, placement});
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) {
+            return std::tie(a.first.worstCost, a.first.totalCost) < std::tie(b.first.worstCost, b.first.totalCost);
+        });
+        candidates.resize(std::min<size_t>(candidates.size(), g_jobs));
+        if (candidates.empty())
+        {
+            std::cout << "  Iteration " << it + 1 << ": no feasible neighbor\n";
+            continue;
+        }
+
+        std::vector<std::string> argsList;
+        for (const auto& candidate : candidates)
+        {
+            argsList.push_back(PlacementArgs(scenarioOf(candidate.second), budget, endDeviceRoles));
+        }
+        std::vector<RunSummary> results = RunChildSimulations(argsList);
+        uint32_t chosen = 0;
+        for (uint32_t k = 1; k < results.size(); k++)
+        {
+            chosen = (energyOf(results[k]) < energyOf(results[chosen])) ? k : chosen;
+        }
+        double energy = energyOf(results[chosen]);
+
+        bool accepted = energy <= currentEnergy ||
+                        (std::isfinite(energy) && temperature > 0 &&
+                         uniform->GetValue() < std::exp(-(energy - currentEnergy) / temperature));
+        if (accepted)
+        {
+            routers = candidates[chosen].second;
+            currentEnergy = energy;
+        }
+        if (energy < bestEnergy)
+        {
+            best = candidates[chosen].second;
+            bestSummary = results[chosen];
+            bestEnergy = energy;
+        }
+        std::cout << "  Iteration " << it + 1 << ": best candidate "
+                  << (results[chosen].empty() ? std::string("run FAILED")
+                                              : (objective == "pdr" ? "worst flow PDR " : "p99 ") +
+                                                    std::to_string(std::abs(energy)))
+                  << (accepted ? " (accepted)" : " (rejected)") << " | best so far "
+                  << std::abs(bestEnergy) << "\n";
+    }
+
+    std::cout << "\n--- Best router placement ---\n";
+    std::cout << filtered << " candidate(s) discarded by the analytical pre-filter (end device without a path)\n";
+    if (bestSummary.empty())
+    {
+        std::cout << "No placement completed a simulation.\n";
+        return 1;
+    }
+    for (uint32_t r = 0; r < budget; r++)
+    {
+        std::cout << "Router " << r + 1 << ": (" << best[r].x << ", " << best[r].y << ")\n";
+    }
+    std::cout << "Worst flow PDR: " << bestSummary["worstFlowPdr"] * 100 << " % | PDR: " << bestSummary["pdr"] * 100
+              << " % | p99 latency: " << bestSummary["p99Delay"] << " s | Avg hops: " << bestSummary["avgHops"] << "\n";
+
+    // The scenario with the best placement, for --topologyFile
+    std::ofstream file(outputFile);
+    std::vector<Vector> positions = scenarioOf(best);
+    file << "# x y role (router placement optimized for the " << objective << " objective)\n";
+    for (uint32_t i = 0; i < positions.size(); i++)
+    {
+        std::string role = (i == 0) ? "zc" : (i <= budget ? "zr" : fixedRoles[i - budget]);
+        file << positions[i].x << " " << positions[i].y << " " << role << "\n";
+    }
+    std::cout << "Scenario written to " << outputFile << " (run it with --topologyFile=" << outputFile << ")\n";
+    return 0;
+}
+
+
+//* Surrogate Model
+//* Purpose:
+//* Predicts the PDR and the average latency of a topology and traffic configuration in microseconds, from a few graph
+//* features, so that thousands of candidate configurations can be screened and only the promising ones simulated.
+//*
+//* How it works:
+//* 1. Calibration: random connected configurations (positions, routers, collection sources, packet interval) run as
+//*    short child simulations in parallel. 75 % of them fit the model, the other 25 % are held out to measure its error.
+//* 2. Features (analytical, from the link cost model): average and maximum minimum hop count of the sources, average
+//*    path cost per hop of the sources (link quality), average neighbor count, offered load [packets/s] and relayed
+//*    load (sum over the sources of hops / interval) [transmissions/s].
+//* 3. Model: one linear regression per metric (least squares with a small ridge term, normal equations).
+//* 4. Screening: random candidates are ranked by the predicted PDR and the best ones are simulated to compare.
+struct SurrogateConfig
+{
+    std::vector<Vector> positions;
+    std::vector<std::string> roles;  // Role of every node (zc, zr, zed)
+    std::vector<uint32_t> sources;   // Collection sources (report to the coordinator)
+    double interval = 1.0;           // Packet interval of every source [s]
+    std::vector<double> features;    // Bias term first (see SurrogateFeatures)
+};
+
+static const char* SURROGATE_FEATURE_NAMES[] = {"bias", "avg hops", "max hops", "cost/hop", "neighbors",
+                                                "load [pkt/s]", "relayed load [tx/s]"};
+
+//* Features of a configuration (empty if a node cannot reach the coordinator: the connectivity pre-check rejects it)
+static std::vector<double>
+SurrogateFeatures(const SurrogateConfig& config)
+{
+    const uint32_t n = config.positions.size();
+    std::vector<double> cost = LinkCostsOfPositions(config.positions);
+    std::vector<bool> canRelay(n);
+    std::vector<std::vector<uint32_t>> adjacency(n);
+    double links = 0;
+    for (uint32_t a = 0; a < n; a++)
+    {
+        canRelay[a] = config.roles[a] != "zed";
+        for (uint32_t b = 0; b < n; b++)
+        {
+            if (a != b && cost[a * n + b] != LINK_COST_NONE)
+            {
+                adjacency[a].push_back(b);
+                links++;
+            }
+        }
+    }
+    std::vector<int32_t> hops = RelayHops(adjacency, canRelay, -1);
+    if (std::count(hops.begin(), hops.end(), -1) > 0)
+    {
+        return {};
+    }
+    std::vector<double> dist;
+    std::vector<uint32_t> costHops;
+    ShortestPathsToSink(cost, canRelay, 0, dist, costHops);
+
+    double sumHops = 0;
+    double maxHops = 0;
+    double sumCost = 0;
+    for (uint32_t source : config.sources)
+    {
+        sumHops += hops[source];
+        maxHops = std::max(maxHops, static_cast<double>(hops[source]));
+        sumCost += dist[source];
+    }
+    double numSources = config.sources.size();
+    return {1.0,
+            sumHops / numSources,
+            maxHops,
+            sumCost / sumHops,
+            links / n,
+            numSources / config.interval,
+            sumHops / config.interval};
+}
+
+//* Random connected configuration of 8 to 30 nodes
+static SurrogateConfig
+RandomSurrogateConfig(Ptr<UniformRandomVariable> uniform)
+{
+    SurrogateConfig config;
+    do
+    {
+        uint32_t n = uniform->GetInteger(8, 30);
+        double side = std::sqrt(static_cast<double>(n)) * uniform->GetValue(30, 70);
+        double routerFraction = uniform->GetValue(0.3, 1.0);
+        config.positions.assign(1, Vector(0, 0, 0));
+        config.roles.assign(1, "zc");
+        config.sources.clear();
+        for (uint32_t i = 1; i < n; i++)
+        {
+            config.positions.push_back(Vector(uniform->GetValue(0, side), uniform->GetValue(0, side), 0));
+            config.roles.push_back(uniform->GetValue() < routerFraction ? "zr" : "zed");
+            if (uniform->GetValue() < 0.5)
+            {
+                config.sources.push_back(i);
+            }
+        }
+        if (config.sources.empty())
+        {
+            config.sources.push_back(n - 1);
+        }
+        config.interval = std::exp(uniform->GetValue(std::log(0.2), std::log(2.0))); // Log-uniform in [0.2, 2] s
+        config.features = SurrogateFeatures(config);
+    } while (config.features.empty());
+    return config;
+}
+
+//* Arguments of the child simulation of a configuration
+static std::string
+SurrogateArgs(const SurrogateConfig& config)
+{
+    std::ostringstream args;
+    args << "--positions=";
+    for (uint32_t i = 0; i < config.positions.size(); i++)
+    {
+        args << (i > 0 ? "," : "") << config.positions[i].x << ":" << config.positions[i].y;
+    }
+    args << " --roles=";
+    for (uint32_t i = 0; i < config.roles.size(); i++)
+    {
+        args << (i > 0 ? "," : "") << config.roles[i];
+    }
+    args << " --collection=1 --collectionSources=";
+    for (uint32_t k = 0; k < config.sources.size(); k++)
+    {
+        args << (k > 0 ? "," : "") << config.sources[k];
+    }
+    args << " --interval=" << config.interval << " --sourceNode=" << config.sources[0]
+         << " --destinationNode=0 --inspectNode=0";
+    return args.str();
+}
+
+//* Least squares fit (XtX + ridge I) b = Xt y, solved with Gaussian elimination (partial pivoting)
+static std::vector<double>
+FitLinearModel(const std::vector<std::vector<double>>& x, const std::vector<double>& y)
+{
+    const uint32_t m = x[0].size();
+    std::vector<std::vector<double>> a(m, std::vector<double>(m + 1, 0.0));
+    for (uint32_t k = 0; k < x.size(); k++)
+    {
+        for (uint32_t i = 0; i < m; i++)
+        {
+            for (uint32_t j = 0; j < m; j++)
+            {
+                a[i][j] += x[k][i] * x[k][j];
+            }
+            a[i][m] += x[k][i] * y[k];
+        }
+    }
+    for (uint32_t i = 1; i < m; i++)
+    {
+        a[i][i] += 1e-6 * x.size(); // Ridge (not on the bias): keeps the system solvable with collinear features
+    }
+    for (uint32_t col = 0; col < m; col++)
+    {
+        uint32_t pivot = col;
+        for (uint32_t row = col + 1; row < m; row++)
+        {
+            pivot = (std::abs(a[row][col]) > std::abs(a[pivot][col])) ? row : pivot;
+        }
+        std::swap(a[col], a[pivot]);
+        for (uint32_t row = 0; row < m; row++)
+        {
+            if (row != col && a[col][col] != 0)
+            {
+                double factor = a[row][col] / a[col][col];
+                for (uint32_t j = col; j <= m; j++)
+                {
+                    a[row][j] -= factor * a[col][j];
+                }
+            }
+        }
+    }
+    std::vector<double> coefficients(m);
+    for (uint32_t i = 0; i < m; i++)
+    {
+        coefficients[i] = (a[i][i] != 0) ? a[i][m] / a[i][i] : 0.0;
+    }
+    return coefficients;
+}
+
+static double
+PredictPdr(const std::vector<double>& model, const std::vector<double>& features)
+{
+    return std::clamp(std::inner_product(model.begin(), model.end(), features.begin(), 0.0), 0.0, 1.0);
+}
+
+static double
+PredictDelay(const std::vector<double>& model, const std::vector<double>& features)
+{
+    return std::max(0.0, std::inner_product(model.begin(), model.end(), features.begin(), 0.0));
+}
+
+static int
+RunSurrogateModel(uint32_t calibrationRuns, uint32_t screenCandidates)
+{
+    Ptr<UniformRandomVariable> uniform = CreateObject<UniformRandomVariable>();
+    uniform->SetStream(STREAM_SURROGATE);
+    std::cout << "--- Surrogate model ---\n";
+    std::cout << "Calibration: " << calibrationRuns << " random configurations | " << g_jobs << " parallel runs\n";
+
+    std::vector<SurrogateConfig> configs;
+    std::vector<std::string> argsList;
+    for (uint32_t k = 0; k < calibrationRuns; k++)
+    {
+        configs.push_back(RandomSurrogateConfig(uniform));
+        argsList.push_back(SurrogateArgs(configs.back()));
+    }
+    std::vector<RunSummary> results = RunChildSimulations(argsList);
+
+    // 75 % of the completed runs (shuffled) fit the model, the others are held out. Runs that delivered nothing are
+    // kept (PDR 0 is a valid outcome); only their delay is undefined, so they do not enter the delay model.
+    std::vector<uint32_t> completed;
+    for (uint32_t k = 0; k < results.size(); k++)
+    {
+        if (!results[k].empty())
+        {
+            completed.push_back(k);
+        }
+    }
+    for (uint32_t k = completed.size(); k > 1; k--)
+    {
+        std::swap(completed[k - 1], completed[uniform->GetInteger(0, k - 1)]);
+    }
+    uint32_t numTrain = (completed.size() * 3) / 4;
+    const uint32_t numFeatures = configs[0].features.size();
+    if (numTrain < numFeatures || completed.size() == numTrain)
+    {
+        std::cout << "Only " << completed.size() << " runs completed: not enough to fit and validate "
+                  << numFeatures << " coefficients.\n";
+        return 1;
+    }
+    std::vector<std::vector<double>> x;
+    std::vector<double> pdr;
+    std::vector<std::vector<double>> xDelivered;
+    std::vector<double> delay;
+    for (uint32_t k = 0; k < numTrain; k++)
+    {
+        x.push_back(configs[completed[k]].features);
+        pdr.push_back(results[completed[k]]["pdr"]);
+        if (results[completed[k]]["received"] > 0)
+        {
+            xDelivered.push_back(configs[completed[k]].features);
+            delay.push_back(results[completed[k]]["avgDelay"]);
+        }
+    }
+    if (xDelivered.size() < numFeatures)
+    {
+        std::cout << "Only " << xDelivered.size() << " training runs delivered packets: not enough to fit "
+                  << numFeatures << " delay coefficients.\n";
+        return 1;
+    }
+    std::vector<double> pdrModel = FitLinearModel(x, pdr);
+    std::vector<double> delayModel = FitLinearModel(xDelivered, delay);
+
+    std::cout << "Feature             | PDR coefficient | Avg delay coefficient [s]\n";
+    for (uint32_t i = 0; i < numFeatures; i++)
+    {
+        std::cout << SURROGATE_FEATURE_NAMES[i] << " | " << pdrModel[i] << " | " << delayModel[i] << "\n";
+    }
+
+    // Error on the held-out simulations
+    double pdrAbs = 0, pdrMax = 0, delayAbs = 0, delayMax = 0;
+    uint32_t numDelayHeldOut = 0;
+    for (uint32_t k = numTrain; k < completed.size(); k++)
+    {
+        const auto& features = configs[completed[k]].features;
+        double pdrError = std::abs(PredictPdr(pdrModel, features) - results[completed[k]]["pdr"]);
+        pdrAbs += pdrError;
+        pdrMax = std::max(pdrMax, pdrError);
+        if (results[completed[k]]["received"] > 0)
+        {
+            double delayError = std::abs(PredictDelay(delayModel, features) - results[completed[k]]["avgDelay"]);
+            delayAbs += delayError;
+            delayMax = std::max(delayMax, delayError);
+            numDelayHeldOut++;
+        }
+    }
+    uint32_t numHeldOut = completed.size() - numTrain;
+    std::cout << "Fitted on " << numTrain << " runs, validated on " << numHeldOut << " held-out runs ("
+              << results.size() - completed.size() << " child simulations failed)\n";
+    std::cout << "Held-out error: PDR MAE " << 100 * pdrAbs / numHeldOut << " points (max " << 100 * pdrMax
+              << ") | Avg delay MAE " << (numDelayHeldOut > 0 ? delayAbs / numDelayHeldOut : 0.0) << " s (max "
+              << delayMax << " s, " << numDelayHeldOut << " runs with deliveries)\n";
+
+    // Screening: rank random candidates by the predicted PDR, then by the predicted latency
+    std::vector<SurrogateConfig> candidates;
+    for (uint32_t k = 0; k < screenCandidates; k++)
+    {
+        SurrogateConfig config = RandomSurrogateConfig(uniform);
+        config.features.clear();
+        candidates.push_back(config);
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::tuple<double, double, uint32_t>> ranking; // (-predicted PDR, predicted delay, candidate)
+    for (uint32_t k = 0; k < candidates.size(); k++)
+    {
+        candidates[k].features = SurrogateFeatures(candidates[k]);
+        ranking.push_back({-PredictPdr(pdrModel, candidates[k].features),
+                           PredictDelay(delayModel, candidates[k].features),
+                           k});
+    }
+    double elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    std::sort(ranking.begin(), ranking.end());
+    std::cout << "Screened " << candidates.size() << " candidates in " << elapsedUs / 1000 << " ms ("
+              << (candidates.empty() ? 0.0 : elapsedUs / candidates.size()) << " us per candidate, features included)\n";
+
+    // The most promising candidates run as full simulations to check the predictions
+    argsList.clear();
+    for (uint32_t k = 0; k < ranking.size() && k < g_jobs; k++)
+    {
+        argsList.push_back(SurrogateArgs(candidates[std::get<2>(ranking[k])]));
+    }
+    results = RunChildSimulations(argsList);
+    std::cout << "Best candidates | Nodes | Sources | Interval [s] | Predicted PDR / delay | Simulated PDR / delay\n";
+    for (uint32_t k = 0; k < results.size(); k++)
+    {
+        const SurrogateConfig& config = candidates[std::get<2>(ranking[k])];
+        std::cout << "#" << k + 1 << " | " << config.positions.size() << " | " << config.sources.size() << " | "
+                  << config.interval << " | " << -std::get<0>(ranking[k]) << " / " << std::get<1>(ranking[k]) << " | ";
+        if (results[k].empty())
+        {
+            std::cout << "child simulation failed\n";
+            continue;
+        }
+        std::cout << results[k]["pdr"] << " / " << results[k]["avgDelay"] << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+    return 0;
+}
+
+
+//* Common Random Numbers Comparison
+//* Purpose:
+//* Compares two configurations (argsA vs argsB, e.g. "--interval=0.5" vs "--interval=1") over several replications,
+//* and tells if the difference of PDR and latency is significant.
+//*
+//* How it works:
+//* Every node and traffic source draws from its own fixed block of streams (STREAMS_PER_NODE), so replication r of
+//* both configurations (--rngRun=r) sees the same random numbers wherever the two configurations behave alike.
+//* The paired differences B_r - A_r then have a lower variance than the difference of independent runs, which are
+//* also run (B with --rngRun=R+r) to measure the variance reduction. All the child runs are in parallel.
+static int
+CompareWithCrn(const std::string& argsA, const std::string& argsB, uint32_t replications)
+{
+    std::vector<std::string> argsList;
+    for (uint32_t r = 1; r <= replications; r++)
+    {
+        argsList.push_back(argsA + " --rngRun=" + std::to_string(r));
+        argsList.push_back(argsB + " --rngRun=" + std::to_string(r));
+        argsList.push_back(argsB + " --rngRun=" + std::to_string(replications + r));
+    }
+    std::vector<RunSummary> results = RunChildSimulations(argsList);
+
+    std::cout << "\n--- Common random numbers: [" << argsA << "] vs [" << argsB << "], " << replications
+              << " replications ---\n";
+    std::cout << "Metric | Mean A | Mean B | Paired difference (95% CI) | Independent difference (95% CI) | "
+                 "Variance reduction | Replications needed paired / independent\n";
+    int status = 0;
+    for (const char* metric : {"pdr", "avgDelay"})
+    {
+        std::vector<double> a;
+        std::vector<double> b;
+        std::vector<double> bIndependent;
+        for (uint32_t r = 0; r < replications; r++)
+        {
+            if (results[3 * r].empty() || results[3 * r + 1].empty() || results[3 * r + 2].empty())
+            {
+                continue;
+            }
+            a.push_back(results[3 * r].at(metric));
+            b.push_back(results[3 * r + 1].at(metric));
+            bIndependent.push_back(results[3 * r + 2].at(metric));
+        }
+        const uint32_t n = a.size();
+        if (n < 2)
+        {
+            std::cout << metric << " | not enough successful replications (" << n << ")\n";
+            status = 1;
+            continue;
+        }
+        auto mean = [](const std::vector<double>& v) { return std::accumulate(v.begin(), v.end(), 0.0) / v.size(); };
+        auto variance = [&](const std::vector<double>& v) {
+            double m = mean(v);
+            double sum = 0;
+            for (double x : v)
+            {
+                sum += (x - m) * (x - m);
+            }
+            return sum / (v.size() - 1);
+        };
+        std::vector<double> paired;
+        for (uint32_t r = 0; r < n; r++)
+        {
+            paired.push_back(b[r] - a[r]);
+        }
+        double pairedDiff = mean(paired);
+        double pairedVar = variance(paired);                         // Variance of one paired difference
+        double independentDiff = mean(bIndependent) - mean(a);
+        double independentVar = variance(a) + variance(bIndependent); // Variance of one independent difference
+        double pairedHalf = StudentT975(n - 1) * std::sqrt(pairedVar / n);
+        double independentHalf = StudentT975(2 * n - 2) * std::sqrt(independentVar / n);
+
+        // Replications for the 95% interval to exclude 0 at the observed difference: (1.96 s / d)^2
+        auto needed = [&](double var) {
+            return pairedDiff == 0 ? std::numeric_limits<double>::infinity()
+                                   : std::ceil(1.96 * 1.96 * var / (pairedDiff * pairedDiff));
+        };
+        std::cout << metric << " | " << mean(a) << " | " << mean(b) << " | " << pairedDiff << " +/- " << pairedHalf
+                  << (std::abs(pairedDiff) > pairedHalf ? " (significant)" : "") << " | " << independentDiff << " +/- "
+                  << independentHalf << (std::abs(independentDiff) > independentHalf ? " (significant)" : "") << " | "
+                  << (pairedVar > 0 ? independentVar / pairedVar : std::numeric_limits<double>::infinity()) << "x | "
+                  << needed(pairedVar) << " / " << needed(independentVar) << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+    return status;
+}
+
+
+//* CompareManyToOne Function
+//Purpose: Runs the same collection scenario with per-flow route discovery and with many-to-one routing
+//(two child simulations in parallel) and compares routing table sizes, control overhead and sink throughput.
+static int
+CompareManyToOne()
+{
+    std::vector<std::string> argsList = {"--collection=1 --mtoRouting=0", "--collection=1 --mtoRouting=1"};
+    std::vector<RunSummary> results = RunChildSimulations(argsList);
+
+    std::cout << "\n--- Collection: per-flow route discovery vs many-to-one routing ---\n";
+    std::cout << "Routing      | PDR    | Avg delay [s] | Routing entries avg / max | Control frames | Sink bit/s\n";
+    const char* names[] = {"Per-flow    ", "Many-to-one "};
+    for (uint32_t k = 0; k < results.size(); k++)
+    {
+        if (results[k].empty())
+        {
+            std::cout << names[k] << " | child simulation failed\n";
+            continue;
+        }
+        std::cout << names[k] << " | " << results[k]["pdr"] << " | " << results[k]["avgDelay"] << " | "
+                  << results[k]["routingEntriesAvg"] << " / " << results[k]["routingEntriesMax"] << " | "
+                  << results[k]["controlFrames"] << " | " << results[k]["sinkBps"] << "\n";
+    }
+    std::cout << "---------------------------------------------------\n";
+    return (results[0].empty() || results[1].empty()) ? 1 : 0;
+}
+
+
+//* MAIN Function
+int
+main(int argc, char* argv[])
+{
+//Inialization
+    // Command line options (./ns3 run "Zigbee-sim --help" to list them)
+    double startTime = 12.0;    // Start sending packets
+    double interval = 0.5;      // Interval between packets (seconds)
+    int numPacketsToSend = 200; // Total number of packets to send per source (maximum number with --earlyStop)
+    uint32_t numSources = 1;    // Concurrent sources (sourceStack and the following nodes, see below)
+    uint32_t sourceNode = 2;      // SOURCE NODE: Change here (e.g., 5)
+    uint32_t destinationNode = 8; // DESTINATION NODE: Change here (e.g., 3)
+    uint32_t inspectNode = 4;     // NODE TO INSPECT: Change here (e.g., destinationNode or 2)
+
+    // Topology: the built-in 10 nodes topology, a square grid of gridNodes nodes, or a --topologyFile scenario
+    uint32_t gridNodes = 0;     // Nodes of a generated square grid (0 = built-in 10 nodes topology)
+    double gridSpacing = 50.0;  // Distance between neighbor grid nodes [m]
+    double routerFraction = 1.0; // Fraction of the grid nodes (besides the coordinator) that are routers
+    std::string rolesOverride = "";        // Role of every node, e.g. "zc,zr,zr,zed" (overrides the defaults)
+    std::string topologyFile = "";         // Positions and roles of every node (one "x y role" line per node)
+    std::string routerFractionSweep = "";  // Comma separated router fractions to compare (child runs), e.g. "0.05,0.1,0.2"
+    double joinInterval = 1.0;  // Seconds between the network discoveries of two consecutive nodes
+    bool connectivityCheck = true;         // Check the expected connectivity before running the simulation
+    std::string positionsOverride = "";    // Positions of every node "x:y,x:y,..." (set by the placement optimizer)
+
+    // Router placement optimizer (runs child simulations instead of a single simulation)
+    uint32_t placeRouters = 0;             // Router budget (0 = disabled)
+    std::string placementObjective = "pdr"; // "pdr" (worst flow PDR) or "p99" (p99 latency)
+    uint32_t placementIterations = 20;     // Simulated annealing iterations (g_jobs child runs each)
+    uint32_t placementPackets = 20;        // Packets per source in every child run
+    std::string placementFile = "router-placement.txt"; // Best scenario (--topologyFile format)
+
+    // Sleepy end devices (g_pollInterval, g_pollAwake, g_bufferPersistence)
+    bool sleepyEndDevices = false;         // Every end device is rx-off-when-idle (same as zed:rxoff in --roles)
+
+    // Fault injection (g_fadeTime, g_recoveryWindow, g_recoverySlo)
+    std::string faults = "";               // e.g. "node:3@50+30,link:2-4@60,coord@80" (see ParseFaults)
+    uint32_t randomFaults = 0;             // Random router failures during the traffic
+    double randomFaultDuration = 0;        // Duration of the random failures [s] (0 = permanent)
+
+    // Replications and paired comparisons with common random numbers (runs child simulations)
+    uint32_t rngRun = 4;                   // Run number of the random number generator (replication)
+    std::string crnA = "";                 // Arguments of configuration A, e.g. "--interval=0.5"
+    std::string crnB = "";                 // Arguments of configuration B, e.g. "--interval=1"
+    uint32_t crnReplications = 10;         // Replications of each configuration
+
+    // Surrogate model (runs child simulations instead of a single simulation)
+    uint32_t surrogateRuns = 0;            // Calibration runs (0 = disabled)
+    uint32_t surrogateScreen = 1000;       // Candidates screened with the fitted model
+    uint32_t surrogatePackets = 20;        // Packets per source in every child run
+
+    // Collection traffic (many-to-one): the selected nodes report to the coordinator
+    bool collection = false;
+    std::string collectionSources = "all"; // Comma separated Node IDs, or "all"
+    bool mtoRouting = false;               // The coordinator runs many-to-one route discovery (concentrator)
+    double mtoInterval = 0.0;              // Seconds between many-to-one route discoveries (0 = only once)
+    bool compareMto = false;               // Run the collection with and without MTO routing (child runs) and compare
+
+    // Broadcast traffic: the sources flood the network instead of sending to the destination
+    std::string broadcast = "";            // "all" (FF:FF), "routers" (FF:FC), "rxon" (FF:FD) or empty (unicast)
+    uint32_t broadcastRadius = 0;          // NWK radius of the broadcasts (0 = default, 2 * max depth)
+
+    // Request/response traffic: the destination answers every request (RTT instead of one-way delay)
+    bool respond = false;
+
+    // APS layer: end-to-end acknowledged delivery with retries (g_apsMaxRetries, g_apsAckWait)
+    bool aps = false;
+
+    // In-network aggregation of the collection traffic (g_aggWindow, g_aggMaxReadings)
+    bool aggregation = false;
+    bool compareAggregation = false; // Run the collection with and without aggregation (child runs) and compare
+
+    // Parent selection when joining (g_parentPolicy, g_parentMinSinr)
+    std::string parentPolicySweep = ""; // Comma separated policies to compare (child runs), e.g. "first,lqi,depth,score"
+
+    // Source batching of the readings (g_batchWindow, g_batchMaxReadings)
+    bool batching = false;
+    std::string batchSweep = "";     // Comma separated batch windows [s] to compare (child runs), e.g. "0,0.5,1,2"
+
+    // Saturation throughput finder (runs child simulations instead of a single simulation)
+    bool findCapacity = false;
+    std::string capacitySources = "1,2,4"; // Numbers of concurrent sources to test
+    double capacityMinInterval = 0.02;     // Shortest interval of the search [s]
+    double capacityMaxInterval = 2.0;      // Longest interval of the search [s]
+    double targetPdr = 0.95;               // Minimum PDR
+    double maxP99 = 1.0;                   // Maximum p99 latency [s]
+    uint32_t capacityPackets = 60;         // Packets per source of each probe run
+    uint32_t capacityRounds = 4;           // Search rounds per number of sources
+    uint32_t capacityReplications = 3;     // Run numbers per probe (the probe passes on the mean of its replications)
+
+    // Table snapshots: every snapshotInterval seconds the tables of all nodes are appended (as deltas) to snapshotFile.
+    // Use --snapshotView=<file> to replay a snapshot file instead of running the simulation.
+    double metricsWindow = 0;                           // Seconds per window of the metrics time-series (0 = disabled)
+    std::string metricsFile = "Zigbee-sim-metrics.csv"; // Output file of the metrics time-series
+    double snapshotInterval = 0;                        // Seconds between table snapshots (0 = disabled)
+    std::string snapshotFile = "Zigbee-sim-tables.bin"; // Output file of the table snapshots
+    std::string snapshotView = "";                      // Snapshot file to replay (viewer mode)
+    double snapshotViewTime = -1.0;                     // Time to reconstruct in viewer mode (< 0 = churn timeline)
+    double routeCheckInterval = 1.0;                    // Seconds between route consistency checks (0 = disabled)
+    bool routeOptimality = false;                       // Compare discovered routes with link-cost shortest paths
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("interval", "Interval between packets [s]", interval);
+    cmd.AddValue("numPackets", "Packets to send per source (maximum number with --earlyStop)", numPacketsToSend);
+    cmd.AddValue("numSources", "Number of concurrent sources", numSources);
+    cmd.AddValue("sourceNode", "Node ID of the source", sourceNode);
+    cmd.AddValue("destinationNode", "Node ID of the destination", destinationNode);
+    cmd.AddValue("inspectNode", "Node ID whose tables are printed at the end", inspectNode);
+    cmd.AddValue("gridNodes", "Number of nodes of a generated square grid topology (0 = built-in topology)", gridNodes);
+    cmd.AddValue("routerFraction", "Fraction of the grid nodes (besides the coordinator) that are routers", routerFraction);
+    cmd.AddValue("roles", "Comma separated role of every node: zc, zr or zed (zed:rxoff for rx-off-when-idle)", rolesOverride);
+    cmd.AddValue("topologyFile", "Scenario file, one node per line: x y role", topologyFile);
+    cmd.AddValue("connectivityCheck", "Check the expected connectivity of the topology before the simulation", connectivityCheck);
+    cmd.AddValue("positions", "Positions of every node: x:y,x:y,... (overrides the topology, use with --roles)", positionsOverride);
+    cmd.AddValue("placeRouters", "Search the positions of this many routers for the end devices of the scenario (child runs)", placeRouters);
+    cmd.AddValue("placementObjective", "Objective of the router placement: pdr (worst flow PDR) or p99 (p99 latency)", placementObjective);
+    cmd.AddValue("placementIterations", "Simulated annealing iterations of the router placement", placementIterations);
+    cmd.AddValue("placementPackets", "Packets per source in every child run of the router placement", placementPackets);
+    cmd.AddValue("placementFile", "Output scenario file of the best router placement", placementFile);
+    cmd.AddValue("sleepyEndDevices", "Every end device turns its receiver off when idle and polls its parent", sleepyEndDevices);
+    cmd.AddValue("pollInterval", "Seconds between two polls of a sleepy end device", g_pollInterval);
+    cmd.AddValue("pollAwake", "Seconds the receiver of a sleepy end device stays on after a poll", g_pollAwake);
+    cmd.AddValue("bufferPersistence", "Seconds a frame for a sleepy end device waits in its parent", g_bufferPersistence);
+    cmd.AddValue("faults", "Scheduled faults: node:<id>@<t>[+<d>], link:<a>-<b>@<t>[+<d>], coord@<t>[+<d>] (coordinator outage), comma separated", faults);
+    cmd.AddValue("randomFaults", "Number of random router failures during the traffic", randomFaults);
+    cmd.AddValue("randomFaultDuration", "Duration of the random router failures [s] (0 = permanent)", randomFaultDuration);
+    cmd.AddValue("fadeTime", "Seconds for a failing link to fade out completely", g_fadeTime);
+    cmd.AddValue("recoveryWindow", "Window of the PDR recovery measurement after a fault [s]", g_recoveryWindow);
+    cmd.AddValue("recoverySlo", "Recovery time objective after a fault [s] (0 = none)", g_recoverySlo);
+    cmd.AddValue("rngRun", "Run number of the random number generator (replication)", rngRun);
+    cmd.AddValue("sendJitter", "Random variation of the send times, as a fraction of the interval (0 = periodic)", g_sendJitter);
+    cmd.AddValue("crnA", "Arguments of configuration A of a paired comparison with common random numbers", crnA);
+    cmd.AddValue("crnB", "Arguments of configuration B of a paired comparison with common random numbers", crnB);
+    cmd.AddValue("crnReplications", "Replications of each configuration of the paired comparison", crnReplications);
+    cmd.AddValue("surrogateRuns", "Fit a PDR/latency surrogate model on this many random child runs (0 = disabled)", surrogateRuns);
+    cmd.AddValue("surrogateScreen", "Candidate configurations screened with the surrogate model", surrogateScreen);
+    cmd.AddValue("surrogatePackets", "Packets per source in every child run of the surrogate model", surrogatePackets);
+    cmd.AddValue("rareEventEffort", "Estimate the loss of every flow by multilevel splitting with this many trajectories per level (0 = disabled)", g_rareEventEffort);
+    cmd.AddValue("snrOffset", "SNR shift of every link from the start of the traffic [dB] (negative = degraded channel)", g_snrOffsetDb);
+    cmd.AddValue("rxSensitivity", "Rx sensitivity of every PHY [dBm]", g_rxSensitivityDbm);
+    cmd.AddValue("routerFractionSweep", "Comma separated router fractions to compare on the grid (child runs)", routerFractionSweep);
+    cmd.AddValue("gridSpacing", "Distance between neighbor nodes of the grid [m]", gridSpacing);
+    cmd.AddValue("joinInterval", "Seconds between the network discoveries of two consecutive nodes", joinInterval);
+    cmd.AddValue("collection", "Many-to-one collection traffic: the sources report to the coordinator", collection);
+    cmd.AddValue("collectionSources", "Comma separated Node IDs reporting to the coordinator, or \"all\"", collectionSources);
+    cmd.AddValue("mtoRouting", "The coordinator runs many-to-one route discovery (collection traffic)", mtoRouting);
+    cmd.AddValue("mtoInterval", "Seconds between many-to-one route discoveries (0 = only once)", mtoInterval);
+    cmd.AddValue("compareMto", "Compare the collection with and without many-to-one routing (child runs)", compareMto);
+    cmd.AddValue("broadcast", "Broadcast traffic to \"all\" devices, \"routers\" or \"rxon\" (rx-on-when-idle) devices", broadcast);
+    cmd.AddValue("broadcastRadius", "NWK radius of the broadcasts (0 = default)", broadcastRadius);
+    cmd.AddValue("respond", "The destination replies to every request (round-trip time measurement)", respond);
+    cmd.AddValue("aps", "Send the data over the APS layer with end-to-end acknowledgements and retries", aps);
+    cmd.AddValue("apsMaxRetries", "APS retransmissions of an unacknowledged frame (apsMaxFrameRetries)", g_apsMaxRetries);
+    cmd.AddValue("apsAckWait", "Seconds to wait for an APS ack (apsAckWaitDuration)", g_apsAckWait);
+    cmd.AddValue("aggregation", "Routers merge the readings of their children toward the coordinator (collection traffic)", aggregation);
+    cmd.AddValue("aggWindow", "Aggregation window [s]", g_aggWindow);
+    cmd.AddValue("aggMaxReadings", "Maximum readings in an aggregated frame", g_aggMaxReadings);
+    cmd.AddValue("compareAggregation", "Compare the collection with and without aggregation (child runs)", compareAggregation);
+    cmd.AddValue("batching", "Sources accumulate their readings before sending them in a single frame", batching);
+    cmd.AddValue("batchWindow", "Maximum age of a batch [s]", g_batchWindow);
+    cmd.AddValue("batchMaxReadings", "Maximum readings in a batch", g_batchMaxReadings);
+    cmd.AddValue("batchSweep", "Comma separated batch windows [s] for the goodput vs latency curve (0 = no batching)", batchSweep);
+    cmd.AddValue("parentPolicy", "Parent selection: first (NWK default), lqi, depth or score", g_parentPolicy);
+    cmd.AddValue("parentMinSinr", "Beacon SINR [dB] preferred by the score policy", g_parentMinSinr);
+    cmd.AddValue("parentPolicySweep", "Comma separated parent policies to compare (child runs)", parentPolicySweep);
+    cmd.AddValue("findCapacity", "Search the maximum offered load meeting the PDR / p99 targets (child runs)", findCapacity);
+    cmd.AddValue("capacitySources", "Comma separated numbers of concurrent sources tested by --findCapacity", capacitySources);
+    cmd.AddValue("capacityMinInterval", "Shortest packet interval [s] tested by --findCapacity", capacityMinInterval);
+    cmd.AddValue("capacityMaxInterval", "Longest packet interval [s] tested by --findCapacity", capacityMaxInterval);
+    cmd.AddValue("targetPdr", "Minimum PDR (0..1) of an acceptable load", targetPdr);
+    cmd.AddValue("maxP99", "Maximum p99 latency [s] of an acceptable load", maxP99);
+    cmd.AddValue("capacityPackets", "Packets per source of each --findCapacity probe run", capacityPackets);
+    cmd.AddValue("capacityRounds", "Search rounds per number of sources of --findCapacity", capacityRounds);
+    cmd.AddValue("capacityReplications", "Replications (--rngRun values) of every --findCapacity probe", capacityReplications);
+    cmd.AddValue("jobs", "Child simulations run in parallel by the automated searches", g_jobs);
+    cmd.AddValue("earlyStop", "Stop the traffic once the PDR and latency confidence intervals converge", g_earlyStop);
+    cmd.AddValue("ciRelWidth", "Target relative half-width of the 95% confidence intervals (early stop)", g_ciRelWidth);
+    cmd.AddValue("ciBatchSize", "Packets per batch of the batch means confidence intervals", g_ciBatchSize);
+    cmd.AddValue("ciMinBatches", "Batches required before testing the convergence (early stop)", g_ciMinBatches);
+    cmd.AddValue("metricsWindow", "Seconds per window of the metrics time-series (0 = disabled)", metricsWindow);
+    cmd.AddValue("metricsFile", "CSV file of the metrics time-series", metricsFile);
+    cmd.AddValue("snapshotInterval", "Seconds between table snapshots of all nodes (0 = disabled)", snapshotInterval);
+    cmd.AddValue("snapshotFile", "Binary file where the table snapshots are written", snapshotFile);
+    cmd.AddValue("snapshotView", "Replay this table snapshot file instead of running the simulation", snapshotView);
+    cmd.AddValue("snapshotViewTime", "Time [s] of the tables printed by --snapshotView (< 0 = route churn timeline)", snapshotViewTime);
+    cmd.AddValue("routeCheckInterval", "Seconds between network-wide route consistency checks (0 = disabled)", routeCheckInterval);
+    cmd.AddValue("routeOptimality", "Compare the discovered routes with the link-cost shortest paths at the end", routeOptimality);
+    cmd.AddValue("stopOnCompletion", "End the run as soon as every packet is received, dropped or timed out", g_stopOnCompletion);
+    cmd.AddValue("packetTimeout", "Seconds after which an outstanding packet is considered lost", g_packetTimeout);
+    cmd.Parse(argc, argv);
+    NS_ABORT_MSG_IF(g_ciBatchSize == 0, "--ciBatchSize must be at least 1");
+    NS_ABORT_MSG_IF(numPacketsToSend < 0, "--numPackets must not be negative");
+    NS_ABORT_MSG_IF(g_sendJitter < 0 || g_sendJitter >= 0.5, "--sendJitter must be at least 0 and below 0.5");
+    NS_ABORT_MSG_IF(g_rareEventEffort > 0 && g_snrOffsetDb != 0, "--rareEventEffort sets its own --snrOffset in the validation runs");
+    NS_ABORT_MSG_IF(aps && (g_apsMaxRetries + 1) * g_apsAckWait >= g_packetTimeout,
+                    "--packetTimeout (" << g_packetTimeout << " s) must be longer than the APS retries ((apsMaxRetries + 1) * "
+                                        << "apsAckWait = " << (g_apsMaxRetries + 1) * g_apsAckWait << " s)");
+
+    if (!snapshotView.empty())
+    {
+        return ViewTableSnapshots(snapshotView, snapshotViewTime);
+    }
+
+    if (!broadcast.empty())
+    {
+        std::map<std::string, Mac16Address> broadcastAddrs = {{"all", Mac16Address("FF:FF")},
+                                                              {"routers", Mac16Address("FF:FC")},
+                                                              {"rxon", Mac16Address("FF:FD")}};
+        NS_ABORT_MSG_IF(broadcastAddrs.count(broadcast) == 0, "Unknown --broadcast=" << broadcast << " (all, routers or rxon)");
+        g_broadcastMode = true;
+        g_broadcastAddr = broadcastAddrs[broadcast];
+        g_broadcastRadius = std::min(broadcastRadius, 255u);
+    }
+
+    NS_ABORT_MSG_IF(respond && g_broadcastMode, "--respond cannot be used with broadcast traffic");
+    g_respond = respond;
+    NS_ABORT_MSG_IF(aps && (respond || g_broadcastMode), "--aps only applies to unicast requests without --respond");
+    g_aps = aps;
+    NS_ABORT_MSG_IF(aggregation && !collection, "--aggregation requires --collection=1");
+    NS_ABORT_MSG_IF(aggregation && (aps || respond || g_broadcastMode), "--aggregation cannot be combined with --aps, --respond or --broadcast");
+    NS_ABORT_MSG_IF(g_aggMaxReadings == 0, "--aggMaxReadings must be at least 1");
+    NS_ABORT_MSG_IF(g_aggMaxReadings * READING_BYTES > MAX_NSDU_BYTES,
+                    "--aggMaxReadings must be at most " << MAX_NSDU_BYTES / READING_BYTES << " (one NSDU of "
+                                                        << MAX_NSDU_BYTES << " bytes)");
+    g_aggregation = aggregation;
+    NS_ABORT_MSG_IF(batching && (aps || respond || g_broadcastMode), "--batching cannot be combined with --aps, --respond or --broadcast");
+    NS_ABORT_MSG_IF(g_batchMaxReadings == 0, "--batchMaxReadings must be at least 1");
+    NS_ABORT_MSG_IF(g_batchMaxReadings * READING_BYTES > MAX_NSDU_BYTES,
+                    "--batchMaxReadings must be at most " << MAX_NSDU_BYTES / READING_BYTES << " (one NSDU of "
+                                                          << MAX_NSDU_BYTES << " bytes)");
+    g_batching = batching;
+
+    NS_ABORT_MSG_IF(routerFraction < 0 || routerFraction > 1, "--routerFraction must be between 0 and 1");
+    NS_ABORT_MSG_IF(g_parentPolicy != "first" && g_parentPolicy != "lqi" && g_parentPolicy != "depth" &&
+                        g_parentPolicy != "score",
+                    "Unknown --parentPolicy=" << g_parentPolicy << " (first, lqi, depth or score)");
+
+    if (!parentPolicySweep.empty())
+    {
+        std::vector<std::string> policies;
+        std::istringstream list(parentPolicySweep);
+        std::string policy;
+        while (std::getline(list, policy, ','))
+        {
+            policies.push_back(policy);
+        }
+        g_jobs = std::max(1u, g_jobs);
+        SetChildCommand(argc, argv, {"parentPolicy", "jobs"});
+        return SweepParentPolicy(policies);
+    }
+
+    if (!routerFractionSweep.empty())
+    {
+        NS_ABORT_MSG_IF(gridNodes == 0 || !topologyFile.empty() || !rolesOverride.empty(),
+                        "--routerFractionSweep requires --gridNodes without --roles or --topologyFile");
+        std::vector<double> fractions;
+        std::istringstream list(routerFractionSweep);
+        std::string fraction;
+        while (std::getline(list, fraction, ','))
+        {
+            fractions.push_back(std::stod(fraction));
+        }
+        g_jobs = std::max(1u, g_jobs);
+        SetChildCommand(argc, argv, {"routerFraction", "jobs"});
+        return SweepRouterFraction(fractions);
+    }
+
+    if (!batchSweep.empty())
+    {
+        std::vector<double> windows;
+        std::istringstream list(batchSweep);
+        std::string window;
+        while (std::getline(list, window, ','))
+        {
+            windows.push_back(std::stod(window));
+        }
+        g_jobs = std::max(1u, g_jobs);
+        SetChildCommand(argc, argv, {"batchSweep", "batching", "batchWindow", "packetTimeout", "jobs"});
+        return SweepBatchWindow(windows);
+    }
+
+    if (compareAggregation)
+    {
+        g_jobs = std::max(1u, g_jobs);
+        SetChildCommand(argc, argv, {"compareAggregation", "aggregation", "collection=", "jobs"});
+        return CompareAggregation();
+    }
+
+    if (compareMto)
+    {
+        g_jobs = std::max(1u, g_jobs);
+        SetChildCommand(argc, argv, {"compareMto", "mtoRouting", "collection=", "jobs"});
+        return CompareManyToOne();
+    }
 
-    Simulator::ScheduleNow(&ZigbeeNwk::NldeDataRequest, stackSrc->GetNwk(), dataReqParams, p);
-}
+    if (!crnA.empty() || !crnB.empty())
+    {
+        NS_ABORT_MSG_IF(crnReplications < 2, "--crnReplications must be at least 2");
+        g_jobs = std::max(1u, g_jobs);
+        SetChildCommand(argc, argv, {"crn", "rngRun", "jobs"});
+        return CompareWithCrn(crnA, crnB, crnReplications);
+    }
 
+    if (surrogateRuns > 0)
+    {
+        g_jobs = std::max(1u, g_jobs);
+        g_propModel = CreateObject<LogDistancePropagationLossModel>(); // Same model as the channel (see below)
+        SetChildCommand(argc, argv, {"surrogate", "placeRouters", "positions", "roles", "topologyFile", "gridNodes",
+                                     "routerFraction", "collection", "sourceNode", "destinationNode", "inspectNode",
+                                     "numPackets", "numSources", "interval", "jobs"});
+        g_childCommand += " --numPackets=" + std::to_string(surrogatePackets);
+        return RunSurrogateModel(surrogateRuns, surrogateScreen);
+    }
+
+    if (findCapacity)
+    {
+        std::vector<uint32_t> sourceCounts;
+        std::istringstream list(capacitySources);
+        std::string count;
+        while (std::getline(list, count, ','))
+        {
+            sourceCounts.push_back(std::stoul(count));
+        }
+        g_jobs = std::max(1u, g_jobs);
+        NS_ABORT_MSG_IF(capacityReplications == 0, "--capacityReplications must be at least 1");
+        SetChildCommand(argc, argv, {"findCapacity", "capacity", "numSources", "interval", "numPackets", "rngRun", "jobs"});
+        return FindCapacity(sourceCounts, capacityMinInterval, capacityMaxInterval, targetPdr, maxP99, capacityPackets,
+                            capacityRounds, capacityReplications, rngRun);
+    }
 
-//* MAIN Function
-int
-main(int argc, char* argv[])
-{
-//Inialization
    LogComponentEnableAll(LogLevel(LOG_PREFIX_TIME | LOG_PREFIX_FUNC | LOG_PREFIX_NODE));
    //Enables logging for all components with time, function, and node prefixes.
    //LogComponentEnable("ZigbeeNwk", LOG_LEVEL_DEBUG);
 
     RngSeedManager::SetSeed(3);
-    RngSeedManager::SetRun(4);
-    //Set the seed and run number for the random number generator.
+    RngSeedManager::SetRun(rngRun);
+    //Set the seed and run number (replication, --rngRun) for the random number generator.
+
+    // Built-in topology (see the figure at the top of this file), a generated grid with --gridNodes,
+    // or the positions and roles of --topologyFile
+    std::vector<Vector> positions = {Vector(0, 0, 0),      // N0 (ZC)
+                                     Vector(100, 50, 0),   // N1 (ZR)
+                                     Vector(-75, 50, 0),   // N2 (ZR)
+                                     Vector(0, -100, 0),   // N3 (ZR)
+                                     Vector(-100, -50, 0), // N4 (ZR)
+                                     Vector(100, 100, 0),  // N5 (ZED)
+                                     Vector(150, 50, 0),   // N6 (ZED)
+                                     Vector(150, 0, 0),    // N7 (ZED)
+                                     Vector(-150, -100, 0),// N8 (ZED)
+                                     Vector(-50, -100, 0)};// N9 (ZED)
+    std::string roles = "zc,zr,zr,zr,zr,zed,zed,zed,zed,zed";
+    if (!topologyFile.empty())
+    {
+        // One node per line: "x y role [#comment]" (Node 0 is the coordinator)
+        std::ifstream file(topologyFile);
+        NS_ABORT_MSG_IF(!file, "Unable to open --topologyFile=" << topologyFile);
+        positions.clear();
+        g_roles.clear();
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line.substr(0, line.find('#')));
+            double x;
+            double y;
+            std::string role;
+            if (!(fields >> x >> y >> role))
+            {
+                continue; // Empty line or comment
+            }
+            NodeConfig config;
+            NS_ABORT_MSG_IF(!ParseNodeConfig(role, config), "Invalid role \"" << role << "\" in " << topologyFile);
+            positions.push_back(Vector(x, y, 0));
+            g_roles.push_back(config);
+        }
+    }
+    else if (gridNodes > 0)
+    {
+        // Square grid, row by row, with the coordinator in the corner: every node has a neighbor with a lower ID,
+        // which has already joined when it starts its discovery.
+        uint32_t side = std::ceil(std::sqrt(static_cast<double>(gridNodes)));
+        positions.clear();
+        for (uint32_t i = 0; i < gridNodes; i++)
+        {
+            positions.push_back(Vector((i % side) * gridSpacing, (i / side) * gridSpacing, 0));
+        }
+        // Routers evenly spread over the node IDs: round(routerFraction * (N - 1)) routers
+        roles = "zc";
+        for (uint32_t i = 1; i < gridNodes; i++)
+        {
+            bool router = std::floor(i * routerFraction) != std::floor((i - 1) * routerFraction);
+            roles += router ? ",zr" : ",zed";
+        }
+    }
+    if (!positionsOverride.empty())
+    {
+        positions.clear();
+        std::istringstream list(positionsOverride);
+        std::string position;
+        while (std::getline(list, position, ','))
+        {
+            size_t colon = position.find(':');
+            NS_ABORT_MSG_IF(colon == std::string::npos, "Invalid position \"" << position << "\" in --positions");
+            positions.push_back(Vector(std::stod(position.substr(0, colon)), std::stod(position.substr(colon + 1)), 0));
+        }
+    }
+    const uint32_t numNodes = positions.size();
+
+    // Role table: --roles overrides the roles of the built-in topology or of the grid
+    if (topologyFile.empty())
+    {
+        std::istringstream list(rolesOverride.empty() ? roles : rolesOverride);
+        std::string role;
+        g_roles.clear();
+        while (std::getline(list, role, ','))
+        {
+            NodeConfig config;
+            NS_ABORT_MSG_IF(!ParseNodeConfig(role, config), "Invalid role \"" << role << "\" in --roles");
+            g_roles.push_back(config);
+        }
+    }
+    NS_ABORT_MSG_IF(g_roles.size() != numNodes,
+                    "The scenario has " << numNodes << " nodes but " << g_roles.size() << " roles");
+    NS_ABORT_MSG_IF(numNodes < 2 || g_roles[0].role != ROLE_COORDINATOR ||
+                        std::count_if(g_roles.begin(), g_roles.end(),
+                                      [](const NodeConfig& c) { return c.role == ROLE_COORDINATOR; }) != 1,
+                    "Node 0 must be the only coordinator");
+    for (auto& config : g_roles)
+    {
+        config.rxOnWhenIdle = config.rxOnWhenIdle && !(sleepyEndDevices && config.role == ROLE_END_DEVICE);
+    }
+    bool anySleepy = std::any_of(g_roles.begin(), g_roles.end(), [](const NodeConfig& c) { return !c.rxOnWhenIdle; });
+    NS_ABORT_MSG_IF(anySleepy && (g_aps || g_respond || g_broadcastMode || g_aggregation || g_batching),
+                    "Sleepy end devices cannot be combined with --aps, --respond, --broadcast, --aggregation or --batching");
+    if (anySleepy && g_bufferPersistence >= g_packetTimeout)
+    {
+        // A buffered frame must expire (and be counted as such) before its packet times out
+        std::cout << "WARN: --bufferPersistence=" << g_bufferPersistence << " s is not shorter than --packetTimeout="
+                  << g_packetTimeout << " s, clamped to " << g_packetTimeout / 2
+                  << " s (raise --packetTimeout to keep it).\n";
+        g_bufferPersistence = g_packetTimeout / 2;
+    }
+    uint32_t numRouters = std::count_if(g_roles.begin(), g_roles.end(),
+                                        [](const NodeConfig& c) { return c.role == ROLE_ROUTER; });
+    std::cout << "INFO: " << numNodes << " nodes: 1 coordinator, " << numRouters << " routers, "
+              << numNodes - 1 - numRouters << " end devices\n";
+
+    if (placeRouters > 0)
+    {
+        NS_ABORT_MSG_IF(placementObjective != "pdr" && placementObjective != "p99",
+                        "Unknown --placementObjective=" << placementObjective << " (pdr or p99)");
+        g_jobs = std::max(1u, g_jobs);
+        g_propModel = CreateObject<LogDistancePropagationLossModel>(); // Same model as the channel (see below)
+        SetChildCommand(argc, argv, {"placeRouters", "placement", "positions", "roles", "topologyFile", "gridNodes",
+                                     "routerFraction", "collection", "sourceNode", "destinationNode", "inspectNode",
+                                     "numPackets", "jobs"});
+        g_childCommand += " --numPackets=" + std::to_string(placementPackets);
+        return OptimizeRouterPlacement(positions, placeRouters, placementObjective, placementIterations, placementFile);
+    }
 
     NodeContainer nodes;
-    nodes.Create(10);
-    //Create a container to hold the 10 nodes.
+    nodes.Create(numNodes);
+    //Create a container to hold the nodes.
 
 //MAC Configuration
     LrWpanHelper lrWpanHelper; //Creates a helper for LR-WPAN (802.15.4) devices
     
     //Installs LR-WPAN devices on the nodes
     NetDeviceContainer lrwpanDevices = lrWpanHelper.Install(nodes);
-    Ptr<LrWpanNetDevice> dev0 = lrwpanDevices.Get(0)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev1 = lrwpanDevices.Get(1)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev2 = lrwpanDevices.Get(2)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev3 = lrwpanDevices.Get(3)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev4 = lrwpanDevices.Get(4)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev5 = lrwpanDevices.Get(5)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev6 = lrwpanDevices.Get(6)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev7 = lrwpanDevices.Get(7)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev8 = lrwpanDevices.Get(8)->GetObject<LrWpanNetDevice>();
-    Ptr<LrWpanNetDevice> dev9 = lrwpanDevices.Get(9)->GetObject<LrWpanNetDevice>();
+    std::vector<Ptr<LrWpanNetDevice>> devs;
+    for (uint32_t i = 0; i < numNodes; i++)
+    {
+        devs.push_back(lrwpanDevices.Get(i)->GetObject<LrWpanNetDevice>());
+    }
 
     //Each device must ALWAYS have unique 64-bit IEEE Address (Extended address) assigned.
     //Network address (short address) are assigned by the the JOIN mechanism
-    dev0->GetMac()->SetExtendedAddress("00:00:00:00:00:00:CA:FE");
-    dev1->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:01");
-    dev2->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:02");
-    dev3->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:03");
-    dev4->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:04");
-    dev5->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:05");
-    dev6->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:06");
-    dev7->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:07");
-    dev8->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:08");
-    dev9->GetMac()->SetExtendedAddress("00:00:00:00:00:00:00:09");
+    devs[0]->GetMac()->SetExtendedAddress("00:00:00:00:00:00:CA:FE");
+    for (uint32_t i = 1; i < numNodes; i++)
+    {
+        char extAddr[24];
+        std::snprintf(extAddr, sizeof(extAddr), "00:00:00:00:00:00:%02X:%02X", (i >> 8) & 0xFF, i & 0xFF);
+        devs[i]->GetMac()->SetExtendedAddress(Mac64Address(extAddr));
+    }
 
     //creates a wireless channel for the devices
     Ptr<SingleModelSpectrumChannel> channel = CreateObject<SingleModelSpectrumChannel>();
@@ -545,170 +6668,141 @@ main(int argc, char* argv[])
         CreateObject<ConstantSpeedPropagationDelayModel>();
 
     channel->AddPropagationLossModel(propModel);    //Adds the propagation loss model to the channel
+    if (!faults.empty() || randomFaults > 0 || g_snrOffsetDb != 0)
+    {
+        propModel->SetNext(CreateObject<FaultLossModel>()); //Failed nodes, fading links and SNR offset (fault injection)
+    }
+    g_propModel = propModel;                        //Keep it for the analyses based on the physical topology
     channel->SetPropagationDelayModel(delayModel);  //Sets the propagation delay model for the channel
 
     //Assigns the channel to each device
-    dev0->SetChannel(channel);
-    dev1->SetChannel(channel);
-    dev2->SetChannel(channel);
-    dev3->SetChannel(channel);
-    dev4->SetChannel(channel);
-    dev5->SetChannel(channel);
-    dev6->SetChannel(channel);
-    dev7->SetChannel(channel);
-    dev8->SetChannel(channel);
-    dev9->SetChannel(channel);
+    for (const auto& dev : devs)
+    {
+        dev->SetChannel(channel);
+    }
 
 //NWK Configuration
     ZigbeeHelper zigbee; //Creates a helper for Zigbee devices
     
     //Installs the Zigbee stack on all devices
     ZigbeeStackContainer zigbeeStackContainer = zigbee.Install(lrwpanDevices);
-    Ptr<ZigbeeStack> zstack0 = zigbeeStackContainer.Get(0)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack1 = zigbeeStackContainer.Get(1)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack2 = zigbeeStackContainer.Get(2)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack3 = zigbeeStackContainer.Get(3)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack4 = zigbeeStackContainer.Get(4)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack5 = zigbeeStackContainer.Get(5)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack6 = zigbeeStackContainer.Get(6)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack7 = zigbeeStackContainer.Get(7)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack8 = zigbeeStackContainer.Get(8)->GetObject<ZigbeeStack>();
-    Ptr<ZigbeeStack> zstack9 = zigbeeStackContainer.Get(9)->GetObject<ZigbeeStack>();
-
-    // Add the stacks to a container to later on print routes.
-    zigbeeStacks.Add(zstack0);
-    zigbeeStacks.Add(zstack1);
-    zigbeeStacks.Add(zstack2);
-    zigbeeStacks.Add(zstack3);
-    zigbeeStacks.Add(zstack4);
-    zigbeeStacks.Add(zstack5);
-    zigbeeStacks.Add(zstack6);
-    zigbeeStacks.Add(zstack7);
-    zigbeeStacks.Add(zstack8);
-    zigbeeStacks.Add(zstack9);
-
-    // Assign streams to the zigbee stacks to obtain
-    // reprodusable results from random events occurring inside the stack.
-    zstack0->GetNwk()->AssignStreams(0);
-    zstack1->GetNwk()->AssignStreams(10);
-    zstack2->GetNwk()->AssignStreams(20);
-    zstack3->GetNwk()->AssignStreams(30);
-    zstack4->GetNwk()->AssignStreams(40);
-    zstack5->GetNwk()->AssignStreams(50); 
-    zstack6->GetNwk()->AssignStreams(60); 
-    zstack7->GetNwk()->AssignStreams(70); 
-    zstack8->GetNwk()->AssignStreams(80); 
-    zstack9->GetNwk()->AssignStreams(90); 
+    for (uint32_t i = 0; i < numNodes; i++)
+    {
+        // Add the stacks to a container to later on print routes.
+        Ptr<ZigbeeStack> zstack = zigbeeStackContainer.Get(i)->GetObject<ZigbeeStack>();
+        zigbeeStacks.Add(zstack);
+
+        // Assign streams to the devices, the zigbee stacks and the traffic source of the node (fixed block per
+        // Node ID) to obtain reprodusable results, and common random numbers between configurations.
+        int64_t streamBlock = static_cast<int64_t>(nodes.Get(i)->GetId()) * STREAMS_PER_NODE;
+        devs[i]->AssignStreams(streamBlock + STREAM_OFFSET_DEVICE);
+        zstack->GetNwk()->AssignStreams(streamBlock + STREAM_OFFSET_NWK);
+        g_trafficRng.push_back(CreateObject<UniformRandomVariable>());
+        g_trafficRng.back()->SetStream(streamBlock + STREAM_OFFSET_TRAFFIC);
+    }
+    Ptr<ZigbeeStack> zstack0 = zigbeeStacks.Get(0); // Coordinator
     
 //Mobility configuration
     MobilityHelper mobility;
     mobility.SetMobilityModel("ns3::ConstantPositionMobilityModel"); // Set the type of model to install
     mobility.Install(nodes); // Install the model on ALL nodes in the container
 
-    //get the installed mobility model for each node and set its specific position
-    Ptr<ConstantPositionMobilityModel> mob0 = nodes.Get(0)->GetObject<ConstantPositionMobilityModel>();
-    mob0->SetPosition(Vector(0, 0, 0));
-
-    Ptr<ConstantPositionMobilityModel> mob1 = nodes.Get(1)->GetObject<ConstantPositionMobilityModel>();
-    mob1->SetPosition(Vector(100, 50, 0));
-
-    Ptr<ConstantPositionMobilityModel> mob2 = nodes.Get(2)->GetObject<ConstantPositionMobilityModel>();
-    mob2->SetPosition(Vector(-75, 50, 0));
-
-    Ptr<ConstantPositionMobilityModel> mob3 = nodes.Get(3)->GetObject<ConstantPositionMobilityModel>();
-    mob3->SetPosition(Vector(0, -100, 0));
-
-    Ptr<ConstantPositionMobilityModel> mob4 = nodes.Get(4)->GetObject<ConstantPositionMobilityModel>();
-    mob4->SetPosition(Vector(-100, -50, 0));
-
-    Ptr<ConstantPositionMobilityModel> mob5 = nodes.Get(5)->GetObject<ConstantPositionMobilityModel>();
-    mob5->SetPosition(Vector(100, 100, 0));
-
-    Ptr<ConstantPositionMobilityModel> mob6 = nodes.Get(6)->GetObject<ConstantPositionMobilityModel>();
-    mob6->SetPosition(Vector(150, 50, 0));
+    for (uint32_t i = 0; i < numNodes; i++)
+    {
+        //get the installed mobility model for each node and set its specific position
+        Ptr<ConstantPositionMobilityModel> mob = nodes.Get(i)->GetObject<ConstantPositionMobilityModel>();
+        mob->SetPosition(positions[i]);
+        //link the node's mobility model to the PHY layer of the LR-WPAN device
+        devs[i]->GetPhy()->SetMobility(mob);
+        if (g_rxSensitivityDbm != LINK_RX_SENSITIVITY_DBM)
+        {
+            devs[i]->GetPhy()->SetRxSensitivity(g_rxSensitivityDbm);
+        }
+    }
 
-    Ptr<ConstantPositionMobilityModel> mob7 = nodes.Get(7)->GetObject<ConstantPositionMobilityModel>();
-    mob7->SetPosition(Vector(150, 0, 0));
+    // Reject a broken topology before running it (no path from a node to the coordinator)
+    if (connectivityCheck && !CheckConnectivity(positions))
+    {
+        std::cout << "ERROR: Some nodes cannot reach the coordinator, simulation not started "
+                  << "(--connectivityCheck=0 to run it anyway)\n";
+        return 1;
+    }
 
-    Ptr<ConstantPositionMobilityModel> mob8 = nodes.Get(8)->GetObject<ConstantPositionMobilityModel>();
-    mob8->SetPosition(Vector(-150, -100, 0));
+    //record the real path of the tracked packets: every MAC appends its node when it receives one
+    for (uint32_t i = 0; i < lrwpanDevices.GetN(); i++)
+    {
+        Ptr<LrWpanNetDevice> dev = lrwpanDevices.Get(i)->GetObject<LrWpanNetDevice>();
+        dev->GetMac()->TraceConnectWithoutContext("MacRx",
+                                                  MakeBoundCallback(&PathMacRx, static_cast<uint16_t>(nodes.Get(i)->GetId())));
+    }
 
-    Ptr<ConstantPositionMobilityModel> mob9 = nodes.Get(9)->GetObject<ConstantPositionMobilityModel>();
-    mob9->SetPosition(Vector(-50, -100, 0));
+    //airtime accounting from the PHY traces of every node
+    g_airtime.resize(nodes.GetN());
+    for (uint32_t i = 0; i < lrwpanDevices.GetN(); i++)
+    {
+        Ptr<LrWpanNetDevice> dev = lrwpanDevices.Get(i)->GetObject<LrWpanNetDevice>();
+        uint16_t nodeId = nodes.Get(i)->GetId();
+        dev->GetPhy()->TraceConnectWithoutContext("TrxState", MakeBoundCallback(&AirtimeTrxState, nodeId));
+        dev->GetPhy()->TraceConnectWithoutContext("PhyTxBegin", MakeBoundCallback(&AirtimePhyTxBegin, nodeId));
+        if (g_parentPolicy != "first")
+        {
+            //beacons of the potential parents (parent selection)
+            dev->GetPhy()->TraceConnectWithoutContext("PhyRxEnd", MakeBoundCallback(&ParentBeaconRxEnd, nodeId));
+        }
+        if (g_aps)
+        {
+            //airtime of the APS retransmissions and acks
+            dev->GetPhy()->TraceConnectWithoutContext("PhyTxBegin", MakeCallback(&ApsPhyTxBegin));
+        }
+        if (g_respond)
+        {
+            //reverse path of the replies
+            dev->GetMac()->TraceConnectWithoutContext("MacRx", MakeBoundCallback(&ReplyMacRx, nodeId));
+        }
+        if (anySleepy)
+        {
+            //airtime of the polls of the sleepy end devices
+            dev->GetPhy()->TraceConnectWithoutContext("PhyTxBegin", MakeCallback(&PollPhyTxBegin));
+        }
+        if (g_broadcastMode)
+        {
+            //coverage and rebroadcasts of the broadcast traffic
+            dev->GetMac()->TraceConnectWithoutContext("MacRx", MakeBoundCallback(&BroadcastMacRx, nodeId));
+            dev->GetPhy()->TraceConnectWithoutContext("PhyTxBegin", MakeBoundCallback(&BroadcastPhyTxBegin, nodeId));
+        }
+    }
 
-    //link the node's mobility model to the PHY layer of the LR-WPAN device
-    dev0->GetPhy()->SetMobility(mob0);
-    dev1->GetPhy()->SetMobility(mob1);
-    dev2->GetPhy()->SetMobility(mob2);
-    dev3->GetPhy()->SetMobility(mob3);
-    dev4->GetPhy()->SetMobility(mob4);
-    dev5->GetPhy()->SetMobility(mob5);
-    dev6->GetPhy()->SetMobility(mob6);
-    dev7->GetPhy()->SetMobility(mob7);
-    dev8->GetPhy()->SetMobility(mob8);
-    dev9->GetPhy()->SetMobility(mob9);
+    // The coordinator is the root of the tree
+    g_nodeDepth[zstack0->GetNode()->GetId()] = 0;
 
+    // Rows of the header of an empty routing table (to count the routing table entries at the end)
+    g_routingTableHeaderRows = CaptureTableRows(zstack0->GetNwk(), SNAPSHOT_ROUTING_TABLE).size();
 
 
 //NWK callbacks hooks
     // These hooks are usually directly connected to the APS layer
     // In this case, there is no APS layer, therefore, we connect the event outputs
     // of all devices directly to our static functions in this example.
+    // (With --aps, a minimal APS layer with acks and retries runs inside SendData and NwkDataIndication.)
 
     zstack0->GetNwk()->SetNlmeNetworkFormationConfirmCallback(
         MakeBoundCallback(&NwkNetworkFormationConfirm, zstack0));
     zstack0->GetNwk()->SetNlmeRouteDiscoveryConfirmCallback(
         MakeBoundCallback(&NwkRouteDiscoveryConfirm, zstack0));
 
-    zstack0->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack0));
-    zstack1->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack1));
-    zstack2->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack2));
-    zstack3->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack3));
-    zstack4->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack4));
-    zstack5->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack5));
-    zstack6->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack6));
-    zstack7->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack7));
-    zstack8->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack8));
-    zstack9->GetNwk()->SetNldeDataIndicationCallback(
-        MakeBoundCallback(&NwkDataIndication, zstack9));
-
-    zstack1->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack1));
-    zstack2->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack2));
-    zstack3->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack3));
-    zstack4->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack4));
-    zstack5->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack5));
-    zstack6->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack6));
-    zstack7->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack7));
-    zstack8->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack8));
-    zstack9->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
-        MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack9));
-
-    zstack1->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack1));
-    zstack2->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack2));
-    zstack3->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack3));
-    zstack4->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack4));
-    zstack5->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack5));
-    zstack6->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack6));
-    zstack7->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack7));
-    zstack8->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack8));
-    zstack9->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack9));
+    for (auto i = zigbeeStacks.Begin(); i != zigbeeStacks.End(); i++)
+    {
+        Ptr<ZigbeeStack> zstack = *i;
+        zstack->GetNwk()->SetNldeDataConfirmCallback(MakeBoundCallback(&NwkDataConfirm, zstack));
+        zstack->GetNwk()->SetNldeDataIndicationCallback(MakeBoundCallback(&NwkDataIndication, zstack));
+        zstack->GetNwk()->SetNlmeDirectJoinConfirmCallback(MakeBoundCallback(&NwkDirectJoinConfirm, zstack));
+        if (zstack != zstack0)
+        {
+            zstack->GetNwk()->SetNlmeNetworkDiscoveryConfirmCallback(
+                MakeBoundCallback(&NwkNetworkDiscoveryConfirm, zstack));
+            zstack->GetNwk()->SetNlmeJoinConfirmCallback(MakeBoundCallback(&NwkJoinConfirm, zstack));
+        }
+    }
 
 //Network Formation
     // 1 - Initiate the Zigbee coordinator, start the network
@@ -728,108 +6822,84 @@ main(int argc, char* argv[])
                                    netFormParams);
 
 //Network Discovery and Joining
-    // 2- Schedule devices sequentially find and join the network.
-    //    After this procedure, each device make a NLME-START-ROUTER.request to become a router
-
-    NlmeNetworkDiscoveryRequestParams netDiscParams;
-    netDiscParams.m_scanChannelList.channelPageCount = 1;
-    netDiscParams.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams.m_scanDuration = 2;
-    //Schedules the network discovery request for each router, with increasing delays
-    Simulator::ScheduleWithContext(zstack1->GetNode()->GetId(),
-                                   Seconds(3),
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack1->GetNwk(),
-                                   netDiscParams);
-
-    NlmeNetworkDiscoveryRequestParams netDiscParams2;
-    netDiscParams2.m_scanChannelList.channelPageCount = 1;
-    netDiscParams2.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams2.m_scanDuration = 2;
-    Simulator::ScheduleWithContext(zstack2->GetNode()->GetId(),
-                                   Seconds(4),
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack2->GetNwk(),
-                                   netDiscParams2);
-
-    NlmeNetworkDiscoveryRequestParams netDiscParams3;
-    netDiscParams3.m_scanChannelList.channelPageCount = 1;
-    netDiscParams3.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams3.m_scanDuration = 2;
-    Simulator::ScheduleWithContext(zstack3->GetNode()->GetId(),
-                                   Seconds(5),
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack3->GetNwk(),
-                                   netDiscParams3);
-
-    NlmeNetworkDiscoveryRequestParams netDiscParams4;
-    netDiscParams4.m_scanChannelList.channelPageCount = 1;
-    netDiscParams4.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams4.m_scanDuration = 2;
-    Simulator::ScheduleWithContext(zstack4->GetNode()->GetId(),
-                                   Seconds(6),
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack4->GetNwk(),
-                                   netDiscParams4);
-    // End devices
-    NlmeNetworkDiscoveryRequestParams netDiscParams5;
-    netDiscParams5.m_scanChannelList.channelPageCount = 1;
-    netDiscParams5.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams5.m_scanDuration = 2;
-    Simulator::ScheduleWithContext(zstack5->GetNode()->GetId(),
-                                   Seconds(7), // Continue staggering
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack5->GetNwk(),
-                                   netDiscParams5);
-
-    NlmeNetworkDiscoveryRequestParams netDiscParams6;
-    netDiscParams6.m_scanChannelList.channelPageCount = 1;
-    netDiscParams6.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams6.m_scanDuration = 2;
-    Simulator::ScheduleWithContext(zstack6->GetNode()->GetId(),
-                                   Seconds(8),
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack6->GetNwk(),
-                                   netDiscParams6);
-
-    NlmeNetworkDiscoveryRequestParams netDiscParams7;
-    netDiscParams7.m_scanChannelList.channelPageCount = 1;
-    netDiscParams7.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams7.m_scanDuration = 2;
-    Simulator::ScheduleWithContext(zstack7->GetNode()->GetId(),
-                                   Seconds(9),
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack7->GetNwk(),
-                                   netDiscParams7);
-
-    NlmeNetworkDiscoveryRequestParams netDiscParams8;
-    netDiscParams8.m_scanChannelList.channelPageCount = 1;
-    netDiscParams8.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams8.m_scanDuration = 2;
-    Simulator::ScheduleWithContext(zstack8->GetNode()->GetId(),
-                                   Seconds(10),
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack8->GetNwk(),
-                                   netDiscParams8);
-
-    NlmeNetworkDiscoveryRequestParams netDiscParams9;
-    netDiscParams9.m_scanChannelList.channelPageCount = 1;
-    netDiscParams9.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
-    netDiscParams9.m_scanDuration = 2;
-    Simulator::ScheduleWithContext(zstack9->GetNode()->GetId(),
-                                   Seconds(11),
-                                   &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
-                                   zstack9->GetNwk(),
-                                   netDiscParams9);
+    // 2- Schedule devices sequentially find and join the network, routers first then end devices, in ID order
+    //    (the k-th device starts at 2 + k * joinInterval seconds).
+    //    After this procedure, each router make a NLME-START-ROUTER.request to become a router
+    std::vector<uint32_t> joinOrder;
+    for (NodeRole role : {ROLE_ROUTER, ROLE_END_DEVICE})
+    {
+        for (uint32_t i = 1; i < numNodes; i++)
+        {
+            if (g_roles[i].role == role)
+            {
+                joinOrder.push_back(i);
+            }
+        }
+    }
+    for (uint32_t k = 0; k < joinOrder.size(); k++)
+    {
+        uint32_t i = joinOrder[k];
+        NlmeNetworkDiscoveryRequestParams netDiscParams;
+        netDiscParams.m_scanChannelList.channelPageCount = 1;
+        netDiscParams.m_scanChannelList.channelsField[0] = 0x00007800; // BitMap: Channels 11~14
+        netDiscParams.m_scanDuration = 2;
+        Simulator::ScheduleWithContext(zigbeeStacks.Get(i)->GetNode()->GetId(),
+                                       Seconds(2 + (k + 1) * joinInterval),
+                                       &ZigbeeNwk::NlmeNetworkDiscoveryRequest,
+                                       zigbeeStacks.Get(i)->GetNwk(),
+                                       netDiscParams);
+    }
+    // The traffic starts 1 s after the last node started joining
+    startTime = std::max(startTime, 2 + numNodes * joinInterval);
+    g_snrOffsetStart = startTime; // The network forms on the nominal channel
 
 // ---------------------------------------------------------------------
 //todo --- Transmission and Inspection Configuration ---
 // ---------------------------------------------------------------------
-    // Modify these lines to easily change the involved nodes
-    // Note: zstackN corresponds to the Zigbee stack of Node N in the simulation (e.g., zstack0 -> Node 0)
-    Ptr<ZigbeeStack> sourceStack      = zstack2; // SOURCE NODE: Change here (e.g., zstack5)
-    Ptr<ZigbeeStack> destinationStack = zstack8; // DESTINATION NODE: Change here (e.g., zstack3)
-    Ptr<ZigbeeStack> inspectStack     = zstack4; // NODE TO INSPECT: Change here (e.g., destinationStack or zstack2)
+    // The involved nodes are set at the beginning of main (sourceNode, destinationNode, inspectNode)
+    // Note: zigbeeStacks.Get(N) is the Zigbee stack of Node N in the simulation (e.g., zigbeeStacks.Get(0) -> Node 0)
+    NS_ABORT_MSG_IF(sourceNode >= numNodes || destinationNode >= numNodes || inspectNode >= numNodes,
+                    "Source, destination and inspected nodes must be lower than the number of nodes (" << numNodes << ")");
+    Ptr<ZigbeeStack> sourceStack      = zigbeeStacks.Get(sourceNode);
+    Ptr<ZigbeeStack> destinationStack = zigbeeStacks.Get(collection ? 0 : destinationNode); // Collection: the coordinator
+    Ptr<ZigbeeStack> inspectStack     = zigbeeStacks.Get(inspectNode);
+
+    // With --numSources=N, the N-1 nodes following sourceStack (skipping the destination) also send to destinationStack
+    std::vector<Ptr<ZigbeeStack>> sourceStacks = {sourceStack};
+    for (uint32_t k = 1; k < zigbeeStacks.GetN() && sourceStacks.size() < numSources; k++)
+    {
+        Ptr<ZigbeeStack> candidate = zigbeeStacks.Get((sourceStack->GetNode()->GetId() + k) % zigbeeStacks.GetN());
+        if (candidate != destinationStack)
+        {
+            sourceStacks.push_back(candidate);
+        }
+    }
+    // Collection traffic: all the selected nodes report to the coordinator
+    if (collection)
+    {
+        sourceStacks.clear();
+        std::istringstream list(collectionSources);
+        std::string id;
+        while (std::getline(list, id, ','))
+        {
+            if (id == "all")
+            {
+                for (uint32_t k = 1; k < numNodes; k++)
+                {
+                    sourceStacks.push_back(zigbeeStacks.Get(k));
+                }
+            }
+            else
+            {
+                NS_ABORT_MSG_IF(id.empty() || id.find_first_not_of("0123456789") != std::string::npos ||
+                                    id.size() > 9 || std::stoul(id) == 0 || std::stoul(id) >= numNodes,
+                                "Invalid Node ID \"" << id << "\" in --collectionSources (1 to " << numNodes - 1
+                                                      << " or \"all\")");
+                sourceStacks.push_back(zigbeeStacks.Get(std::stoul(id)));
+            }
+        }
+        NS_ABORT_MSG_IF(sourceStacks.empty(), "No valid collection source in --collectionSources=" << collectionSources);
+    }
 
     // Log/info print to confirm the chosen configuration
     NS_LOG_INFO("--- Simulation Configuration ---");
@@ -838,145 +6908,249 @@ main(int argc, char* argv[])
     NS_LOG_INFO("Inspecting Node:  Node " << inspectStack->GetNode()->GetId() << " (" << inspectStack->GetNwk()->GetIeeeAddress() << ")");
     std::cout << "\n--------------------------------\n";
     std::cout << "--- Simulation Configuration ---\n";
-    std::cout << "Source Node:      Node " << sourceStack->GetNode()->GetId() << "\n";
-    std::cout << "Destination Node: Node " << destinationStack->GetNode()->GetId() << "\n";
+    std::cout << "Source Node:      Node " << sourceStacks[0]->GetNode()->GetId();
+    for (uint32_t k = 1; k < sourceStacks.size() && k < 20; k++)
+    {
+        std::cout << ", Node " << sourceStacks[k]->GetNode()->GetId();
+    }
+    std::cout << (sourceStacks.size() > 20 ? ", ..." : "") << " (" << sourceStacks.size() << " source(s))\n";
+    if (g_broadcastMode)
+    {
+        std::cout << "Destination:      Broadcast " << g_broadcastAddr << " (" << broadcast << ")\n";
+    }
+    else
+    {
+        std::cout << "Destination Node: Node " << destinationStack->GetNode()->GetId() << "\n";
+    }
     std::cout << "Inspecting Node:  Node " << inspectStack->GetNode()->GetId() << "\n";
     std::cout << "--------------------------------\n";
 // ---------------------------------------------------------------------
 
 //Data Transmission
-    double startTime = 12.0;    // Start sending packets
-    double interval = 0.5;      // Interval between packets (seconds)
-    int numPacketsToSend = 200; // Total number of packets to send
-        
-    NS_LOG_INFO("Scheduling " << numPacketsToSend << " packets from Node " << sourceStack->GetNode()->GetId()
-                << " to Node " << destinationStack->GetNode()->GetId() << " starting at " << startTime << "s");
-
-    for (int i = 0; i < numPacketsToSend; ++i) {
-        // Schedule sending packets at regular intervals from the source node to the destination node
-        Simulator::Schedule(Seconds(startTime + i * interval), &SendData, sourceStack, destinationStack);
-    }
-
-// ---------------------------------------------------------------------
-// --- Calculate and Print Final Results ---
-// ---------------------------------------------------------------------
-    // MAKE SURE THIS TIME IS AFTER THE LAST PACKET + POSSIBLE MAXIMUM LATENCY
-    // Example: if you send 200 packets every 0.5s starting from 12s, the last send is at 12 + 199*0.5 = 111.5s
-    // Give it more time to arrive, e.g., 120s or more.
-    double calculationTime = startTime + (numPacketsToSend * interval) + 10.0; // Added safety time
-    Simulator::Schedule(Seconds(calculationTime), []() {
-    std::cout << "\n-----------------------------------------\n";
-    std::cout << "---      Simulation Results           ---\n";
-    std::cout << "-----------------------------------------\n";
-    std::cout << "Total Packets Sent:     " << g_totalPacketsSent << "\n";
-    std::cout << "Total Packets Received: " << g_totalPacketsReceived << "\n";
+    // startTime, interval and numPacketsToSend are set at the beginning of main (they can be changed from the command line)
+    NS_LOG_INFO("Scheduling " << numPacketsToSend << " packets from each of the " << sourceStacks.size()
+                << " source(s) to Node " << destinationStack->GetNode()->GetId() << " starting at " << startTime << "s");
 
-    // Calculate Average PDR
-    double avgPdr = 0.0;
-    if (g_totalPacketsSent > 0)
+    // Many-to-one route discovery: the coordinator becomes a concentrator before the traffic starts
+    if (collection && mtoRouting)
     {
-        avgPdr = static_cast<double>(g_totalPacketsReceived) / g_totalPacketsSent;
-        std::cout << "Packet Delivery Ratio (PDR): " << avgPdr * 100.0 << " %\n";
+        Simulator::Schedule(Seconds(startTime - 0.5), &ManyToOneRouteDiscovery, zstack0, mtoInterval);
     }
-    else
+
+    // Send packets at regular intervals from the source node(s) to the destination node (sources are staggered)
+    g_sendsRemaining = numPacketsToSend * sourceStacks.size();
+    for (uint32_t k = 0; k < sourceStacks.size() && numPacketsToSend > 0; k++)
     {
-        std::cout << "PDR: N/A (No packets sent)\n";
+        ScheduleSend(sourceStacks[k],
+                     destinationStack,
+                     startTime + k * interval / sourceStacks.size(),
+                     interval,
+                     0,
+                     numPacketsToSend);
     }
-    
-    // Calculate latency metrics
-    std::cout << "--- Latency Metrics (End-to-End) ---\n";
-    if (!g_delayList.empty())
-    {
-        Time totalDelay = Seconds(0);
-        Time minDelay = g_delayList[0];
-        Time maxDelay = g_delayList[0];
 
-        // Calculate sum, min, max
-        for (const auto& delay : g_delayList) {
-            totalDelay += delay;
-            if (delay < minDelay) minDelay = delay;
-            if (delay > maxDelay) maxDelay = delay;
+    // Fault injection: scheduled faults, then random router failures during the traffic
+    NS_ABORT_MSG_IF(!ParseFaults(faults, numNodes), "Invalid --faults=" << faults);
+    if (randomFaults > 0)
+    {
+        std::vector<uint16_t> routers;
+        for (uint32_t i = 1; i < numNodes; i++)
+        {
+            if (IsRouterNode(i))
+            {
+                routers.push_back(i);
+            }
         }
-
-        // Calculate average
-        Time avgDelay = totalDelay / g_delayList.size();
-
-        // Calculate Jitter (as standard deviation of latency in seconds)
-        double sumSquaredDiff = 0.0;
-        double avgDelaySec = avgDelay.GetSeconds();
-        for (const auto& delay : g_delayList) {
-            double delaySec = delay.GetSeconds();
-            sumSquaredDiff += (delaySec - avgDelaySec) * (delaySec - avgDelaySec);
+        NS_ABORT_MSG_IF(routers.empty(), "--randomFaults requires routers");
+        Ptr<UniformRandomVariable> faultRng = CreateObject<UniformRandomVariable>();
+        faultRng->SetStream(STREAM_FAULTS);
+        for (uint32_t k = 0; k < randomFaults; k++)
+        {
+            FaultEvent fault;
+            fault.a = routers[faultRng->GetInteger(0, routers.size() - 1)];
+            fault.start = faultRng->GetValue(startTime, startTime + 0.8 * numPacketsToSend * interval);
+            fault.duration = (randomFaultDuration > 0) ? randomFaultDuration : -1.0;
+            g_faults.push_back(fault);
         }
-        double variance = sumSquaredDiff / g_delayList.size();
-        double jitter = std::sqrt(variance);
-
-        std::cout << "Average Delay: " << avgDelay.GetSeconds() << " s\n";
-        std::cout << "Minimum Delay: " << minDelay.GetSeconds() << " s\n";
-        std::cout << "Maximum Delay: " << maxDelay.GetSeconds() << " s\n";
-        std::cout << "Jitter (StdDev): " << jitter << " s\n";
-        std::cout << "(Based on " << g_delayList.size() << " successfully received packets)\n";
     }
-    else
+    for (uint32_t k = 0; k < g_faults.size(); k++)
     {
-        std::cout << "Average Delay: N/A\n";
-        std::cout << "Minimum Delay: N/A\n";
-        std::cout << "Maximum Delay: N/A\n";
-        std::cout << "Jitter (StdDev): N/A\n";
-        std::cout << "(No packets received successfully to calculate latency)\n";
+        Simulator::Schedule(Seconds(g_faults[k].start), &StartFault, k);
     }
-    std::cout << "-------------------------------------------\n";
-    });
-    
+
+// ---------------------------------------------------------------------
+// --- Calculate and Print Final Results ---
+// ---------------------------------------------------------------------
+    // The run ends as soon as every packet is resolved (received, dropped or timed out, see CheckCompletion).
+    // calculationTime is only the upper bound (or the fixed end time with --stopOnCompletion=0):
+    // MAKE SURE THIS TIME IS AFTER THE LAST PACKET + POSSIBLE MAXIMUM LATENCY
+    // Example: if you send 200 packets every 0.5s starting from 12s, the last send is at 12 + 199*0.5 = 111.5s
+    double calculationTime = startTime + (numPacketsToSend * interval) + 10.0; // Added safety time
+
     //Print TABLES
     // Choose the node to inspect
     Ptr<ZigbeeStack> nodeToInspect = inspectStack;
-    // Choose a time shortly before the final results
-    double tablePrintTime = calculationTime - 0.5; // Print half a second before results
-    // Make sure the time is not too early if calculationTime is very close to the last send
-    if (tablePrintTime < startTime + (numPacketsToSend * interval)) {
-        tablePrintTime = calculationTime; // Otherwise, print at the same time as results
-    }
     // Log/info print to confirm the chosen configuration before simulation
-    NS_LOG_INFO("Scheduling final tables print for Node " << nodeToInspect->GetNode()->GetId()
-                << " at T=" << tablePrintTime << " s");
-    std::cout << "INFO: Scheduling final tables print for Node " << nodeToInspect->GetNode()->GetId()
-              << " at T=" << tablePrintTime << " s\n";
+    NS_LOG_INFO("Final tables print for Node " << nodeToInspect->GetNode()->GetId()
+                << " when all packets are resolved (at the latest at T=" << calculationTime << " s)");
+    std::cout << "INFO: Final tables print for Node " << nodeToInspect->GetNode()->GetId()
+              << " when all packets are resolved (at the latest at T=" << calculationTime << " s)\n";
     std::cout << "----------------------------------------------------------\n";
 
     // Create the output stream wrapper for std::cout (necessary for Print* functions)
     Ptr<OutputStreamWrapper> stream = Create<OutputStreamWrapper>(&std::cout);
 
-    // ---Schedule printing a line before printing the tables---
-    Simulator::Schedule(Seconds(tablePrintTime), [nodeToInspect]() { 
-        std::cout << "----  END TRANSMISSION  ----\n"; 
-        std::cout << "\n-----------------------------------------\n"; 
-        std::cout << "---         Tables for Node " << nodeToInspect->GetNode()->GetId() 
-                  << "         ---\n"; 
-        std::cout << "-----------------------------------------\n"; 
-    });  
-
-    // Print the NEIGHBOR TABLE at the end of all packet transmissions
-    Simulator::Schedule(Seconds(tablePrintTime),
-                        &ZigbeeNwk::PrintNeighborTable,
-                        nodeToInspect->GetNwk(),
-                        stream);
-    // Print the ROUTING TABLE at the end of all packet transmissions
-    Simulator::Schedule(Seconds(tablePrintTime + 0.01), 
-                        &ZigbeeNwk::PrintRoutingTable,
-                        nodeToInspect->GetNwk(),
-                        stream);
+    // ---Print a line before printing the tables---
+    g_finalReports.push_back([nodeToInspect]() {
+        std::cout << "----  END TRANSMISSION  ----\n";
+        std::cout << "\n-----------------------------------------\n";
+        std::cout << "---         Tables for Node " << nodeToInspect->GetNode()->GetId()
+                  << "         ---\n";
+        std::cout << "-----------------------------------------\n";
+    });
+
+    // Print the NEIGHBOR TABLE and the ROUTING TABLE at the end of all packet transmissions
+    g_finalReports.push_back([nodeToInspect, stream]() {
+        nodeToInspect->GetNwk()->PrintNeighborTable(stream);
+        nodeToInspect->GetNwk()->PrintRoutingTable(stream);
+    });
     //!Print the ROUTE DISCOVERY TABLE immediately after sending the first packet
     Simulator::Schedule(Seconds(startTime + 0.72), 
                         &ZigbeeNwk::PrintRouteDiscoveryTable,
                         nodeToInspect->GetNwk(),
                         stream);
 
-    // Schedule TraceRoute via the Wrapper function
-    Simulator::Schedule(Seconds(tablePrintTime + 0.03), // Keep the same time or adjust if needed
-                       &ScheduleTraceRouteWrapper,      // Call the NEW wrapper function
-                       sourceStack,                     // Pass the POINTER to the source stack
-                       destinationStack);                // Pass the POINTER to the destination stack
+    // Periodic snapshots of the tables of ALL nodes (delta encoded, see TakeTableSnapshot)
+    if (snapshotInterval > 0)
+    {
+        g_snapshotStream.open(snapshotFile, std::ios::binary | std::ios::trunc);
+        if (g_snapshotStream)
+        {
+            g_snapshotStream.write("ZSNP", 4);
+            g_snapshotStream.put(2); // Format version (2: rows keep their printed order)
+            Simulator::Schedule(Seconds(snapshotInterval), &TakeTableSnapshot, snapshotInterval);
+            std::cout << "INFO: Table snapshots of all nodes every " << snapshotInterval << " s in " << snapshotFile << "\n";
+        }
+        else
+        {
+            std::cout << "WARN: Unable to open " << snapshotFile << ", table snapshots disabled.\n";
+        }
+    }
+
+    // Time-series of the metrics per window, from the first packet sent
+    if (metricsWindow > 0)
+    {
+        g_metricsStream.open(metricsFile, std::ios::trunc);
+        if (g_metricsStream)
+        {
+            g_metricsStream << "t_start,t_end,sent,received,lost,outstanding,goodput_bps,delay_p50,delay_p90,delay_p99,delay_max\n";
+            g_windowStart = Seconds(startTime);
+            Simulator::Schedule(Seconds(startTime + metricsWindow), &SampleMetricsWindow, metricsWindow);
+            g_finalReports.push_back([metricsFile]() {
+                WriteMetricsWindow(); // Last (partial) window
+                g_metricsStream.close();
+                std::cout << "INFO: " << g_metricsWindows << " metrics windows written to " << metricsFile << "\n";
+            });
+            std::cout << "INFO: Metrics time-series with " << metricsWindow << " s windows in " << metricsFile << "\n";
+        }
+        else
+        {
+            std::cout << "WARN: Unable to open " << metricsFile << ", metrics time-series disabled.\n";
+        }
+    }
+
+    // TraceRoute via the Wrapper function
+    g_finalReports.push_back([sourceStack = sourceStacks[0], destinationStack]() {
+        ScheduleTraceRouteWrapper(sourceStack, destinationStack);
+    });
+
+    // Periodic network-wide route consistency checks (loops and black holes), from the first packet sent
+    if (routeCheckInterval > 0)
+    {
+        Simulator::Schedule(Seconds(startTime), &CheckRouteConsistency, routeCheckInterval);
+        g_finalReports.push_back(&PrintRouteConsistencySummary);
+    }
+
+    // Compare the discovered routes with the shortest paths of the physical topology
+    if (routeOptimality)
+    {
+        g_finalReports.push_back(&AnalyzeRouteOptimality);
+    }
+
+    // Airtime of every node and goodput of every flow, measured from the first packet sent
+    Simulator::Schedule(Seconds(startTime), &ResetAirtimeStats);
+    g_finalReports.push_back(&PrintAirtimeReport);
+
+    // Routing table sizes and control overhead of the collection traffic
+    if (collection)
+    {
+        g_finalReports.push_back(&PrintCollectionReport);
+    }
+
+    // Coverage, completion latency and rebroadcasts of the broadcast traffic
+    if (g_broadcastMode)
+    {
+        g_finalReports.push_back(&PrintBroadcastReport);
+    }
+
+    // Round-trip times, response loss and asymmetry of the request/response exchanges
+    if (g_respond)
+    {
+        g_finalReports.push_back(&PrintResponseReport);
+    }
+
+    // Delivery ratio after retries, extra latency and airtime overhead of the APS acknowledged delivery
+    if (g_aps)
+    {
+        g_finalReports.push_back(&PrintApsReport);
+    }
+
+    // Frames and delay of the in-network aggregation
+    if (g_aggregation)
+    {
+        g_finalReports.push_back(&PrintAggregationReport);
+    }
+
+    // Batches sent by the sources
+    if (g_batching)
+    {
+        g_finalReports.push_back(&PrintBatchingReport);
+    }
+
+    // Depth distribution of the tree and its effect on hops and latency
+    if (g_parentPolicy != "first")
+    {
+        g_finalReports.push_back(&PrintTreeReport);
+    }
+
+    // Real forwarding paths of the tracked packets, per flow
+    g_finalReports.push_back(&PrintDataPathReport);
+    if (anySleepy)
+    {
+        // Parent buffering, polls and duty cycle of the sleepy end devices
+        g_finalReports.push_back(&PrintSleepyReport);
+    }
+    if (!g_faults.empty())
+    {
+        // Route repair and recovery after the injected faults
+        g_finalReports.push_back(&PrintFaultReport);
+    }
+    if (g_rareEventEffort > 0)
+    {
+        // Loss probability of the dominant paths, down to rare events, validated with brute-force child runs of the
+        // worst flow alone (the options that add traffic, faults or end-to-end retries are not forwarded)
+        SetChildCommand(argc, argv, {"rareEvent", "snrOffset", "rxSensitivity", "numPackets", "numSources", "rngRun",
+                                     "collection", "sourceNode", "destinationNode", "faults", "randomFault",
+                                     "earlyStop", "aps", "respond", "broadcast", "aggregation", "batching", "jobs"});
+        g_finalReports.push_back(&PrintRareEventReport);
+    }
+
+    // Final performance metrics
+    g_finalReports.push_back(&PrintSimulationResults);
+    g_finalReports.push_back(&PrintConfidenceIntervals);
+    g_finalReports.push_back(&PrintWarmupReport);
+    g_finalReports.push_back(&PrintRunSummary);
+    Simulator::Schedule(Seconds(calculationTime), &RunFinalReports);
 
 // --------------------------------------------------------------------
 // --- Animation & Tracing ---
@@ -1002,9 +7176,17 @@ main(int argc, char* argv[])
 //---------------------------------------------------------------------
 
 // --- Simulation Control ---
+    // RunFinalReports stops the simulation; this is only a safety net
     double stopTime = calculationTime + 5.0; // Ensure simulation ends AFTER calculation
     Simulator::Stop(Seconds(stopTime));
     Simulator::Run();
     Simulator::Destroy();
+
+    if (g_snapshotStream.is_open())
+    {
+        g_snapshotStream.close();
+        std::cout << "INFO: " << g_snapshotCount << " table snapshots written to " << snapshotFile
+                  << " (" << g_snapshotRowIds.size() << " distinct rows)\n";
+    }
     return 0;
 }